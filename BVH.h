@@ -0,0 +1,299 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "Sphere.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// A group of up to 64 rays traced together, e.g. the camera rays of an 8x8 pixel tile.
+// Whole subtrees are culled for the packet with interval arithmetic over the rays' origins and inverse directions.
+template <typename T>
+struct RayPacket {
+	static const int maxRays = 64;
+
+	int count = 0;
+	RayT<T> rays[maxRays];
+	Vec3T<T> inverseDirection[maxRays];
+	T tMax[maxRays];
+	int64_t hitIndex[maxRays];		// primitive hit by each ray, -1 for none
+
+	// bounds over all rays, only valid when `coherent`
+	T originMin[3], originMax[3];
+	T inverseMin[3], inverseMax[3];
+	T packetTMax;
+	bool coherent;					// every direction component has the same, nonzero sign across the packet
+
+	void Clear() { count = 0; }
+
+	void Add(const RayT<T>& r) {
+		rays[count] = r;
+		tMax[count] = std::numeric_limits<T>::infinity();
+		hitIndex[count] = -1;
+		count++;
+	}
+
+	// call after adding the rays, before traversal
+	void Prepare() {
+		coherent = true;
+		for (int axis = 0; axis < 3; axis++) {
+			originMin[axis] = inverseMin[axis] = std::numeric_limits<T>::infinity();
+			originMax[axis] = inverseMax[axis] = -std::numeric_limits<T>::infinity();
+		}
+
+		for (int i = 0; i < count; i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				T d = rays[i].direction.e[axis];
+				inverseDirection[i].e[axis] = 1 / d;
+				originMin[axis] = std::min(originMin[axis], rays[i].origin.e[axis]);
+				originMax[axis] = std::max(originMax[axis], rays[i].origin.e[axis]);
+				inverseMin[axis] = std::min(inverseMin[axis], inverseDirection[i].e[axis]);
+				inverseMax[axis] = std::max(inverseMax[axis], inverseDirection[i].e[axis]);
+			}
+		}
+
+		for (int axis = 0; axis < 3; axis++)
+			coherent = coherent && count > 0 && (inverseMin[axis] > 0 || inverseMax[axis] < 0) && std::isfinite(inverseMin[axis]) && std::isfinite(inverseMax[axis]);
+		UpdateTMax();
+	}
+
+	void UpdateTMax() {
+		packetTMax = 0;
+		for (int i = 0; i < count; i++)
+			packetTMax = std::max(packetTMax, tMax[i]);
+	}
+
+	// conservative: true only if no ray of the packet can enter the box within (tMin, tMax)
+	bool Misses(const T boxMin[3], const T boxMax[3], T tMin) const {
+		if (!coherent)
+			return false;
+
+		T entry = tMin;
+		T exit = packetTMax;
+		for (int axis = 0; axis < 3; axis++) {
+			// the slab entered first depends on the shared direction sign
+			T nearPlane = inverseMin[axis] > 0 ? boxMin[axis] : boxMax[axis];
+			T farPlane = inverseMin[axis] > 0 ? boxMax[axis] : boxMin[axis];
+
+			T lo, hi;
+			IntervalProduct(nearPlane - originMax[axis], nearPlane - originMin[axis], inverseMin[axis], inverseMax[axis], lo, hi);
+			entry = std::max(entry, lo);
+			IntervalProduct(farPlane - originMax[axis], farPlane - originMin[axis], inverseMin[axis], inverseMax[axis], lo, hi);
+			exit = std::min(exit, hi);
+		}
+		return entry > exit;
+	}
+
+	// slab test of one ray
+	bool Hits(int i, const T boxMin[3], const T boxMax[3], T tMin) const {
+		T entry = tMin;
+		T exit = tMax[i];
+		for (int axis = 0; axis < 3; axis++) {
+			T t0 = (boxMin[axis] - rays[i].origin.e[axis]) * inverseDirection[i].e[axis];
+			T t1 = (boxMax[axis] - rays[i].origin.e[axis]) * inverseDirection[i].e[axis];
+			entry = std::max(entry, std::min(t0, t1));
+			exit = std::min(exit, std::max(t0, t1));
+		}
+		return entry <= exit;
+	}
+
+private:
+	static void IntervalProduct(T aLo, T aHi, T bLo, T bHi, T& lo, T& hi) {
+		T p0 = aLo * bLo, p1 = aLo * bHi, p2 = aHi * bLo, p3 = aHi * bHi;
+		lo = std::min(std::min(p0, p1), std::min(p2, p3));
+		hi = std::max(std::max(p0, p1), std::max(p2, p3));
+	}
+};
+
+// Bounding volume hierarchy over spheres.
+// Build reorders the spheres so every leaf is a contiguous range of at most maxLeafSpheres.
+template <typename T>
+class SphereBVH {
+public:
+	static const int maxLeafSpheres = 4;
+
+	struct Node {
+		T boundsMin[3];
+		T boundsMax[3];
+		uint32_t first;		// first sphere of a leaf, or the left child; the right child follows it
+		uint16_t count;		// spheres in a leaf, 0 for an inner node
+		uint16_t axis;		// split axis of an inner node
+	};
+
+	void Clear() {
+		nodes.clear();
+		spheres = nullptr;
+	}
+
+	bool IsEmpty() const { return nodes.empty(); }
+
+	size_t GetBytes() const { return nodes.capacity() * sizeof(Node); }
+
+	// the vector must outlive the hierarchy and not change size
+	void Build(std::vector<SphereT<T>>& _spheres) {
+		Clear();
+		spheres = &_spheres;
+		if (_spheres.empty())
+			return;
+
+		nodes.reserve(2 * _spheres.size() / maxLeafSpheres + 1);
+		nodes.push_back(Node());
+		Subdivide(0, 0, static_cast<uint32_t>(_spheres.size()));
+	}
+
+	// index of the closest sphere hit within (tMin, tMax), or -1; tMax is lowered to its distance
+	int64_t Intersect(const RayT<T>& r, T tMin, T& tMax) const {
+		Vec3T<T> inverse(1 / r.direction.e[0], 1 / r.direction.e[1], 1 / r.direction.e[2]);
+		int64_t closest = -1;
+		RayHitT<T> hit;
+		uint64_t steps = 0;
+
+		uint32_t stack[64];
+		int top = 0;
+		stack[top++] = 0;
+
+		while (top > 0) {
+			const Node& node = nodes[stack[--top]];
+			RENDER_STAT(nodeVisits++);
+			steps++;
+			if (!HitsBox(r, inverse, node, tMin, tMax))
+				continue;
+
+			if (node.count > 0) {
+				steps += node.count;
+				for (uint32_t i = node.first; i < node.first + node.count; i++) {
+					if ((*spheres)[i].Intersect(r, IntervalT<T>(tMin, tMax), hit)) {
+						tMax = hit.t;
+						closest = i;
+					}
+				}
+				continue;
+			}
+
+			// visit the child on the ray's side of the split first
+			bool leftFirst = r.direction.e[node.axis] > 0;
+			stack[top++] = leftFirst ? node.first + 1 : node.first;
+			stack[top++] = leftFirst ? node.first : node.first + 1;
+		}
+
+		TraversalSteps() += steps;
+		return closest;
+	}
+
+	// finds the closest sphere of every ray in the packet, writing hitIndex and tMax
+	void IntersectPacket(RayPacket<T>& packet, T tMin) const {
+		packet.Prepare();
+
+		// each entry carries the first ray that may still hit the node, rays before it missed an ancestor
+		struct Entry { uint32_t node; int firstActive; };
+		Entry stack[64];
+		int top = 0;
+		stack[top++] = { 0, 0 };
+		RayHitT<T> hit;
+
+		while (top > 0) {
+			Entry entry = stack[--top];
+			const Node& node = nodes[entry.node];
+			RENDER_STAT(nodeVisits++);
+
+			// whole packet cull, then find the first ray that actually hits
+			if (packet.Misses(node.boundsMin, node.boundsMax, tMin))
+				continue;
+			int first = entry.firstActive;
+			while (first < packet.count && !packet.Hits(first, node.boundsMin, node.boundsMax, tMin))
+				first++;
+			if (first == packet.count)
+				continue;
+
+			if (node.count > 0) {
+				for (uint32_t s = node.first; s < node.first + node.count; s++) {
+					const SphereT<T>& sphere = (*spheres)[s];
+
+					// packet-vs-sphere cull on the sphere's bounding box
+					T sphereMin[3], sphereMax[3];
+					for (int axis = 0; axis < 3; axis++) {
+						sphereMin[axis] = sphere.GetCenter().e[axis] - sphere.GetRadius();
+						sphereMax[axis] = sphere.GetCenter().e[axis] + sphere.GetRadius();
+					}
+					if (packet.Misses(sphereMin, sphereMax, tMin))
+						continue;
+
+					for (int i = first; i < packet.count; i++) {
+						if (sphere.Intersect(packet.rays[i], IntervalT<T>(tMin, packet.tMax[i]), hit)) {
+							packet.tMax[i] = hit.t;
+							packet.hitIndex[i] = s;
+						}
+					}
+				}
+				packet.UpdateTMax();
+				continue;
+			}
+
+			bool leftFirst = packet.rays[first].direction.e[node.axis] > 0;
+			stack[top++] = { leftFirst ? node.first + 1 : node.first, first };
+			stack[top++] = { leftFirst ? node.first : node.first + 1, first };
+		}
+	}
+
+private:
+	std::vector<Node> nodes;
+	std::vector<SphereT<T>>* spheres = nullptr;
+
+	static bool HitsBox(const RayT<T>& r, const Vec3T<T>& inverse, const Node& node, T tMin, T tMax) {
+		for (int axis = 0; axis < 3; axis++) {
+			T t0 = (node.boundsMin[axis] - r.origin.e[axis]) * inverse.e[axis];
+			T t1 = (node.boundsMax[axis] - r.origin.e[axis]) * inverse.e[axis];
+			tMin = std::max(tMin, std::min(t0, t1));
+			tMax = std::min(tMax, std::max(t0, t1));
+		}
+		return tMin <= tMax;
+	}
+
+	// median split on the longest axis of the sphere centres
+	void Subdivide(uint32_t index, uint32_t first, uint32_t count) {
+		std::vector<SphereT<T>>& list = *spheres;
+
+		T centerMin[3], centerMax[3];
+		for (int axis = 0; axis < 3; axis++) {
+			nodes[index].boundsMin[axis] = centerMin[axis] = std::numeric_limits<T>::infinity();
+			nodes[index].boundsMax[axis] = centerMax[axis] = -std::numeric_limits<T>::infinity();
+		}
+		for (uint32_t i = first; i < first + count; i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				T c = list[i].GetCenter().e[axis];
+				nodes[index].boundsMin[axis] = std::min(nodes[index].boundsMin[axis], c - list[i].GetRadius());
+				nodes[index].boundsMax[axis] = std::max(nodes[index].boundsMax[axis], c + list[i].GetRadius());
+				centerMin[axis] = std::min(centerMin[axis], c);
+				centerMax[axis] = std::max(centerMax[axis], c);
+			}
+		}
+
+		if (count <= maxLeafSpheres) {
+			nodes[index].first = first;
+			nodes[index].count = static_cast<uint16_t>(count);
+			nodes[index].axis = 0;
+			return;
+		}
+
+		int axis = 0;
+		for (int a = 1; a < 3; a++)
+			if (centerMax[a] - centerMin[a] > centerMax[axis] - centerMin[axis])
+				axis = a;
+
+		uint32_t half = count / 2;
+		std::nth_element(list.begin() + first, list.begin() + first + half, list.begin() + first + count,
+			[axis](const SphereT<T>& a, const SphereT<T>& b) { return a.GetCenter().e[axis] < b.GetCenter().e[axis]; });
+
+		uint32_t left = static_cast<uint32_t>(nodes.size());
+		nodes.push_back(Node());
+		nodes.push_back(Node());
+		nodes[index].first = left;
+		nodes[index].count = 0;
+		nodes[index].axis = static_cast<uint16_t>(axis);
+
+		Subdivide(left, first, half);
+		Subdivide(left + 1, first + half, count - half);
+	}
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Keeps the compiler from discarding a value computed by a benchmark body.
+template <typename T>
+inline void KeepValue(const T& value) {
+#if defined(_MSC_VER)
+	static const void* volatile sink;
+	sink = &value;
+	_ReadWriteBarrier();
+#else
+	asm volatile("" : : "m"(value) : "memory");
+#endif
+}
+
+// Timings of one benchmark, every figure in nanoseconds per operation.
+struct BenchmarkResult {
+	std::string name;
+	uint64_t iterations = 0;	// operations per timed run
+	int runs = 0;
+	double mean = 0;
+	double min = 0;
+	double p50 = 0;
+	double p90 = 0;
+	double p99 = 0;
+	double max = 0;
+
+	double GetOpsPerSecond() const { return p50 > 0 ? 1e9 / p50 : 0; }
+};
+
+// Runs benchmark bodies: calibrates how many operations make one run of at least minRunSeconds,
+// warms up, then times a number of runs and reports percentiles over their per-operation times.
+// A body is called as body(iterations) and has to perform that many operations.
+class BenchmarkSuite {
+public:
+	int warmupRuns = 3;
+	int runs = 30;
+	double minRunSeconds = 0.005;
+	std::string filter;				// only benchmarks whose name contains this run
+
+	template <typename Body>
+	void Run(const char* name, Body&& body) {
+		if (!filter.empty() && strstr(name, filter.c_str()) == nullptr)
+			return;
+
+		// double the run length until it is long enough to time reliably
+		uint64_t iterations = 1;
+		while (TimeRun(body, iterations) < minRunSeconds * 1e9 && iterations < (1ull << 40))
+			iterations *= 2;
+
+		for (int i = 0; i < warmupRuns; i++)
+			TimeRun(body, iterations);
+
+		std::vector<double> samples(runs);
+		for (double& sample : samples)
+			sample = TimeRun(body, iterations) / static_cast<double>(iterations);
+		std::sort(samples.begin(), samples.end());
+
+		BenchmarkResult result;
+		result.name = name;
+		result.iterations = iterations;
+		result.runs = runs;
+		for (double sample : samples)
+			result.mean += sample / runs;
+		result.min = samples.front();
+		result.p50 = Percentile(samples, 0.50);
+		result.p90 = Percentile(samples, 0.90);
+		result.p99 = Percentile(samples, 0.99);
+		result.max = samples.back();
+		results.push_back(result);
+
+		if (log)
+			PrintResult(*log, result);
+	}
+
+	// text results are written as benchmarks finish when set
+	void SetLog(std::ostream* _log) {
+		log = _log;
+		if (log) {
+			char line[160];
+			snprintf(line, sizeof(line), "%-32s %12s %14s %10s %10s %10s\n", "benchmark", "ns/op", "ops/s", "p90", "p99", "max");
+			*log << line;
+		}
+	}
+
+	const std::vector<BenchmarkResult>& GetResults() const { return results; }
+
+	void WriteJson(std::ostream& out, const std::vector<std::pair<std::string, std::string>>& context) const {
+		out << "{\n  \"context\": {";
+		for (size_t i = 0; i < context.size(); i++)
+			out << (i ? ", " : " ") << "\"" << context[i].first << "\": \"" << context[i].second << "\"";
+		out << " },\n  \"benchmarks\": [\n";
+
+		for (size_t i = 0; i < results.size(); i++) {
+			const BenchmarkResult& r = results[i];
+			char line[512];
+			snprintf(line, sizeof(line),
+				"    { \"name\": \"%s\", \"iterations\": %llu, \"runs\": %d, \"ns_per_op\": %.4f, \"ops_per_sec\": %.1f, "
+				"\"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+				r.name.c_str(), static_cast<unsigned long long>(r.iterations), r.runs, r.p50, r.GetOpsPerSecond(),
+				r.mean, r.min, r.p50, r.p90, r.p99, r.max, i + 1 < results.size() ? "," : "");
+			out << line;
+		}
+		out << "  ]\n}\n";
+	}
+
+private:
+	std::vector<BenchmarkResult> results;
+	std::ostream* log = nullptr;
+
+	template <typename Body>
+	static double TimeRun(Body& body, uint64_t iterations) {
+		auto start = std::chrono::high_resolution_clock::now();
+		body(iterations);
+		auto end = std::chrono::high_resolution_clock::now();
+		return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	}
+
+	// nearest rank on sorted samples
+	static double Percentile(const std::vector<double>& sorted, double p) {
+		size_t rank = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+		return sorted[std::min(rank, sorted.size() - 1)];
+	}
+
+	static void PrintResult(std::ostream& out, const BenchmarkResult& r) {
+		char line[160];
+		snprintf(line, sizeof(line), "%-32s %12.3f %14.0f %10.3f %10.3f %10.3f\n", r.name.c_str(), r.p50, r.GetOpsPerSecond(), r.p90, r.p99, r.max);
+		out << line;
+	}
+};
@@ -3,20 +3,38 @@
 #include "RTWeekend.h"
 
 #include "Hittable.h"
+#include "HittableList.h"
+#include "Sphere.h"
+#include "FlatScene.h"
+#include "Material.h"
 #include "Texture.h"
+#include "ImageSink.h"
+#include "Framebuffer.h"
+#include "CostMap.h"
+#include "DependencyMap.h"
+#include "Resolve.h"
 #include "PixelColor.h"
-
+#include "PerfCounters.h"
+#include "RenderStats.h"
+#include "Trace.h"
+#include "Wavefront.h"
+#include "RenderJob.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
 #include <chrono>
 #include <thread>
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 using namespace std::chrono;
 
-class Material;
-
-std::string NanoToHHMMSS(nanoseconds time)
+inline std::string NanoToHHMMSS(nanoseconds time)
 {
 	const auto hrs = duration_cast<hours>(time);
 	const auto mins = duration_cast<minutes>(time - hrs);
@@ -58,69 +76,181 @@ public:
 	double defocusAngle = 0;				// Variation angle of rays through each pixel
 	double focusDist = 10;					// Distance from camera lookfrom point to plane of perfect focus
 
-	Camera(shared_ptr<Texture> _outputTexture) : outputTexture(_outputTexture) { }
+	ResolveSettings resolve;				// Exposure, tonemapping and transfer curve used for the 8-bit output
+
+	shared_ptr<TiledFramebuffer> accumulationBuffer;	// Optional; samples are added to those already stored and the running mean is output
+	shared_ptr<CostMap> costMap;			// Optional; records the cycles, traversal steps and rays of every pixel, traced one ray at a time
+	shared_ptr<DependencyMap> dependencyMap;	// Optional; only its dirty pixels are traced, one ray at a time, recording what their paths hit
+
+	bool specializedKernels = true;			// Use a render loop compiled for the scene's primitive kinds and these settings when one exists
+	bool singlePrecision = false;			// Trace paths in float, only available with the specialized kernels
+	uint64_t seed = 0;						// Nonzero makes each row's random numbers repeatable regardless of thread scheduling
+	int packetSize = 8;						// 4 or 8 traces camera rays in packets of that many pixels square, 0 traces them one by one
+	bool wavefront = false;					// Move batches of paths through separate intersect and per-material shade stages instead
+	int wavefrontSize = 1 << 16;			// Paths per wavefront queue, bands and samples are split to fit
+	bool verbose = true;					// Progress and summary lines on std::clog
+	int threadCount = 0;					// Worker threads, 0 for one per hardware thread
+	bool keepPartialImage = false;			// RenderAsync keeps a copy of the finished rows for RenderJob::GetPartialImage
+	std::function<void(const RenderProgress&)> onProgress;	// Called from the workers, one call at a time, after each finished band
+	shared_ptr<WorkerPool> workerPool;		// Renders on this pool's workers instead of on threads of its own
+	JobSchedule schedule;					// Priority, weight and deadline of renders on the workerPool
+	shared_ptr<const FlatScene<Sphere>> flatScene;			// Flat copy of the world gathered ahead of time, skips gathering it every render
+	shared_ptr<const FlatScene<Spheref>> flatSceneFloat;	// The same for singlePrecision
+	uint64_t reorderBounces = 0;			// Wavefront only: bit d sorts the rays of bounce d by direction octant and origin before they are traced
+
+	Camera(shared_ptr<Texture> _outputTexture)
+		: Camera(_outputTexture->GetResolutionX(), _outputTexture->GetResolutionY(), _outputTexture) { }
+
+	// rows are handed to the sink as they finish, so no full image buffer is required
+	Camera(int _imageWidth, int _imageHeight, shared_ptr<ImageSink> _output)
+		: imageWidth(_imageWidth), imageHeight(_imageHeight), output(_output) { }
+
+	// renders and waits, printing progress and a summary when verbose
+	// returns function's success
+	bool Render(const Hittable& world, const MaterialTable& materials) {
+		TraceScope traceRender("render");
+		shared_ptr<RenderJob> job = RenderAsync(world, materials);
+		if (verbose && !kernelName.empty())
+			std::clog << "Kernel: " << kernelName << "\n";
 
-	void Render(const Hittable& world) {
-		Initialize();
+		// update console as rows are completed
+		for (RenderProgress progress = job->GetProgress(); !job->IsDone();) {
+			progress = job->WaitForProgress(progress.completedRows);
+			if (verbose && !job->IsDone()) {
+				const auto estimateTime = duration_cast<nanoseconds>(duration<double>(progress.remainingSeconds));
+				std::clog << "\rScanlines remaining: " << progress.totalRows - progress.completedRows << "   estimated remaining time: "
+					<< NanoToHHMMSS(estimateTime) << "     " << std::flush;
+			}
+		}
 
-		int maxX = outputTexture->GetResolutionX();
-		int maxY = outputTexture->GetResolutionY();
+		bool success = job->Wait();
+		if (verbose && !kernelName.empty()) {
+			std::clog << "\rDone in " << NanoToHHMMSS(duration_cast<nanoseconds>(duration<double>(renderSeconds))) << std::string(64, ' ') << "\n";
+			std::clog << "Rays: " << rayCount / 1e6 << " M, " << rayCount / 1e6 / renderSeconds << " Mrays/s\n";
+			std::clog << "Threads: " << usedThreads << ", " << syncCycles / 1e6 << " Mcycles synchronising, "
+				<< idleSeconds * 1000 << " ms idle after their last band\n";
+			if (perfCounters.IsAvailable()) {
+				uint64_t misses = perfCounters.Get(PerfCounters::CacheMisses);
+				uint64_t references = perfCounters.Get(PerfCounters::CacheReferences);
+				std::clog << "Cache: " << misses / 1e6 << " M misses of " << references / 1e6 << " M references, "
+					<< (rayCount ? static_cast<double>(misses) / rayCount : 0.0) << " misses/ray\n";
+			}
+			if (wavefront)
+				wavefrontStats.Print(std::clog);
+			if (costMap)
+				costMap->Print(std::clog);
+#if RENDER_STATS
+			renderStats.PrintText(std::clog);
+#endif
+		}
+		return success;
+	}
 
-		totalThreadTime_ns = nanoseconds::zero();
-		completedRows = 0;
+	// Starts a render on the worker threads and returns at once. The job reports progress, can be cancelled between bands,
+	// and completes with the same result Render would return. The scene and materials must stay alive until it is done,
+	// and a camera renders one job at a time; starting another while one runs gives a job that failed.
+	shared_ptr<RenderJob> RenderAsync(const Hittable& world, const MaterialTable& materials) {
+		shared_ptr<RenderJob> job(new RenderJob(imageWidth, imageHeight, keepPartialImage));
+		shared_ptr<RenderJob> running = currentJob.lock();
+		if (running && !running->IsDone()) {
+			job->Complete(false);
+			return job;
+		}
+		currentJob = job;
+		activeJob = job.get();
 
-		auto startRenderTime_ns = high_resolution_clock::now();
+		Initialize();
 
-		const auto processor_count = std::thread::hardware_concurrency();
-		std::thread* workers = new std::thread[processor_count];
+		int maxX = imageWidth;
+		int maxY = imageHeight;
+
+		kernelName.clear();
+		rayCount = 0;
+		wavefrontStats.Reset();
+		outputFailed = false;
+#if RENDER_STATS
+		renderStats.Reset();
+#endif
+
+		if ((accumulationBuffer && (accumulationBuffer->GetResolutionX() != maxX || accumulationBuffer->GetResolutionY() != maxY))
+			|| (costMap && (costMap->GetWidth() != maxX || costMap->GetHeight() != maxY))
+			|| (dependencyMap && (dependencyMap->GetWidth() != maxX || dependencyMap->GetHeight() != maxY || accumulationBuffer))
+			|| !output->Begin(maxX, maxY)) {
+			job->Complete(false);
+			return job;
+		}
 
-		std::atomic_uint32_t rowCounter(0);
-		for (auto i = 0; i < processor_count; i++)
-			workers[i] = std::thread(&Camera::RenderRow, this, std::ref(rowCounter), maxY, maxX, std::ref(world));
+		RowWorker renderRows;
+		{
+			// gathers the spheres and builds the hierarchy of the flat scenes
+			TraceScope traceSelect("select kernel");
+			renderRows = SelectKernel(world, materials, job->flatWorld, job->flatWorldFloat);
+		}
 
-		// update console as rows are completed
-		while (true) {
-			nanoseconds partialTime = totalThreadTime_ns;
-			uint32_t partialRows = completedRows;
-
-			{
-				// lock before accessing global timer
-				std::unique_lock<std::mutex> lk(timer_mutex);
-
-				// break out of update loop if rendering has finished
-				if (completedRows >= maxY)
-					break;
-
-				// wait for a row to finish
-				cv.wait(lk);
-				// clone timer state
-				partialTime = totalThreadTime_ns;
-				partialRows = completedRows;
+		const int processor_count = threadCount > 0 ? threadCount
+			: workerPool ? workerPool->GetThreadCount() : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		usedThreads = processor_count;
+		syncCycles = 0;
+		workerEndNanos = 0;
+		renderStart = high_resolution_clock::now();
+
+		// cache behaviour of the workers, summed as they leave when the platform allows counting it
+		perfCounters.Reset();
+
+		if (workerPool) {
+			// the pool holds on to the job until its workers are done with it
+			auto pooled = make_shared<WorkerPool::Job>();
+			pooled->schedule = schedule;
+			pooled->maxWorkers = processor_count;
+			pooled->totalRows = maxY;
+			pooled->cancelled = &job->cancelled;
+			pooled->run = [renderRows, job] { return renderRows(job->bandCounter); };
+			pooled->finish = [this] { FinishRender(); };
+			if (!workerPool->Schedule(pooled)) {
+				job->Complete(false);
+				return job;
 			}
-			
-			int completedLines = partialRows;
-			int remainingLines = maxY - completedLines;
-			const auto averageLineTime = partialTime / partialRows;
-
-			// update console
-			const auto estimateTime = averageLineTime * remainingLines / processor_count;
-			const auto hrs = duration_cast<hours>(estimateTime);
-			const auto mins = duration_cast<minutes>(estimateTime - hrs);
-			const auto secs = duration_cast<seconds>(estimateTime - hrs - mins);
-			std::clog << "\rScanlines remaining: " << remainingLines << "   estimated remaining time: " << NanoToHHMMSS(estimateTime) << "     " << std::flush;
+			job->pooled = pooled.get();
+			return job;
 		}
 
-		// destroy threads
-		for (auto i = 0; i < processor_count; i++)
-			workers[i].join();
-		delete[] workers;
-
-		// write final state
-		auto endRenderTime_ns = high_resolution_clock::now();
-		std::clog << "\rDone in " << NanoToHHMMSS(endRenderTime_ns - startRenderTime_ns) << std::string(64, ' ') << "\n";
+		job->activeWorkers = processor_count;
+		for (auto i = 0; i < processor_count; i++) {
+			job->workers.emplace_back([this, renderRows, running = job.get()] {
+				renderRows(running->bandCounter);
+				// the last worker out completes the job
+				if (--running->activeWorkers == 0)
+					FinishRender();
+			});
+		}
+		return job;
 	}
 
+	// describes the render loop picked by the last Render call
+	const std::string& GetKernelName() const { return kernelName; }
+
+	// rays traced and wall clock time of the last Render call
+	uint64_t GetRayCount() const { return rayCount; }
+	double GetRenderSeconds() const { return renderSeconds; }
+
+	// workers of the last Render call, the cycles they spent claiming bands and reporting progress,
+	// and the thread time they spent finished while others were still rendering
+	int GetThreadCount() const { return usedThreads; }
+	uint64_t GetSyncCycles() const { return syncCycles; }
+	double GetIdleSeconds() const { return idleSeconds; }
+
+	// stage timings and queue occupancy of the last wavefront Render call
+	const WavefrontStats& GetWavefrontStats() const { return wavefrontStats; }
+
+	// hardware counters over the last Render call, check IsAvailable
+	const PerfCounters& GetPerfCounters() const { return perfCounters; }
+
+	// path and intersection counts of the last Render call, when RENDER_STATS counts them
+	const RenderStats& GetRenderStats() const { return renderStats; }
+
 private:
+	// returns true once the bands have run out, false when it left them to other jobs on the workerPool
+	using RowWorker = std::function<bool(std::atomic_uint32_t&)>;
 
 	Point3 position;
 	Point3 pixelTopLeft;
@@ -130,20 +260,31 @@ private:
 	Vec3   defocusDiskU;	// Defocus disk horizontal radius
 	Vec3   defocusDiskV;	// Defocus disk vertical radius
 
-	nanoseconds totalThreadTime_ns;
-	uint32_t completedRows;
-	std::mutex timer_mutex;
-	std::condition_variable cv;
-
-	shared_ptr<Texture> outputTexture;
+	int imageWidth, imageHeight;
+	shared_ptr<ImageSink> output;
+	std::atomic_bool outputFailed;
+	Resolver resolver;
+	std::string kernelName;
+	std::atomic<uint64_t> rayCount{ 0 };
+	double renderSeconds = 0;
+	int usedThreads = 0;
+	std::atomic<uint64_t> syncCycles{ 0 };
+	std::atomic<uint64_t> workerEndNanos{ 0 };		// sum over the workers of when each finished
+	high_resolution_clock::time_point renderStart;
+	double idleSeconds = 0;
+	std::weak_ptr<RenderJob> currentJob;
+	RenderJob* activeJob = nullptr;		// the running job, alive while its workers are
+	WavefrontStats wavefrontStats;
+	PerfCounters perfCounters;
+	RenderStats renderStats;
 
 	void Initialize() {
-		double imageWidth = static_cast<double>(outputTexture->GetResolutionX());
-		double imageHeight = static_cast<double>(outputTexture->GetResolutionY());
+		double width = static_cast<double>(imageWidth);
+		double height = static_cast<double>(imageHeight);
 
 		position = lookfrom;
 		
-		double aspect_ratio = imageWidth / imageHeight;
+		double aspect_ratio = width / height;
 
 		// Determine viewport dimensions.
 		double theta = Deg2Rad(vfov);
@@ -161,8 +302,8 @@ private:
 		Vec3 viewportV = viewportHeight * -v;	// Vector down viewport vertical edge
 
 		// Calculate the horizontal and vertical delta vectors from pixel to pixel.
-		pixelDeltaU = viewportU / imageWidth;
-		pixelDeltaV = viewportV / imageHeight;
+		pixelDeltaU = viewportU / width;
+		pixelDeltaV = viewportV / height;
 
 		// Calculate the location of the upper left pixel.
 		Vec3 viewportTopLeft = position - (focusDist * w) - (viewportU / 2) - (viewportV / 2);
@@ -172,56 +313,393 @@ private:
 		auto defocusRadius = focusDist * tan(Deg2Rad(defocusAngle / 2));
 		defocusDiskU = u * defocusRadius;
 		defocusDiskV = v * defocusRadius;
+
+		resolver = Resolver(resolve);
+	}
+
+	// Runtime dispatcher, returns the row loop instantiated for this scene and these settings.
+	// Scenes made only of spheres get a flat copy with direct intersection calls, anything else uses the virtual Hittable path.
+	// The copy is gathered into flatWorld or flatWorldFloat unless the camera was given one.
+	RowWorker SelectKernel(const Hittable& world, const MaterialTable& materials, FlatScene<Sphere>& flatWorld, FlatScene<Spheref>& flatWorldFloat) {
+		const HittableList* list = dynamic_cast<const HittableList*>(&world);
+		if (specializedKernels && singlePrecision && (flatSceneFloat || (list && flatWorldFloat.Gather(*list)))) {
+			kernelName = std::string("spheres, float, ") + GetSimdName(GetSimdKernels().level);
+			return SelectOptions(flatSceneFloat ? *flatSceneFloat : flatWorldFloat, materials, true);
+		}
+		if (specializedKernels && !singlePrecision && (flatScene || (list && flatWorld.Gather(*list)))) {
+			kernelName = std::string("spheres, ") + GetSimdName(GetSimdKernels().level);
+			return SelectOptions(flatScene ? *flatScene : flatWorld, materials, true);
+		}
+
+		kernelName = "generic";
+		return SelectOptions(world, materials, false);
+	}
+
+	template <typename Scene>
+	RowWorker SelectOptions(const Scene& world, const MaterialTable& materials, bool fixedBounces) {
+		bool depthOfField = defocusAngle > 0;
+		kernelName += depthOfField ? ", depth of field" : ", pinhole";
+
+		// bounce limits used by the built-in scenes get a fully unrolled path loop
+		if (fixedBounces && maxRayBounces == 10) {
+			kernelName += ", 10 bounces";
+			return depthOfField ? MakeWorker<Scene, true, 10>(world, materials) : MakeWorker<Scene, false, 10>(world, materials);
+		}
+		if (fixedBounces && maxRayBounces == 50) {
+			kernelName += ", 50 bounces";
+			return depthOfField ? MakeWorker<Scene, true, 50>(world, materials) : MakeWorker<Scene, false, 50>(world, materials);
+		}
+
+		kernelName += ", runtime bounces";
+		return depthOfField ? MakeWorker<Scene, true, 0>(world, materials) : MakeWorker<Scene, false, 0>(world, materials);
+	}
+
+	template <typename Scene, bool DepthOfField, int FixedBounces>
+	RowWorker MakeWorker(const Scene& world, const MaterialTable& materials) {
+		// costs and hits are only attributable to a pixel when its samples are traced on their own
+		if (costMap || dependencyMap) {
+			kernelName += costMap ? ", cost map" : "";
+			kernelName += dependencyMap ? ", dependencies" : "";
+			return MakeWorker<Scene, DepthOfField, FixedBounces, 0, false>(world, materials);
+		}
+
+		if (wavefront) {
+			kernelName += ", wavefront";
+			return MakeWorker<Scene, DepthOfField, FixedBounces, 0, true>(world, materials);
+		}
+
+		// only flat scenes can trace packets
+		if constexpr (!std::is_base_of<Hittable, Scene>::value) {
+			if (packetSize == 4) {
+				kernelName += ", 4x4 packets";
+				return MakeWorker<Scene, DepthOfField, FixedBounces, 4, false>(world, materials);
+			}
+			if (packetSize == 8) {
+				kernelName += ", 8x8 packets";
+				return MakeWorker<Scene, DepthOfField, FixedBounces, 8, false>(world, materials);
+			}
+		}
+		return MakeWorker<Scene, DepthOfField, FixedBounces, 0, false>(world, materials);
 	}
 
-	void RenderRow(std::atomic_uint32_t& rowCounter, const int maxY, const int rowWidth, const Hittable& world)
+	template <typename Scene, bool DepthOfField, int FixedBounces, int PacketSize, bool Wavefront>
+	RowWorker MakeWorker(const Scene& world, const MaterialTable& materials) {
+		return [this, &world, &materials](std::atomic_uint32_t& bandCounter) {
+			return RenderRows<Scene, DepthOfField, FixedBounces, PacketSize, Wavefront>(bandCounter, world, materials);
+		};
+	}
+
+	// Scene is either a Hittable or a FlatScene, DepthOfField selects the lens model,
+	// FixedBounces is the path length, or 0 to read maxRayBounces at run time,
+	// PacketSize traces camera rays in packets over bands of that many rows, or 0 for single rays a row at a time,
+	// and Wavefront renders bands sized to fill a path queue
+	// returns true once the bands have run out, false when the worker pool moved this worker to another job
+	template <typename Scene, bool DepthOfField, int FixedBounces, int PacketSize, bool Wavefront>
+	bool RenderRows(std::atomic_uint32_t& bandCounter, const Scene& world, const MaterialTable& materials)
 	{
+		const int maxY = imageHeight;
+		const int rowWidth = imageWidth;
+		const int bandHeight = Wavefront ? GetWavefrontRows() : PacketSize > 0 ? PacketSize : 1;
+		uint64_t bandRays;
+		std::vector<Color> bandColors(rowWidth * bandHeight);
+		std::vector<PixelColor> rowPixels(rowWidth);
+		Trace::SetThreadName("render worker");
+		uint64_t waitCycles = 0;
+		PerfCounters workerCounters;
+		workerCounters.Start();
+
+		auto leave = [&](bool ranOut) {
+			workerCounters.Stop();
+			perfCounters.Add(workerCounters);
+			syncCycles += waitCycles;
+			workerEndNanos += duration_cast<nanoseconds>(high_resolution_clock::now() - renderStart).count();
+			RENDER_STATS_MERGE(renderStats);
+			return ranOut;
+		};
+
 		while (true) {
-			// sequentially claim rows
-			const int y = rowCounter.fetch_add(1);
-			// stop when past end of image
-			if (y >= maxY)
-				return;
+			// sequentially claim bands of rows
+			uint64_t waitStart = ReadCycleCounter();
+			const int y0 = bandCounter.fetch_add(1) * bandHeight;
+			waitCycles += ReadCycleCounter() - waitStart;
+			// stop when past end of image or cancelled
+			if (y0 >= maxY || activeJob->IsCancelled())
+				return leave(true);
+			const int rows = std::min(bandHeight, maxY - y0);
+			const high_resolution_clock::time_point bandStart = high_resolution_clock::now();
+
+			if (seed)
+				SeedRandom(MixBits(seed * 0x9E3779B97F4A7C15ull + y0));
+			bandRays = 0;
+			const uint64_t traceStart = Trace::IsEnabled() ? Trace::Now() : 0;
+
+			if constexpr (Wavefront) {
+				TraceWavefront<Scene, DepthOfField, FixedBounces>(y0, rows, world, materials, bandColors.data(), bandRays);
+			}
+			else if constexpr (PacketSize > 0) {
+				TracePackets<Scene, DepthOfField, FixedBounces, PacketSize>(y0, rows, world, materials, bandColors.data(), bandRays);
+			}
+			else {
+				for (int x = 0; x < rowWidth; x++)
+				{
+					// pixels no edit reached keep the colour of the last render
+					if (dependencyMap && !dependencyMap->IsDirty(x, y0)) {
+						bandColors[x] = dependencyMap->GetColor(x, y0);
+						continue;
+					}
+					// so re-rendered pixels come out as they would in a full render
+					if (dependencyMap && seed)
+						SeedRandom(MixBits(MixBits(seed * 0x9E3779B97F4A7C15ull + y0) + x));
+
+					Color resultColor(0, 0, 0);
+					PixelDependencies touched(dependencyMap ? &dependencyMap->GetGrid() : nullptr);
+					const uint64_t startCycles = costMap ? ReadCycleCounter() : 0;
+					const uint64_t startSteps = TraversalSteps();
+					const uint64_t startRays = bandRays;
+
+					for (int i = 0; i < samplesPerPixel; i++)
+					{
+						Ray r = GetRay<DepthOfField>(x, y0);
+						resultColor += dependencyMap ? RayColor<FixedBounces, true>(r, world, materials, bandRays, &touched)
+							: RayColor<FixedBounces>(r, world, materials, bandRays);
+					}
+
+					if (costMap)
+						costMap->Record(x, y0, ReadCycleCounter() - startCycles, TraversalSteps() - startSteps, bandRays - startRays, samplesPerPixel);
+
+					// average samples
+					resultColor /= static_cast<double>(samplesPerPixel);
+					bandColors[x] = resultColor;
+
+					if (dependencyMap)
+						dependencyMap->Record(x, y0, touched, resultColor);
+				}
+			}
 
-			high_resolution_clock::time_point t_start = high_resolution_clock::now();
+			rayCount += bandRays;
+			RENDER_STAT(samples += static_cast<uint64_t>(rows) * rowWidth * samplesPerPixel);
+			if (Trace::IsEnabled())
+				Trace::Record(rows > 1 ? "trace band" : "trace row", traceStart, Trace::Now(), "y", y0);
 
-			for (int x = 0; x < rowWidth; x++)
-			{
-				Color resultColor(0, 0, 0);
+			for (int row = 0; row < rows; row++) {
+				const int y = y0 + row;
+				Color* rowColors = bandColors.data() + row * rowWidth;
 
-				for (int i = 0; i < samplesPerPixel; i++)
 				{
-					Ray r = GetRay(x, y);
-					resultColor += RayColor(r, maxRayBounces, world);
+					TraceScope traceResolve("resolve row", "y", y);
+
+					// merge with previously accumulated samples
+					if (accumulationBuffer && !accumulationBuffer->AccumulateRow(y, rowColors, samplesPerPixel, rowColors))
+						outputFailed = true;
+
+					// convert the finished row to display colour in one pass
+					resolver.ResolveRow(rowColors, rowWidth, y, rowPixels.data());
 				}
 
-				// average samples
-				resultColor /= static_cast<double>(samplesPerPixel);
-				// clamp color gammut
-				resultColor = Interval(0, 1).clamp(resultColor);
-				// linear to gamma color conversion
-				double gamma = 1.0 / 2.0;
-				resultColor.e[0] = pow(resultColor.e[0], gamma);
-				resultColor.e[1] = pow(resultColor.e[1], gamma);
-				resultColor.e[2] = pow(resultColor.e[2], gamma);
-
-				outputTexture->SetPixel(x, y, resultColor);
+				TraceScope traceWrite("write row", "y", y);
+				if (!output->WriteRow(y, rowPixels.data()))
+					outputFailed = true;
+				activeJob->FinishRow(y, rowPixels.data());
 			}
 
-			high_resolution_clock::time_point t_end = high_resolution_clock::now();
-			nanoseconds rowTime = t_end - t_start;
+			waitStart = ReadCycleCounter();
+			RenderProgress progress = activeJob->FinishBand();
+			waitCycles += ReadCycleCounter() - waitStart;
+
+			if (onProgress) {
+				std::lock_guard<std::mutex> lock(activeJob->callbackMutex);
+				onProgress(progress);
+			}
+
+			// band boundaries are where the pool can hand this worker to a job that needs it more
+			if (activeJob->pooled && activeJob->pooled->FinishBand(rows, duration<double>(high_resolution_clock::now() - bandStart).count()))
+				return leave(false);
+		}
+	}
+
+	// run by the last worker to exit
+	void FinishRender() {
+		renderSeconds = duration<double>(high_resolution_clock::now() - renderStart).count();
+		idleSeconds = std::max(0.0, usedThreads * renderSeconds - workerEndNanos / 1e9);
+
+		bool success = !activeJob->IsCancelled() && !outputFailed;
+		if (success) {
+			TraceScope traceEnd("finish output");
+			success = output->End();
+		}
+		activeJob->Complete(success);
+	}
+
+	// Each sample of a PacketSize x PacketSize tile sends its camera rays through the scene as one packet,
+	// the paths then diverge and continue one ray at a time from their first hit.
+	template <typename Scene, bool DepthOfField, int FixedBounces, int PacketSize>
+	void TracePackets(int y0, int rows, const Scene& world, const MaterialTable& materials, Color* bandColors, uint64_t& rays) const {
+		using T = typename Scene::Scalar;
+		static_assert(PacketSize * PacketSize <= RayPacket<T>::maxRays, "packet does not fit");
 
-			{
-				// thread safe update to timer
-				std::unique_lock<std::mutex> lk(timer_mutex);
-				totalThreadTime_ns += rowTime;
-				completedRows++;
+		RayPacket<T> packet;
+		RayHitT<T> hits[RayPacket<T>::maxRays];
+
+		for (int i = 0; i < rows * imageWidth; i++)
+			bandColors[i] = Color(0, 0, 0);
+
+		for (int x0 = 0; x0 < imageWidth; x0 += PacketSize) {
+			const int columns = std::min(PacketSize, imageWidth - x0);
+
+			for (int s = 0; s < samplesPerPixel; s++) {
+				packet.Clear();
+				for (int row = 0; row < rows; row++)
+					for (int column = 0; column < columns; column++)
+						packet.Add(RayT<T>(GetRay<DepthOfField>(x0 + column, y0 + row)));
+
+				world.IntersectPacket(packet, RayEpsilon<T>::minDistance, hits);
+				rays += packet.count;
+
+				int i = 0;
+				for (int row = 0; row < rows; row++)
+					for (int column = 0; column < columns; column++, i++)
+						bandColors[row * imageWidth + x0 + column] += ShadePath<FixedBounces>(packet.rays[i], hits[i].primitive != nullptr, hits[i], world, materials, rays);
 			}
-			// notify timer has changed
-			cv.notify_all();
 		}
+
+		// average samples
+		for (int i = 0; i < rows * imageWidth; i++)
+			bandColors[i] /= static_cast<double>(samplesPerPixel);
 	}
 
+	// rows per wavefront band, so that all samples of a band fit one queue where possible
+	int GetWavefrontRows() const {
+		int pathsPerRow = std::max(1, imageWidth * samplesPerPixel);
+		return std::min(std::max(1, wavefrontSize / pathsPerRow), imageHeight);
+	}
+
+	// Renders a band as a stream of path queues, each queue moving through the stages
+	// generate, then per bounce: reorder if enabled for it, intersect, sort by material kind, shade one kind at a time, compact.
+	// Bands too wide for one queue are split over the samples.
+	template <typename Scene, bool DepthOfField, int FixedBounces>
+	void TraceWavefront(int y0, int rows, const Scene& world, const MaterialTable& materials, Color* bandColors, uint64_t& rays) {
+		using T = typename Scene::Scalar;
+		using Stage = WavefrontStats::Stage;
+
+		const int bounces = FixedBounces > 0 ? FixedBounces : maxRayBounces;
+		const uint32_t pixels = static_cast<uint32_t>(rows * imageWidth);
+		const int samplesPerPass = std::min(samplesPerPixel, std::max(1, wavefrontSize / static_cast<int>(pixels)));
+		const uint8_t ended = static_cast<uint8_t>(Material::Kind::Count);
+
+		thread_local PathQueue<T> queue;
+		queue.Reserve(pixels * samplesPerPass);
+
+		for (uint32_t i = 0; i < pixels; i++)
+			bandColors[i] = Color(0, 0, 0);
+
+		uint64_t stageNanos[WavefrontStats::StageCount] = {};
+		uint64_t bouncePaths[WavefrontStats::maxBounces] = {};
+		auto time = high_resolution_clock::now();
+		auto endStage = [&](Stage stage) {
+			auto now = high_resolution_clock::now();
+			stageNanos[stage] += duration_cast<nanoseconds>(now - time).count();
+			time = now;
+		};
+
+		for (int s0 = 0; s0 < samplesPerPixel; s0 += samplesPerPass) {
+			const int samples = std::min(samplesPerPass, samplesPerPixel - s0);
+
+			// generate camera rays, samples of a pixel next to each other
+			queue.count = 0;
+			for (int row = 0; row < rows; row++) {
+				for (int x = 0; x < imageWidth; x++) {
+					for (int s = 0; s < samples; s++) {
+						queue.rays[queue.count] = RayT<T>(GetRay<DepthOfField>(x, y0 + row));
+						queue.throughput[queue.count] = Vec3T<T>(1, 1, 1);
+						queue.pixel[queue.count] = row * imageWidth + x;
+						queue.count++;
+					}
+				}
+			}
+			endStage(WavefrontStats::Generate);
+
+			for (int depth = 0; depth < bounces && queue.count > 0; depth++) {
+				if (depth < WavefrontStats::maxBounces)
+					bouncePaths[depth] += queue.count;
+
+				if (depth < 64 && ((reorderBounces >> depth) & 1)) {
+					queue.Reorder();
+					endStage(WavefrontStats::Reorder);
+				}
+
+				// closest hits, paths leaving the scene pick up the sky and end
+				rays += queue.count;
+				for (uint32_t i = 0; i < queue.count; i++) {
+					RayHitT<T> hit;
+					if (!world.Intersect(queue.rays[i], IntervalT<T>(RayEpsilon<T>::minDistance, std::numeric_limits<T>::infinity()), hit)) {
+						bandColors[queue.pixel[i]] += Color(queue.throughput[i] * Background(queue.rays[i]));
+						queue.kind[i] = ended;
+						RENDER_STAT(EndPath(RenderStats::Escaped, depth + 1));
+						continue;
+					}
+					world.Finalize(queue.rays[i], hit, queue.points[i]);
+					queue.kind[i] = static_cast<uint8_t>(materials[queue.points[i].materialId].GetKind());
+				}
+				endStage(WavefrontStats::Intersect);
+
+				queue.Sort();
+				endStage(WavefrontStats::Sort);
+
+				ShadeKind<Lambertian>(queue, materials, depth + 1);
+				ShadeKind<Metal>(queue, materials, depth + 1);
+				ShadeKind<Dielectric>(queue, materials, depth + 1);
+				endStage(WavefrontStats::Shade);
+
+				queue.Compact();
+				endStage(WavefrontStats::Compact);
+			}
+			// paths still alive at the bounce limit gather no more light
+			RENDER_STAT(EndPath(RenderStats::DepthLimit, bounces, queue.count));
+		}
+
+		// average samples
+		for (uint32_t i = 0; i < pixels; i++)
+			bandColors[i] /= static_cast<double>(samplesPerPixel);
+
+		for (int i = 0; i < WavefrontStats::StageCount; i++)
+			wavefrontStats.AddStage(static_cast<Stage>(i), stageNanos[i]);
+		for (int i = 0; i < WavefrontStats::maxBounces && bouncePaths[i] > 0; i++)
+			wavefrontStats.AddPaths(i, bouncePaths[i]);
+	}
+
+	// scatters every queued path that hit material kind M, in one loop without dispatch,
+	// pathLength is the number of rays the paths have traced
+	template <typename M, typename T>
+	static void ShadeKind(PathQueue<T>& queue, const MaterialTable& materials, [[maybe_unused]] int pathLength) {
+		const int k = static_cast<int>(std::is_same<M, Lambertian>::value ? Material::Kind::Lambertian
+			: std::is_same<M, Metal>::value ? Material::Kind::Metal : Material::Kind::Dielectric);
+
+		for (uint32_t j = queue.kindStart[k]; j < queue.kindStart[k + 1]; j++) {
+			const uint32_t i = queue.order[j];
+			const HitPointT<T>& rec = queue.points[i];
+
+			RayT<T> outScatteredRay;
+			Vec3T<T> attenuation;
+			if (!materials[rec.materialId].template Get<M>().scatter(queue.rays[i], rec, attenuation, outScatteredRay)) {
+				queue.kind[i] = static_cast<uint8_t>(Material::Kind::Count);
+				RENDER_STAT(EndPath(RenderStats::Absorbed, pathLength));
+				continue;
+			}
+
+			queue.throughput[i] = queue.throughput[i] * attenuation;
+			queue.rays[i] = RayT<T>(OffsetRayOrigin(rec.position, rec.normal, outScatteredRay.direction), outScatteredRay.direction);
+		}
+	}
+
+	// sky gradient seen by rays leaving the scene
+	template <typename T>
+	static Vec3T<T> Background(const RayT<T>& r) {
+		Vec3T<T> unit_direction = r.direction.normalized();
+		T a = unit_direction.y() * static_cast<T>(0.5) + static_cast<T>(0.5);
+		return (1 - a) * Vec3T<T>(1, 1, 1) + a * Vec3T<T>(0.5, 0.7, 1.0);
+	}
+
+	template <bool DepthOfField>
 	Ray GetRay(int i, int j) const {
 		// Get a randomly sampled camera ray for the pixel at location i,j.
 		// Jitters pixelCenter for MSAA
@@ -230,8 +708,9 @@ private:
 		Vec3 pixelCenter = pixelTopLeft + (i * pixelDeltaU) + (j * pixelDeltaV);
 		Vec3 pixelSample = pixelCenter + pixelRandomOffset();
 
-		Point3 rayOrigin = (defocusAngle <= 0) ? position : defocusDiskSample();
+		Point3 rayOrigin = DepthOfField ? defocusDiskSample() : position;
 		Vec3 rayDirection = pixelSample - rayOrigin;
+		RENDER_STAT(rays[RenderStats::CameraRay]++);
 
 		return Ray(rayOrigin, rayDirection);
 	}
@@ -249,26 +728,62 @@ private:
 		return position + (p[0] * defocusDiskU) + (p[1] * defocusDiskV);
 	}
 
-	Color RayColor(const Ray& r, int depth, const Hittable& world) {
-		HitPoint rec;
+	// traces one path in the scene's precision, adding the number of rays cast to `rays`
+	// and with Record, everything the path hits to `touched`
+	template <int FixedBounces, bool Record = false, typename Scene>
+	Color RayColor(const Ray& primaryRay, const Scene& world, const MaterialTable& materials, uint64_t& rays, PixelDependencies* touched = nullptr) const {
+		using T = typename Scene::Scalar;
 
-		// If we've exceeded the ray bounce limit, no more light is gathered.
-		if (depth <= 0)
+		const int bounces = FixedBounces > 0 ? FixedBounces : maxRayBounces;
+		if (bounces <= 0)
 			return Color(0, 0, 0);
 
-		if (world.Hit(r, Interval(0.001, infinity), rec)) {
-			Ray outScatteredRay;
-			Color attenuation;
+		RayT<T> r(primaryRay);
+		RayHitT<T> hit;
+		rays++;
+		bool found = world.Intersect(r, IntervalT<T>(RayEpsilon<T>::minDistance, std::numeric_limits<T>::infinity()), hit);
+		return ShadePath<FixedBounces, Record>(r, found, hit, world, materials, rays, touched);
+	}
 
-			if (rec.mat->scatter(r, rec, attenuation, outScatteredRay)) {
-				return attenuation * RayColor(outScatteredRay, depth - 1, world);
+	// continues a path from the result of intersecting its first ray r, `found` tells whether hit is valid
+	template <int FixedBounces, bool Record = false, typename Scene, typename T>
+	Color ShadePath(RayT<T> r, bool found, RayHitT<T> hit, const Scene& world, const MaterialTable& materials, uint64_t& rays,
+		PixelDependencies* touched = nullptr) const {
+		const int bounces = FixedBounces > 0 ? FixedBounces : maxRayBounces;
+		Vec3T<T> throughput(1, 1, 1);
+
+		for (int depth = 0; depth < bounces; depth++) {
+			if (depth > 0) {
+				rays++;
+				found = world.Intersect(r, IntervalT<T>(RayEpsilon<T>::minDistance, std::numeric_limits<T>::infinity()), hit);
+			}
+			if constexpr (Record)
+				touched->AddSegment(r, found ? hit.t : std::numeric_limits<T>::infinity());
+			if (!found) {
+				RENDER_STAT(EndPath(RenderStats::Escaped, depth + 1));
+				return Color(throughput * Background(r));
 			}
 
-			return Color(0, 0, 0);
+			// shading data is only needed for the closest hit
+			HitPointT<T> rec;
+			world.Finalize(r, hit, rec);
+			if constexpr (Record)
+				touched->Add(hit.primitive, rec.materialId);
+
+			RayT<T> outScatteredRay;
+			Vec3T<T> attenuation;
+			if (!materials[rec.materialId].scatter(r, rec, attenuation, outScatteredRay)) {
+				RENDER_STAT(EndPath(RenderStats::Absorbed, depth + 1));
+				return Color(0, 0, 0);
+			}
+
+			throughput = throughput * attenuation;
+			r = outScatteredRay;
+			r.origin = OffsetRayOrigin(rec.position, rec.normal, r.direction);
 		}
 
-		Vec3 unit_direction = r.direction.normalized();
-		double a = unit_direction.y() * 0.5 + 0.5;
-		return (1.0 - a) * Color(1.0, 1.0, 1.0) + a * Color(0.5, 0.7, 1.0);
+		// If we've exceeded the ray bounce limit, no more light is gathered.
+		RENDER_STAT(EndPath(RenderStats::DepthLimit, bounces));
+		return Color(0, 0, 0);
 	}
 };
@@ -0,0 +1,280 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "Camera.h"
+#include "FlatScene.h"
+#include "Framebuffer.h"
+#include "HittableList.h"
+#include "ImageSink.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CheckpointHeader {
+	char magic[8];			// "RTCHECK" followed by a zero byte
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;		// AccumulationFormat of the buffer it was taken from
+	uint32_t passSpp;
+	uint32_t passesDone;	// passes whose samples are in the buffer
+	uint64_t seed;			// base of the random sequences of every pass
+	uint64_t fingerprint;	// scene, view and render settings the checkpoint belongs to
+};
+
+// One pixel of the accumulation buffer: running mean and sample count.
+struct CheckpointPixel {
+	float mean[3];
+	uint32_t samples;
+};
+
+static_assert(sizeof(CheckpointHeader) == 48, "CheckpointHeader layout changed");
+static_assert(sizeof(CheckpointPixel) == 16, "CheckpointPixel layout changed");
+
+struct ProgressiveRenderSettings {
+	int width = 0;
+	int height = 0;
+	int samplesPerPixel = 0;		// target
+	int passSpp = 4;				// samples per pixel added by each pass
+	uint64_t seed = 0;				// 0 picks one, which the checkpoint keeps
+	uint64_t fingerprint = 0;		// of the scene and view, a checkpoint of anything else is not resumed
+	std::string checkpointPath;
+	double checkpointSeconds = 60;	// least time between checkpoints
+	bool resume = false;			// continue from the checkpoint when it matches
+	bool verbose = true;
+};
+
+// Renders samplesPerPixel as passes of passSpp samples accumulated into a float buffer, and checkpoints the buffer's
+// means and sample counts with the number of passes done and the seed. Every band of every pass is seeded from the
+// seed and the pass, so a render resumed from a checkpoint traces the same paths as one that was never stopped and
+// ends with the same image. Checkpoints are copied out between passes and written by a background thread, to a
+// temporary file renamed over the last one, so a crash while writing leaves the previous checkpoint intact.
+class ProgressiveRender {
+public:
+	ProgressiveRenderSettings settings;
+	std::function<void(Camera&)> configure;		// view and kernel options of the camera of every pass
+	shared_ptr<TiledFramebuffer> buffer;		// accumulates the passes, a Float32 buffer next to the checkpoint when not given
+
+	ProgressiveRender() { }
+	ProgressiveRender(const ProgressiveRender&) = delete;
+	ProgressiveRender& operator=(const ProgressiveRender&) = delete;
+	~ProgressiveRender() { WaitForWriter(); }
+
+	// the last pass writes the finished image to output
+	// returns function's success
+	bool Run(const Hittable& world, const MaterialTable& materials, shared_ptr<ImageSink> output) {
+		const int passSpp = std::max(settings.passSpp, 1);
+		const int passes = std::max((settings.samplesPerPixel + passSpp - 1) / passSpp, 1);
+		std::string scratchPath;
+		if (!buffer) {
+			scratchPath = settings.checkpointPath + ".fb";
+			buffer = make_shared<TiledFramebuffer>(settings.width, settings.height, AccumulationFormat::Float32, scratchPath.c_str(), 256);
+		}
+		if (!buffer->IsValid() || buffer->GetResolutionX() != settings.width || buffer->GetResolutionY() != settings.height)
+			return false;
+
+		seed = settings.seed ? settings.seed : RandomBits() | 1;
+		int passesDone = settings.resume ? Restore(passes) : 0;
+		if (settings.verbose && passesDone > 0)
+			std::clog << "Resuming from " << settings.checkpointPath << ", " << passesDone << " of " << passes << " passes done\n";
+		if (passesDone == 0 && !Clear())
+			return false;
+
+		auto start = high_resolution_clock::now();
+		auto lastCheckpoint = start;
+		const int firstPass = passesDone;
+		for (int pass = firstPass; pass < passes; pass++) {
+			const bool last = pass == passes - 1;
+			Camera camera(settings.width, settings.height, last ? output : make_shared<NullSink>());
+			if (configure)
+				configure(camera);
+			camera.samplesPerPixel = last ? settings.samplesPerPixel - passSpp * (passes - 1) : passSpp;
+			camera.seed = MixBits(seed + static_cast<uint64_t>(pass) * 0x9E3779B97F4A7C15ull) | 1;
+			camera.accumulationBuffer = buffer;
+			camera.verbose = false;
+			ShareFlatScene(camera, world);
+			if (!camera.Render(world, materials))
+				return false;
+
+			auto now = high_resolution_clock::now();
+			if (settings.verbose) {
+				const auto estimateTime = (now - start) / (pass + 1 - firstPass) * (passes - pass - 1);
+				std::clog << "\rPass " << pass + 1 << " of " << passes << "   estimated remaining time: "
+					<< NanoToHHMMSS(duration_cast<nanoseconds>(estimateTime)) << "     " << std::flush;
+			}
+			if (!last && duration<double>(now - lastCheckpoint).count() >= settings.checkpointSeconds && Checkpoint(pass + 1))
+				lastCheckpoint = now;
+		}
+
+		// the render is done, its checkpoint is of no more use
+		WaitForWriter();
+		std::error_code ec;
+		std::filesystem::remove(settings.checkpointPath, ec);
+		if (!scratchPath.empty()) {
+			buffer.reset();
+			std::filesystem::remove(scratchPath, ec);
+		}
+		if (settings.verbose)
+			std::clog << "\rRendered " << passes - firstPass << " passes in " << NanoToHHMMSS(high_resolution_clock::now() - start)
+				<< std::string(32, ' ') << "\n";
+		return true;
+	}
+
+private:
+	static const uint32_t version = 1;
+
+	uint64_t seed = 0;
+	std::thread writer;
+	std::atomic<bool> writing{ false };
+	shared_ptr<const FlatScene<Sphere>> flatScene;
+	shared_ptr<const FlatScene<Spheref>> flatSceneFloat;
+
+	// gathers the flat scene once rather than on every pass
+	void ShareFlatScene(Camera& camera, const Hittable& world) {
+		const HittableList* list = dynamic_cast<const HittableList*>(&world);
+		if (!camera.specializedKernels || !list)
+			return;
+		if (camera.singlePrecision) {
+			if (!flatSceneFloat) {
+				auto flat = make_shared<FlatScene<Spheref>>();
+				flatSceneFloat = flat->Gather(*list) ? flat : nullptr;
+			}
+			camera.flatSceneFloat = flatSceneFloat;
+		}
+		else {
+			if (!flatScene) {
+				auto flat = make_shared<FlatScene<Sphere>>();
+				flatScene = flat->Gather(*list) ? flat : nullptr;
+			}
+			camera.flatScene = flatScene;
+		}
+	}
+
+	CheckpointHeader MakeHeader(int passesDone) const {
+		CheckpointHeader header = {};
+		std::memcpy(header.magic, "RTCHECK", 8);
+		header.version = version;
+		header.width = static_cast<uint32_t>(settings.width);
+		header.height = static_cast<uint32_t>(settings.height);
+		header.format = static_cast<uint32_t>(buffer->GetFormat());
+		header.passSpp = static_cast<uint32_t>(std::max(settings.passSpp, 1));
+		header.passesDone = static_cast<uint32_t>(passesDone);
+		header.seed = seed;
+		header.fingerprint = settings.fingerprint;
+		return header;
+	}
+
+	// returns function's success
+	bool Clear() {
+		std::vector<Color> mean(settings.width, Color(0, 0, 0));
+		std::vector<uint32_t> samples(settings.width, 0);
+		for (int y = 0; y < settings.height; y++) {
+			if (!buffer->WriteRow(y, mean.data(), samples.data()))
+				return false;
+		}
+		return true;
+	}
+
+	// copies the buffer out and hands it to the writer, skipped while the last checkpoint is still being written
+	// returns false when skipped, or when the buffer could not be read
+	bool Checkpoint(int passesDone) {
+		if (writing)
+			return false;
+		WaitForWriter();
+
+		std::vector<CheckpointPixel> pixels(static_cast<size_t>(settings.width) * settings.height);
+		std::vector<Color> mean(settings.width);
+		std::vector<uint32_t> samples(settings.width);
+		for (int y = 0; y < settings.height; y++) {
+			if (!buffer->ReadRow(y, mean.data(), samples.data()))
+				return false;
+			CheckpointPixel* row = pixels.data() + static_cast<size_t>(y) * settings.width;
+			for (int x = 0; x < settings.width; x++)
+				row[x] = { { static_cast<float>(mean[x][0]), static_cast<float>(mean[x][1]), static_cast<float>(mean[x][2]) }, samples[x] };
+		}
+
+		writing = true;
+		writer = std::thread([this, header = MakeHeader(passesDone), pixels = std::move(pixels)] {
+			if (!Write(settings.checkpointPath, header, pixels))
+				std::cerr << "\nCould not write checkpoint " << settings.checkpointPath << "\n";
+			writing = false;
+		});
+		return true;
+	}
+
+	void WaitForWriter() {
+		if (writer.joinable())
+			writer.join();
+	}
+
+	// writes a temporary file next to the checkpoint and renames it over the checkpoint
+	// returns function's success
+	static bool Write(const std::string& path, const CheckpointHeader& header, const std::vector<CheckpointPixel>& pixels) {
+		std::string temporary = path + ".tmp";
+		FILE* out = fopen(temporary.c_str(), "wb");
+		if (!out)
+			return false;
+		bool ok = fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(pixels.data(), sizeof(CheckpointPixel), pixels.size(), out) == pixels.size();
+		ok = fclose(out) == 0 && ok;
+
+		std::error_code ec;
+		if (ok)
+			std::filesystem::rename(temporary, path, ec);
+		return ok && !ec;
+	}
+
+	// loads a checkpoint of this render into the buffer and takes its seed
+	// returns the passes it has done, 0 when there is no checkpoint that can be continued to `passes`
+	int Restore(int passes) {
+		FILE* in = fopen(settings.checkpointPath.c_str(), "rb");
+		if (!in) {
+			if (settings.verbose)
+				std::clog << "No checkpoint at " << settings.checkpointPath << ", starting over\n";
+			return 0;
+		}
+
+		CheckpointHeader header;
+		CheckpointHeader expected = MakeHeader(0);
+		bool matches = fread(&header, sizeof(header), 1, in) == 1 && std::memcmp(header.magic, expected.magic, 8) == 0
+			&& header.version == version && header.width == expected.width && header.height == expected.height
+			&& header.format == expected.format && header.passSpp == expected.passSpp && header.fingerprint == expected.fingerprint
+			&& (settings.seed == 0 || header.seed == settings.seed) && static_cast<int>(header.passesDone) < passes;
+		if (!matches) {
+			fclose(in);
+			if (settings.verbose)
+				std::clog << "Checkpoint " << settings.checkpointPath << " is of another render, starting over\n";
+			return 0;
+		}
+
+		std::vector<CheckpointPixel> row(settings.width);
+		std::vector<Color> mean(settings.width);
+		std::vector<uint32_t> samples(settings.width);
+		for (int y = 0; y < settings.height; y++) {
+			if (fread(row.data(), sizeof(CheckpointPixel), row.size(), in) != row.size()) {
+				fclose(in);
+				std::cerr << "Checkpoint " << settings.checkpointPath << " is truncated, starting over\n";
+				return 0;
+			}
+			for (int x = 0; x < settings.width; x++) {
+				mean[x] = Color(row[x].mean[0], row[x].mean[1], row[x].mean[2]);
+				samples[x] = row[x].samples;
+			}
+			if (!buffer->WriteRow(y, mean.data(), samples.data())) {
+				fclose(in);
+				return 0;
+			}
+		}
+		fclose(in);
+
+		seed = header.seed;
+		return static_cast<int>(header.passesDone);
+	}
+};
@@ -0,0 +1,297 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "ImageSink.h"
+#include "Scene.h"
+#include "SceneArena.h"
+#include "Scenes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// A render loop setup whose quality over time is measured.
+struct ConvergenceConfig {
+	std::string name;
+	std::function<void(Camera&)> configure;
+};
+
+struct ConvergenceSettings {
+	int width = 320;
+	int height = 180;
+	int maxRayBounces = 10;
+	int referenceSpp = 256;
+	int passSpp = 1;								// samples added by each progressive pass
+	std::vector<double> timePoints = { 0.25, 0.5, 1, 2, 4, 8 };	// seconds of render time, ascending
+	std::string scene = "book";						// first canonical scene whose name contains this
+	std::string referencePath;						// reuses a reference saved here by an earlier run, or saves it
+	std::string scratchPath = "convergence.fb";		// accumulation buffers, removed afterwards
+};
+
+// Error of an image against the reference: RMSE and relative MSE of the linear radiance,
+// and SSIM of the display luminance as the perceptual measure.
+struct ImageError {
+	double rmse = 0;
+	double relMse = 0;
+	double ssim = 1;
+};
+
+// Renders a high sample count reference once, then renders each configuration progressively, a few samples per pass,
+// and writes a CSV of the error of the latest finished image at each time point. Render time excludes the measuring.
+// Lower error at the same time point means a configuration converges faster.
+class ConvergenceBenchmark {
+public:
+	ConvergenceSettings settings;
+	std::vector<ConvergenceConfig> configs;
+
+	// returns function's success
+	bool Run(std::ostream& csv) {
+		const std::vector<CanonicalScene>& scenes = GetCanonicalScenes();
+		auto canonical = std::find_if(scenes.begin(), scenes.end(), [&](const CanonicalScene& s) { return s.name.find(settings.scene) != std::string::npos; });
+		if (canonical == scenes.end() || configs.empty() || settings.timePoints.empty())
+			return false;
+
+		std::clog << "Convergence: building " << canonical->name << "\n";
+		CreateCanonicalScene(*canonical, scene);
+		arena = make_shared<SceneArena>();
+		scene.Build(world, materials, *arena);
+
+		if (!LoadReference()) {
+			std::clog << "Convergence: rendering the " << settings.referenceSpp << " spp reference\n";
+			if (!RenderReference())
+				return false;
+			if (!settings.referencePath.empty() && !SaveReference())
+				std::cerr << "Could not save reference " << settings.referencePath << "\n";
+		}
+
+		csv << "config,time_s,image_time_s,spp,rmse,relmse,ssim\n";
+		for (const ConvergenceConfig& config : configs) {
+			std::clog << "Convergence: " << config.name << "\n";
+			if (!RunConfig(config, csv))
+				return false;
+		}
+		std::remove(settings.scratchPath.c_str());
+		return true;
+	}
+
+	static ImageError Compare(const std::vector<Color>& image, const std::vector<Color>& reference, int width, int height) {
+		ImageError error;
+		const size_t pixels = image.size();
+		double squared = 0, relative = 0;
+		for (size_t i = 0; i < pixels; i++) {
+			for (int c = 0; c < 3; c++) {
+				double difference = image[i][c] - reference[i][c];
+				squared += difference * difference;
+				// the offset keeps dark reference pixels from dominating
+				relative += difference * difference / (reference[i][c] * reference[i][c] + 0.01);
+			}
+		}
+		error.rmse = std::sqrt(squared / (pixels * 3));
+		error.relMse = relative / (pixels * 3);
+		error.ssim = Ssim(Luminance(image), Luminance(reference), width, height);
+		return error;
+	}
+
+private:
+	SceneDescription scene;
+	shared_ptr<SceneArena> arena;
+	HittableList world;
+	MaterialTable materials;
+	std::vector<Color> reference;
+
+	void SetupCamera(Camera& camera, const ConvergenceConfig* config, shared_ptr<TiledFramebuffer> buffer, int spp, uint64_t seed) {
+		if (config && config->configure)
+			config->configure(camera);
+		SetCameraView(camera, scene.camera);
+		camera.samplesPerPixel = spp;
+		camera.maxRayBounces = settings.maxRayBounces;
+		camera.accumulationBuffer = buffer;
+		camera.seed = seed;
+		camera.verbose = false;
+	}
+
+	shared_ptr<TiledFramebuffer> CreateBuffer() {
+		auto buffer = make_shared<TiledFramebuffer>(settings.width, settings.height, AccumulationFormat::Float32, settings.scratchPath.c_str(), 1 << 16);
+		return buffer->IsValid() ? buffer : nullptr;
+	}
+
+	// returns function's success
+	bool ReadImage(TiledFramebuffer& buffer, std::vector<Color>& image) {
+		image.resize(static_cast<size_t>(settings.width) * settings.height);
+		for (int y = 0; y < settings.height; y++) {
+			if (!buffer.ReadRow(y, image.data() + static_cast<size_t>(y) * settings.width, nullptr))
+				return false;
+		}
+		return true;
+	}
+
+	// returns function's success
+	bool RenderReference() {
+		auto buffer = CreateBuffer();
+		if (!buffer)
+			return false;
+		// seeds far from the ones the passes use, so the reference noise is independent
+		Camera camera(settings.width, settings.height, make_shared<NullSink>());
+		SetupCamera(camera, nullptr, buffer, settings.referenceSpp, 0x5EED000000000001ull);
+		if (!camera.Render(world, materials))
+			return false;
+		return ReadImage(*buffer, reference);
+	}
+
+	// returns function's success
+	bool RunConfig(const ConvergenceConfig& config, std::ostream& csv) {
+		auto buffer = CreateBuffer();
+		if (!buffer)
+			return false;
+
+		std::vector<Color> image;
+		ImageError error;
+		bool haveImage = false;
+		double elapsed = 0, imageTime = 0;
+		int spp = 0, imageSpp = 0;
+		size_t point = 0;
+
+		for (uint64_t pass = 1; point < settings.timePoints.size(); pass++) {
+			Camera camera(settings.width, settings.height, make_shared<NullSink>());
+			SetupCamera(camera, &config, buffer, settings.passSpp, pass);
+			if (!camera.Render(world, materials))
+				return false;
+			elapsed += camera.GetRenderSeconds();
+			spp += settings.passSpp;
+
+			// time points passed while this pass rendered see the image before it
+			for (; point < settings.timePoints.size() && settings.timePoints[point] < elapsed; point++) {
+				if (haveImage)
+					WriteRow(csv, config.name, settings.timePoints[point], imageTime, imageSpp, error);
+			}
+
+			if (!ReadImage(*buffer, image))
+				return false;
+			error = Compare(image, reference, settings.width, settings.height);
+			haveImage = true;
+			imageTime = elapsed;
+			imageSpp = spp;
+		}
+		return true;
+	}
+
+	static void WriteRow(std::ostream& csv, const std::string& name, double time, double imageTime, int spp, const ImageError& error) {
+		char line[256];
+		snprintf(line, sizeof(line), "%s,%.3f,%.4f,%d,%.6g,%.6g,%.6f\n", name.c_str(), time, imageTime, spp, error.rmse, error.relMse, error.ssim);
+		csv << line << std::flush;
+	}
+
+	// display luminance: clamped, gamma 2.2
+	static std::vector<double> Luminance(const std::vector<Color>& image) {
+		std::vector<double> luminance(image.size());
+		for (size_t i = 0; i < image.size(); i++) {
+			double y = 0.2126 * image[i][0] + 0.7152 * image[i][1] + 0.0722 * image[i][2];
+			luminance[i] = std::pow(std::min(std::max(y, 0.0), 1.0), 1 / 2.2);
+		}
+		return luminance;
+	}
+
+	// mean structural similarity over 8x8 windows every 4 pixels
+	static double Ssim(const std::vector<double>& a, const std::vector<double>& b, int width, int height) {
+		const int window = 8, step = 4;
+		const double c1 = 0.01 * 0.01, c2 = 0.03 * 0.03;
+		double sum = 0;
+		int windows = 0;
+		for (int y0 = 0; y0 + window <= height; y0 += step) {
+			for (int x0 = 0; x0 + window <= width; x0 += step) {
+				double meanA = 0, meanB = 0;
+				for (int y = y0; y < y0 + window; y++) {
+					for (int x = x0; x < x0 + window; x++) {
+						meanA += a[static_cast<size_t>(y) * width + x];
+						meanB += b[static_cast<size_t>(y) * width + x];
+					}
+				}
+				const double n = window * window;
+				meanA /= n;
+				meanB /= n;
+
+				double varianceA = 0, varianceB = 0, covariance = 0;
+				for (int y = y0; y < y0 + window; y++) {
+					for (int x = x0; x < x0 + window; x++) {
+						double da = a[static_cast<size_t>(y) * width + x] - meanA;
+						double db = b[static_cast<size_t>(y) * width + x] - meanB;
+						varianceA += da * da;
+						varianceB += db * db;
+						covariance += da * db;
+					}
+				}
+				varianceA /= n - 1;
+				varianceB /= n - 1;
+				covariance /= n - 1;
+
+				sum += (2 * meanA * meanB + c1) * (2 * covariance + c2) / ((meanA * meanA + meanB * meanB + c1) * (varianceA + varianceB + c2));
+				windows++;
+			}
+		}
+		return windows ? sum / windows : 1.0;
+	}
+
+	// reference file: a header line, then width * height * 3 floats
+	// returns function's success
+	bool SaveReference() const {
+		std::ofstream file(settings.referencePath, std::ios::binary);
+		file << "rtref " << settings.scene << " " << settings.width << " " << settings.height << " " << settings.referenceSpp << " " << settings.maxRayBounces << "\n";
+		for (const Color& pixel : reference) {
+			float rgb[3] = { static_cast<float>(pixel[0]), static_cast<float>(pixel[1]), static_cast<float>(pixel[2]) };
+			file.write(reinterpret_cast<const char*>(rgb), sizeof(rgb));
+		}
+		return static_cast<bool>(file);
+	}
+
+	// returns false when there is no saved reference for these settings
+	bool LoadReference() {
+		if (settings.referencePath.empty())
+			return false;
+		std::ifstream file(settings.referencePath, std::ios::binary);
+		std::string header, expected = "rtref " + settings.scene + " " + std::to_string(settings.width) + " " + std::to_string(settings.height) + " "
+			+ std::to_string(settings.referenceSpp) + " " + std::to_string(settings.maxRayBounces);
+		if (!file || !std::getline(file, header) || header != expected)
+			return false;
+
+		std::vector<Color> loaded(static_cast<size_t>(settings.width) * settings.height);
+		for (Color& pixel : loaded) {
+			float rgb[3];
+			if (!file.read(reinterpret_cast<char*>(rgb), sizeof(rgb)))
+				return false;
+			pixel = Color(rgb[0], rgb[1], rgb[2]);
+		}
+		reference = std::move(loaded);
+		std::clog << "Convergence: reusing reference " << settings.referencePath << "\n";
+		return true;
+	}
+};
+
+// Configurations by name, each applied on top of `base`: current, single, packets4, packets8, wavefront, float, generic.
+// returns function's success
+inline bool GetConvergenceConfig(const std::string& name, std::function<void(Camera&)> base, ConvergenceConfig& config) {
+	std::function<void(Camera&)> change;
+	if (name == "current") change = [](Camera&) {};
+	else if (name == "single") change = [](Camera& camera) { camera.packetSize = 0; camera.wavefront = false; };
+	else if (name == "packets4") change = [](Camera& camera) { camera.packetSize = 4; camera.wavefront = false; };
+	else if (name == "packets8") change = [](Camera& camera) { camera.packetSize = 8; camera.wavefront = false; };
+	else if (name == "wavefront") change = [](Camera& camera) { camera.wavefront = true; };
+	else if (name == "float") change = [](Camera& camera) { camera.singlePrecision = true; };
+	else if (name == "generic") change = [](Camera& camera) { camera.specializedKernels = false; };
+	else return false;
+
+	config.name = name;
+	config.configure = [base, change](Camera& camera) {
+		if (base)
+			base(camera);
+		change(camera);
+	};
+	return true;
+}
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "MemoryStats.h"
+#include "PixelColor.h"
+#include "Texture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define COST_MAP_RDTSC 1
+#endif
+
+// time stamp counter where the CPU has one, nanoseconds elsewhere
+inline uint64_t ReadCycleCounter() {
+#if COST_MAP_RDTSC
+	return __rdtsc();
+#else
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Per pixel cost of a render: cycles spent, traversal steps (bounding volume nodes and primitives tested)
+// and rays traced, summed over the pixel's samples. Each pixel is recorded by the one thread that renders it.
+class CostMap {
+public:
+	enum class Metric { Cycles, TraversalSteps, PathLength, Count };
+
+	CostMap(int _width, int _height)
+		: width(_width), height(_height), pixels(static_cast<size_t>(_width) * _height) {
+		bytes.Set(pixels.size() * sizeof(Pixel));
+	}
+
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+
+	void Record(int x, int y, uint64_t cycles, uint64_t steps, uint64_t rays, int samples) {
+		Pixel& pixel = pixels[static_cast<size_t>(y) * width + x];
+		pixel.cycles += cycles;
+		pixel.steps += steps;
+		pixel.rays += rays;
+		pixel.samples += samples;
+	}
+
+	// the metric of one pixel, path length is the mean number of rays per sample
+	double Get(int x, int y, Metric metric) const {
+		const Pixel& pixel = pixels[static_cast<size_t>(y) * width + x];
+		switch (metric) {
+			case Metric::Cycles:         return static_cast<double>(pixel.cycles);
+			case Metric::TraversalSteps: return static_cast<double>(pixel.steps);
+			default:                     return pixel.samples ? static_cast<double>(pixel.rays) / pixel.samples : 0.0;
+		}
+	}
+
+	static const char* GetName(Metric metric) {
+		static const char* names[] = { "cycles", "steps", "pathlength" };
+		return names[static_cast<int>(metric)];
+	}
+
+	// Writes the metric as a false colour PNG, blue for cheap pixels through green and yellow to red for the costliest.
+	// The scale ends at the 99th percentile so a few extreme pixels do not wash out the rest.
+	// returns function's success
+	bool SaveHeatmap(const char* path, Metric metric) const {
+		const double scale = Percentile(metric, 0.99);
+		Texture image(width, height);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				double value = scale > 0 ? std::min(Get(x, y, metric) / scale, 1.0) : 0.0;
+				image.SetPixel(x, y, PixelColor(FalseColour(value)));
+			}
+		}
+		return image.SaveToFile(path);
+	}
+
+	// totals and the spread between cheap and expensive pixels of every metric
+	void Print(std::ostream& out) const {
+		out << "Pixel cost (median / p99 / max):";
+		for (int i = 0; i < static_cast<int>(Metric::Count); i++) {
+			Metric metric = static_cast<Metric>(i);
+			out << (i ? ", " : " ") << GetName(metric) << " " << Percentile(metric, 0.5) << " / " << Percentile(metric, 0.99)
+				<< " / " << Percentile(metric, 1.0);
+		}
+		out << "\n";
+	}
+
+private:
+	struct Pixel {
+		uint64_t cycles = 0;
+		uint64_t steps = 0;
+		uint64_t rays = 0;
+		uint32_t samples = 0;
+	};
+
+	int width, height;
+	std::vector<Pixel> pixels;
+	MemoryCounter bytes{ MemorySubsystem::Diagnostics };
+
+	double Percentile(Metric metric, double p) const {
+		std::vector<double> values;
+		values.reserve(pixels.size());
+		for (int y = 0; y < height; y++)
+			for (int x = 0; x < width; x++)
+				values.push_back(Get(x, y, metric));
+		if (values.empty())
+			return 0;
+
+		size_t rank = std::min(static_cast<size_t>(p * (values.size() - 1) + 0.5), values.size() - 1);
+		std::nth_element(values.begin(), values.begin() + rank, values.end());
+		return values[rank];
+	}
+
+	// blue, cyan, green, yellow, red for value 0 to 1
+	static Color FalseColour(double value) {
+		static const Color stops[5] = { Color(0, 0, 1), Color(0, 1, 1), Color(0, 1, 0), Color(1, 1, 0), Color(1, 0, 0) };
+		double position = value * 4;
+		int i = std::min(static_cast<int>(position), 3);
+		double f = position - i;
+		return stops[i] + (stops[i + 1] - stops[i]) * f;
+	}
+};
@@ -0,0 +1,380 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "Hittable.h"
+#include "MemoryStats.h"
+#include "Scene.h"
+#include "Sphere.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Coarse cells dividing a box around the scene, so a pixel can record where its paths went and a sphere appearing
+// anywhere can be matched with the paths that pass its place. Spheres far larger than the typical one, like a ground
+// sphere, are left out of the box so the cells are not stretched over empty space.
+struct DependencyGrid {
+	static const int cellsPerAxis = 8;
+	static const int cellWords = cellsPerAxis * cellsPerAxis * cellsPerAxis / 64;
+
+	float min[3] = { -1, -1, -1 };
+	float max[3] = { 1, 1, 1 };
+
+	void Fit(const SceneDescription& scene) {
+		std::vector<float> radii;
+		for (size_t i = 0; i < scene.GetSphereCount(); i++)
+			radii.push_back(scene.GetSpheres()[i].radius);
+		if (radii.empty())
+			return;
+		std::nth_element(radii.begin(), radii.begin() + radii.size() / 2, radii.end());
+		const float largest = 10 * radii[radii.size() / 2];
+
+		double lo[3] = { infinity, infinity, infinity }, hi[3] = { -infinity, -infinity, -infinity };
+		for (size_t i = 0; i < scene.GetSphereCount(); i++) {
+			const SphereRecord& sphere = scene.GetSpheres()[i];
+			if (sphere.radius > largest)
+				continue;
+			for (int axis = 0; axis < 3; axis++) {
+				lo[axis] = std::min(lo[axis], static_cast<double>(sphere.center[axis]) - sphere.radius);
+				hi[axis] = std::max(hi[axis], static_cast<double>(sphere.center[axis]) + sphere.radius);
+			}
+		}
+
+		// a margin so that edits next to the scene still land in cells
+		const double margin = 0.25 * std::max({ hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], 1e-3 });
+		for (int axis = 0; axis < 3; axis++) {
+			min[axis] = static_cast<float>(lo[axis] - margin);
+			max[axis] = static_cast<float>(hi[axis] + margin);
+		}
+	}
+
+	// adds the cells overlapping the box [lo, hi] to cells, and whether any of it lies outside the grid
+	void AddCells(const double lo[3], const double hi[3], uint64_t cells[cellWords], bool& outside) const {
+		int first[3], last[3];
+		for (int axis = 0; axis < 3; axis++) {
+			outside |= lo[axis] < min[axis] || hi[axis] > max[axis];
+			first[axis] = GetCell(axis, lo[axis]);
+			last[axis] = GetCell(axis, hi[axis]);
+		}
+		for (int z = first[2]; z <= last[2]; z++)
+			for (int y = first[1]; y <= last[1]; y++)
+				for (int x = first[0]; x <= last[0]; x++) {
+					const int bit = (z * cellsPerAxis + y) * cellsPerAxis + x;
+					cells[bit / 64] |= 1ull << (bit % 64);
+				}
+	}
+
+	// adds the cells crossed by origin + t * direction for t in [0, length], as those of the boxes around short pieces of it
+	void AddSegment(const Point3& origin, const Vec3& direction, double length, uint64_t cells[cellWords], bool& outside) const {
+		double t0 = 0, t1 = length;
+		for (int axis = 0; axis < 3; axis++) {
+			if (direction[axis] == 0) {
+				if (origin[axis] < min[axis] || origin[axis] > max[axis])
+					t1 = -1;
+				continue;
+			}
+			double near = (min[axis] - origin[axis]) / direction[axis];
+			double far = (max[axis] - origin[axis]) / direction[axis];
+			if (near > far)
+				std::swap(near, far);
+			t0 = std::max(t0, near);
+			t1 = std::min(t1, far);
+		}
+		if (t0 > 0 || t1 < length)
+			outside = true;
+		if (t0 > t1)
+			return;
+
+		// pieces are padded a little for the rounding of points along the segment
+		const int pieces = 2 * cellsPerAxis;
+		for (int i = 0; i < pieces; i++) {
+			const Point3 a = origin + (t0 + (t1 - t0) * i / pieces) * direction;
+			const Point3 b = origin + (t0 + (t1 - t0) * (i + 1) / pieces) * direction;
+			double lo[3], hi[3];
+			for (int axis = 0; axis < 3; axis++) {
+				const double pad = 1e-3 * (max[axis] - min[axis]) / cellsPerAxis;
+				lo[axis] = std::min(a[axis], b[axis]) - pad;
+				hi[axis] = std::max(a[axis], b[axis]) + pad;
+			}
+			bool clipped = false;
+			AddCells(lo, hi, cells, clipped);
+		}
+	}
+
+private:
+	int GetCell(int axis, double position) const {
+		const double cell = std::floor((position - min[axis]) / (max[axis] - min[axis]) * cellsPerAxis);
+		return static_cast<int>(std::clamp(cell, 0.0, static_cast<double>(cellsPerAxis - 1)));
+	}
+};
+
+// Bits standing for the spheres and materials the paths of a pixel hit and the grid cells they crossed.
+// Spheres are hashed by position and radius and materials by index onto the bits, so several may share one
+// and a set bit only says the pixel may depend on it.
+struct PixelDependencies {
+	static const int primitiveBits = 128;
+	static const int materialBits = 64;
+
+	uint64_t primitives[primitiveBits / 64] = {};
+	uint64_t materials = 0;
+	uint64_t cells[DependencyGrid::cellWords] = {};
+	bool outside = false;		// a path went outside the grid, which includes every path into the sky
+	const DependencyGrid* grid = nullptr;
+
+	explicit PixelDependencies(const DependencyGrid* _grid = nullptr) : grid(_grid) {}
+
+	static int GetPrimitiveBit(const float center[3], float radius) {
+		const float key[4] = { center[0], center[1], center[2], radius };
+		return static_cast<int>(HashBytes(key, sizeof(key)) % primitiveBits);
+	}
+
+	static int GetMaterialBit(uint32_t materialId) { return static_cast<int>(materialId % materialBits); }
+
+	// records a ray traced for the path, up to its hit or to infinity when it escaped
+	template <typename T>
+	void AddSegment(const RayT<T>& r, T length) {
+		grid->AddSegment(Point3(r.origin), Vec3(r.direction), static_cast<double>(length), cells, outside);
+	}
+
+	// records a hit found by any scene's Intersect
+	template <typename T>
+	void Add(const HittableT<T>* primitive, uint32_t materialId) {
+		materials |= 1ull << GetMaterialBit(materialId);
+
+		// the spheres of a flat scene are copies, so they are recognised by their shape rather than their address
+		if (const SphereT<T>* sphere = dynamic_cast<const SphereT<T>*>(primitive)) {
+			const Vec3T<T>& center = sphere->GetCenter();
+			const float c[3] = { static_cast<float>(center[0]), static_cast<float>(center[1]), static_cast<float>(center[2]) };
+			const int bit = GetPrimitiveBit(c, static_cast<float>(sphere->GetRadius()));
+			primitives[bit / 64] |= 1ull << (bit % 64);
+		}
+		else {
+			// anything else could be any edit
+			for (uint64_t& word : primitives)
+				word = ~0ull;
+		}
+	}
+};
+
+struct DependencyFileHeader {
+	char magic[8];			// "RTDEPS" followed by zero bytes
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t sphereCount;	// records of the scene the pixels were rendered from follow the header
+	uint32_t materialCount;
+	uint32_t reserved;
+	uint64_t fingerprint;	// view and render settings the pixels were rendered with
+	float gridMin[3];		// box of the grid the pixels' cells divide
+	float gridMax[3];
+};
+
+static_assert(sizeof(DependencyFileHeader) == 64, "DependencyFileHeader layout changed");
+
+// Per pixel record of the last render of a scene: what its paths hit and the colour they averaged to.
+// After the scene is edited, Invalidate marks the pixels the edit may have changed as dirty, and a Camera given
+// the map renders only those, reusing the stored colour of every other pixel.
+// Removed, moved or changed spheres and changed materials invalidate every pixel whose paths hit them, at any bounce,
+// and spheres appearing in a new place invalidate every pixel whose paths crossed a grid cell they overlap, so no
+// pixel an edit can change is reused. A sphere reaching out of the grid invalidates every pixel that sees the sky.
+class DependencyMap {
+public:
+	DependencyMap(int _width, int _height)
+		: width(_width), height(_height), pixels(static_cast<size_t>(_width) * _height) {
+		bytes.Set(pixels.size() * sizeof(Pixel));
+	}
+
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+	const DependencyGrid& GetGrid() const { return grid; }
+
+	// places the grid around a scene, for a map that records its first render; a loaded map keeps the grid it was saved with
+	void FitGrid(const SceneDescription& scene) { grid.Fit(scene); }
+
+	bool IsDirty(int x, int y) const { return pixels[static_cast<size_t>(y) * width + x].dirty != 0; }
+
+	Color GetColor(int x, int y) const {
+		const float* color = pixels[static_cast<size_t>(y) * width + x].color;
+		return Color(color[0], color[1], color[2]);
+	}
+
+	// stores a re-rendered pixel, which is then clean; each pixel is recorded by the one thread that renders it
+	void Record(int x, int y, const PixelDependencies& touched, const Color& color) {
+		Pixel& pixel = pixels[static_cast<size_t>(y) * width + x];
+		std::copy(std::begin(touched.primitives), std::end(touched.primitives), pixel.primitives);
+		pixel.materials = touched.materials;
+		std::copy(std::begin(touched.cells), std::end(touched.cells), pixel.cells);
+		pixel.outside = touched.outside;
+		pixel.color[0] = static_cast<float>(color[0]);
+		pixel.color[1] = static_cast<float>(color[1]);
+		pixel.color[2] = static_cast<float>(color[2]);
+		pixel.dirty = 0;
+	}
+
+	void InvalidateAll() {
+		for (Pixel& pixel : pixels)
+			pixel.dirty = 1;
+	}
+
+	size_t GetDirtyCount() const {
+		size_t count = 0;
+		for (const Pixel& pixel : pixels)
+			count += pixel.dirty;
+		return count;
+	}
+
+	double GetDirtyFraction() const { return pixels.empty() ? 0.0 : static_cast<double>(GetDirtyCount()) / pixels.size(); }
+
+	// Compares scene with the one the map was last saved with and marks the pixels the difference may reach.
+	// Spheres are matched by their records, so a moved or re-materialed sphere is one removed and one added.
+	void Invalidate(const SceneDescription& scene) {
+		// spheres of the last render left unmatched by the new scene were removed or changed
+		std::unordered_map<std::string, int> previous;
+		for (const SphereRecord& sphere : spheres)
+			previous[GetKey(sphere)]++;
+
+		PixelDependencies edited;	// what the edits reach: bits of changed spheres and materials, cells of added spheres
+		bool addedOutside = false;
+		for (size_t i = 0; i < scene.GetSphereCount(); i++) {
+			const SphereRecord& sphere = scene.GetSpheres()[i];
+			auto match = previous.find(GetKey(sphere));
+			if (match != previous.end() && match->second > 0) {
+				match->second--;
+				continue;
+			}
+
+			// added: any path that passed its place may now hit it
+			double lo[3], hi[3];
+			for (int axis = 0; axis < 3; axis++) {
+				lo[axis] = static_cast<double>(sphere.center[axis]) - sphere.radius;
+				hi[axis] = static_cast<double>(sphere.center[axis]) + sphere.radius;
+			}
+			grid.AddCells(lo, hi, edited.cells, addedOutside);
+		}
+		for (const SphereRecord& sphere : spheres) {
+			auto match = previous.find(GetKey(sphere));
+			if (match->second > 0) {
+				match->second--;
+				const int bit = PixelDependencies::GetPrimitiveBit(sphere.center, sphere.radius);
+				edited.primitives[bit / 64] |= 1ull << (bit % 64);
+			}
+		}
+
+		// materials are referenced by index, so any record that differs changed every sphere using it
+		for (size_t i = 0; i < std::min(materials.size(), scene.GetMaterialCount()); i++) {
+			if (std::memcmp(&materials[i], &scene.GetMaterials()[i], sizeof(MaterialRecord)) != 0)
+				edited.materials |= 1ull << PixelDependencies::GetMaterialBit(static_cast<uint32_t>(i));
+		}
+
+		for (Pixel& pixel : pixels) {
+			bool hit = (pixel.materials & edited.materials) != 0 || (addedOutside && pixel.outside);
+			for (int i = 0; i < PixelDependencies::primitiveBits / 64; i++)
+				hit |= (pixel.primitives[i] & edited.primitives[i]) != 0;
+			for (int i = 0; i < DependencyGrid::cellWords; i++)
+				hit |= (pixel.cells[i] & edited.cells[i]) != 0;
+			if (hit)
+				pixel.dirty = 1;
+		}
+	}
+
+	// writes the pixels with the scene they were rendered from, the scene Invalidate compares the next one with
+	// returns function's success
+	bool Save(const char* path, uint64_t fingerprint, const SceneDescription& scene) {
+		spheres.assign(scene.GetSpheres(), scene.GetSpheres() + scene.GetSphereCount());
+		materials.assign(scene.GetMaterials(), scene.GetMaterials() + scene.GetMaterialCount());
+
+		DependencyFileHeader header = MakeHeader(fingerprint);
+		std::string temporary = std::string(path) + ".tmp";
+		FILE* out = fopen(temporary.c_str(), "wb");
+		if (!out)
+			return false;
+		bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+			&& fwrite(spheres.data(), sizeof(SphereRecord), spheres.size(), out) == spheres.size()
+			&& fwrite(materials.data(), sizeof(MaterialRecord), materials.size(), out) == materials.size()
+			&& fwrite(pixels.data(), sizeof(Pixel), pixels.size(), out) == pixels.size();
+		ok = fclose(out) == 0 && ok;
+
+		std::error_code ec;
+		if (ok)
+			std::filesystem::rename(temporary, path, ec);
+		return ok && !ec;
+	}
+
+	// reads the map of an earlier render with the same view and settings, all of whose pixels start clean
+	// returns false when there is none, in which case every pixel is dirty and the grid is left to FitGrid
+	bool Load(const char* path, uint64_t fingerprint) {
+		spheres.clear();
+		materials.clear();
+		InvalidateAll();
+
+		FILE* in = fopen(path, "rb");
+		if (!in)
+			return false;
+
+		DependencyFileHeader header;
+		DependencyFileHeader expected = MakeHeader(fingerprint);
+		bool ok = fread(&header, sizeof(header), 1, in) == 1 && std::memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+			&& header.version == expected.version && header.width == expected.width && header.height == expected.height
+			&& header.fingerprint == expected.fingerprint;
+		if (ok) {
+			spheres.resize(header.sphereCount);
+			materials.resize(header.materialCount);
+			ok = fread(spheres.data(), sizeof(SphereRecord), spheres.size(), in) == spheres.size()
+				&& fread(materials.data(), sizeof(MaterialRecord), materials.size(), in) == materials.size()
+				&& fread(pixels.data(), sizeof(Pixel), pixels.size(), in) == pixels.size();
+			std::copy(std::begin(header.gridMin), std::end(header.gridMin), grid.min);
+			std::copy(std::begin(header.gridMax), std::end(header.gridMax), grid.max);
+		}
+		fclose(in);
+
+		if (!ok) {
+			spheres.clear();
+			materials.clear();
+			InvalidateAll();
+			return false;
+		}
+		for (Pixel& pixel : pixels)
+			pixel.dirty = 0;
+		return true;
+	}
+
+private:
+	static const uint32_t version = 2;
+
+	struct Pixel {
+		uint64_t primitives[PixelDependencies::primitiveBits / 64] = {};
+		uint64_t materials = 0;
+		uint64_t cells[DependencyGrid::cellWords] = {};
+		float color[3] = {};	// linear mean of the pixel's samples
+		uint8_t dirty = 1;
+		uint8_t outside = 0;
+		uint16_t reserved = 0;
+	};
+
+	int width, height;
+	DependencyGrid grid;
+	std::vector<Pixel> pixels;
+	std::vector<SphereRecord> spheres;		// of the scene the pixels were rendered from
+	std::vector<MaterialRecord> materials;
+	MemoryCounter bytes{ MemorySubsystem::Diagnostics };
+
+	static std::string GetKey(const SphereRecord& sphere) { return std::string(reinterpret_cast<const char*>(&sphere), sizeof(sphere)); }
+
+	DependencyFileHeader MakeHeader(uint64_t fingerprint) const {
+		DependencyFileHeader header = {};
+		std::memcpy(header.magic, "RTDEPS", 7);
+		header.version = version;
+		header.width = static_cast<uint32_t>(width);
+		header.height = static_cast<uint32_t>(height);
+		header.sphereCount = static_cast<uint32_t>(spheres.size());
+		header.materialCount = static_cast<uint32_t>(materials.size());
+		header.fingerprint = fingerprint;
+		std::copy(std::begin(grid.min), std::end(grid.min), header.gridMin);
+		std::copy(std::begin(grid.max), std::end(grid.max), header.gridMax);
+		return header;
+	}
+};
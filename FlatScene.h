@@ -0,0 +1,182 @@
+#pragma once
+
+#include "BVH.h"
+#include "Hittable.h"
+#include "HittableList.h"
+#include "MemoryStats.h"
+#include "Simd.h"
+#include "Sphere.h"
+
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// A scene whose primitive kinds are fixed at compile time.
+// Each kind is stored by value in its own contiguous array and called directly,
+// so the compiler can inline intersection into the render loop.
+// All kinds share one scalar type, which may differ from the double precision scene they are gathered from.
+// Small sets of spheres are laid out as SoA lanes and intersected by the SIMD kernels of the best available instruction set,
+// larger ones are reordered into a bounding volume hierarchy, which can also trace coherent packets of rays.
+template <typename... Primitives>
+class FlatScene {
+	static_assert((std::is_final<Primitives>::value && ...), "primitive kinds must be final so their calls are direct");
+
+public:
+	using Scalar = typename std::tuple_element<0, std::tuple<Primitives...>>::type::Scalar;
+
+	// copies the objects of `world` into per-kind arrays, converting them to Scalar
+	// returns false if the world holds anything else, in which case the generic path has to be used
+	bool Gather(const HittableList& world) {
+		Clear();
+		for (const auto& object : world.objects) {
+			if (!(TryAdd<Primitives>(*object) || ...)) {
+				Clear();
+				return false;
+			}
+		}
+
+		kernels = &GetSimdKernels();
+		if constexpr ((std::is_same<SphereT<Scalar>, Primitives>::value || ...)) {
+			std::vector<SphereT<Scalar>>& spheres = std::get<std::vector<SphereT<Scalar>>>(primitives);
+			if (spheres.size() >= minBVHSpheres) {
+				sphereBVH.Build(spheres);
+			}
+			else {
+				for (const SphereT<Scalar>& sphere : spheres)
+					sphereLanes.Add(sphere.GetCenter(), sphere.GetRadius());
+			}
+		}
+
+		bytes.Set((GetBytes<Primitives>() + ...) + sphereLanes.GetBytes() + sphereBVH.GetBytes());
+		return true;
+	}
+
+	void Clear() {
+		(std::get<std::vector<Primitives>>(primitives).clear(), ...);
+		sphereLanes.Clear();
+		sphereBVH.Clear();
+		bytes.Set(0);
+	}
+
+	size_t GetCount() const { return (std::get<std::vector<Primitives>>(primitives).size() + ...); }
+
+	bool Intersect(const RayT<Scalar>& r, IntervalT<Scalar> rayLengthLimits, RayHitT<Scalar>& hit) const {
+		bool hitSomething = false;
+		Scalar closest_so_far = rayLengthLimits.max;
+		(IntersectKind<Primitives>(r, rayLengthLimits.min, closest_so_far, hit, hitSomething), ...);
+		return hitSomething;
+	}
+
+	// closest hit of every ray in the packet, hits[i].primitive is null where ray i missed
+	void IntersectPacket(RayPacket<Scalar>& packet, Scalar tMin, RayHitT<Scalar>* hits) const {
+		for (int i = 0; i < packet.count; i++)
+			hits[i].primitive = nullptr;
+		(IntersectPacketKind<Primitives>(packet, tMin, hits), ...);
+	}
+
+	void Finalize(const RayT<Scalar>& r, const RayHitT<Scalar>& hit, HitPointT<Scalar>& rec) const {
+		(FinalizeKind<Primitives>(r, hit, rec) || ...);
+	}
+
+private:
+	// below this the SIMD kernels testing every sphere beat the hierarchy
+	static const size_t minBVHSpheres = 32;
+
+	std::tuple<std::vector<Primitives>...> primitives;
+	SphereLanes<Scalar> sphereLanes;
+	SphereBVH<Scalar> sphereBVH;
+	const SimdKernels* kernels = nullptr;
+	MemoryCounter bytes{ MemorySubsystem::Primitives };
+
+	// spheres are an empty list when they are not one of the kinds
+	template <typename T>
+	const std::vector<T>& GetList() const {
+		static const std::vector<T> none;
+		if constexpr ((std::is_same<T, Primitives>::value || ...))
+			return std::get<std::vector<T>>(primitives);
+		else
+			return none;
+	}
+
+	template <typename T>
+	bool TryAdd(const Hittable& object) {
+		using Source = typename T::template Rebind<double>;
+		const Source* primitive = dynamic_cast<const Source*>(&object);
+		if (!primitive)
+			return false;
+		std::get<std::vector<T>>(primitives).emplace_back(*primitive);
+		return true;
+	}
+
+	template <typename T>
+	size_t GetBytes() const {
+		return std::get<std::vector<T>>(primitives).capacity() * sizeof(T);
+	}
+
+	template <typename T>
+	void IntersectKind(const RayT<Scalar>& r, Scalar tMin, Scalar& closest_so_far, RayHitT<Scalar>& hit, bool& hitSomething) const {
+		if constexpr (std::is_same<T, SphereT<Scalar>>::value) {
+			int64_t index = sphereBVH.IsEmpty() ? kernels->ClosestSphere(sphereLanes, r, tMin, closest_so_far) : sphereBVH.Intersect(r, tMin, closest_so_far);
+			if (sphereBVH.IsEmpty()) {
+				TraversalSteps() += sphereLanes.count;
+				// the lane kernels test every sphere and only report the closest hit
+				RENDER_STAT(intersectionTests += sphereLanes.count);
+				RENDER_STAT(primitiveHits += index >= 0);
+			}
+			if (index >= 0) {
+				hit.t = closest_so_far;
+				hit.primitive = &GetList<T>()[index];
+				hitSomething = true;
+			}
+			return;
+		}
+
+		TraversalSteps() += std::get<std::vector<T>>(primitives).size();
+		for (const T& primitive : std::get<std::vector<T>>(primitives)) {
+			if (primitive.Intersect(r, IntervalT<Scalar>(tMin, closest_so_far), hit)) {
+				hitSomething = true;
+				closest_so_far = hit.t;
+			}
+		}
+	}
+
+	template <typename T>
+	void IntersectPacketKind(RayPacket<Scalar>& packet, Scalar tMin, RayHitT<Scalar>* hits) const {
+		if constexpr (std::is_same<T, SphereT<Scalar>>::value) {
+			if (!sphereBVH.IsEmpty()) {
+				sphereBVH.IntersectPacket(packet, tMin);
+				for (int i = 0; i < packet.count; i++) {
+					if (packet.hitIndex[i] >= 0) {
+						hits[i].t = packet.tMax[i];
+						hits[i].primitive = &GetList<T>()[packet.hitIndex[i]];
+					}
+				}
+				return;
+			}
+		}
+
+		// no hierarchy for this kind, rays go one at a time
+		for (int i = 0; i < packet.count; i++) {
+			bool hitSomething = false;
+			IntersectKind<T>(packet.rays[i], tMin, packet.tMax[i], hits[i], hitSomething);
+		}
+	}
+
+	// finalizes the hit if it belongs to the array of kind T
+	template <typename T>
+	bool FinalizeKind(const RayT<Scalar>& r, const RayHitT<Scalar>& hit, HitPointT<Scalar>& rec) const {
+		const std::vector<T>& list = std::get<std::vector<T>>(primitives);
+		if (list.empty())
+			return false;
+
+		std::less<const HittableT<Scalar>*> before;
+		const HittableT<Scalar>* first = &list.front();
+		const HittableT<Scalar>* last = &list.back();
+		if (before(hit.primitive, first) || before(last, hit.primitive))
+			return false;
+
+		static_cast<const T*>(hit.primitive)->T::Finalize(r, hit, rec);
+		return true;
+	}
+};
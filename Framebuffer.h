@@ -0,0 +1,313 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "MappedFile.h"
+#include "MemoryStats.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+enum class AccumulationFormat {
+	Float32,	// 3 x float running mean + 32-bit sample count, 16 bytes per pixel
+	Float16		// 3 x half running mean + 16-bit sample count, 8 bytes per pixel
+};
+
+// IEEE 754 binary16 conversions, round to nearest even
+inline uint16_t FloatToHalf(float value) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	if (((bits >> 23) & 0xFF) == 0xFF) // inf / nan
+		return static_cast<uint16_t>(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+	if (exponent >= 31) // overflow to inf
+		return static_cast<uint16_t>(sign | 0x7C00);
+	if (exponent <= 0) {
+		// subnormal or zero
+		if (exponent < -10)
+			return static_cast<uint16_t>(sign);
+		mantissa |= 0x800000;
+		uint32_t shift = static_cast<uint32_t>(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1);
+		uint32_t halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (half & 1)))
+			half++;
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1FFF;
+	if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+		half++; // may carry into the exponent, which rounds up correctly
+	return static_cast<uint16_t>(half);
+}
+
+inline float HalfToFloat(uint16_t half) {
+	uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1F;
+	uint32_t mantissa = half & 0x3FF;
+	uint32_t bits;
+
+	if (exponent == 0) {
+		if (mantissa == 0) {
+			bits = sign;
+		}
+		else {
+			// normalise subnormal
+			exponent = 127 - 15 + 1;
+			while ((mantissa & 0x400) == 0) {
+				mantissa <<= 1;
+				exponent--;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3FF) << 13);
+		}
+	}
+	else if (exponent == 0x1F) {
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	}
+	else {
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+
+	float value;
+	std::memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// Float accumulation buffer stored in a memory-mapped file as square tiles.
+// Only a bounded number of tiles are mapped at a time, so the image size is limited by disk space rather than RAM.
+// The budget is at least two rows of tiles, since rows are accessed whole and workers near a tile boundary may be
+// on either side of it; any less and every row would map and unmap each of its tiles again.
+// Each pixel stores the running mean of its samples and the sample count, allowing progressive rendering.
+class TiledFramebuffer {
+public:
+	static const int tileSize = 64; // tile edge length in pixels
+
+	TiledFramebuffer(int _width, int _height, AccumulationFormat _format, const char* backingPath, size_t _maxResidentTiles)
+		: width(_width), height(_height), format(_format), maxResidentTiles(std::max<size_t>(_maxResidentTiles, 1))
+	{
+		tilesX = (width + tileSize - 1) / tileSize;
+		tilesY = (height + tileSize - 1) / tileSize;
+		maxResidentTiles = std::max(maxResidentTiles, GetMinResidentTiles(width));
+
+		pixelBytes = format == AccumulationFormat::Float32 ? 16 : 8;
+		tileBytes = static_cast<size_t>(tileSize) * tileSize * pixelBytes;
+
+		// every tile must start on a mapping boundary
+		size_t granularity = MappedFile::GetGranularity();
+		tileStride = (tileBytes + granularity - 1) / granularity * granularity;
+
+		tiles.resize(static_cast<size_t>(tilesX) * tilesY);
+		valid = file.Create(backingPath, static_cast<uint64_t>(tileStride) * tiles.size());
+	}
+
+	~TiledFramebuffer() {
+		for (auto& tile : tiles)
+			MappedFile::Unmap(tile.view, tileBytes);
+	}
+
+	bool IsValid() const { return valid; }
+
+	// smallest budget of mapped tiles for an image `width` pixels wide
+	static size_t GetMinResidentTiles(int width) { return 2 * static_cast<size_t>((width + tileSize - 1) / tileSize); }
+	size_t GetMaxResidentTiles() const { return maxResidentTiles; }
+
+	int GetResolutionX() const { return width; }
+	int GetResolutionY() const { return height; }
+	AccumulationFormat GetFormat() const { return format; }
+
+	// merges `samples` new samples with per-pixel mean `rowMean` into row y
+	// writes the updated running mean of every pixel in the row to `outMean` (may alias rowMean)
+	// returns false when a tile could not be mapped
+	bool AccumulateRow(int y, const Color* rowMean, int samples, Color* outMean) {
+		return ForEachTileInRow(y, [&](uint8_t* tileRow, int x0, int count) {
+			for (int i = 0; i < count; i++) {
+				uint8_t* pixel = tileRow + i * pixelBytes;
+				Color mean;
+				uint32_t n;
+				Load(pixel, mean, n);
+
+				// keep the half-float sample count from wrapping
+				uint32_t added = static_cast<uint32_t>(samples);
+				if (format == AccumulationFormat::Float16)
+					added = std::min<uint32_t>(added, 0xFFFF - n);
+
+				if (added > 0) {
+					uint32_t total = n + added;
+					mean += (rowMean[x0 + i] - mean) * (static_cast<double>(added) / total);
+					n = total;
+					Store(pixel, mean, n);
+				}
+
+				outMean[x0 + i] = mean;
+			}
+		});
+	}
+
+	// reads the running mean and sample count of row y
+	// returns false when a tile could not be mapped
+	bool ReadRow(int y, Color* outMean, uint32_t* outSamples) {
+		return ForEachTileInRow(y, [&](uint8_t* tileRow, int x0, int count) {
+			for (int i = 0; i < count; i++) {
+				uint32_t n;
+				Load(tileRow + i * pixelBytes, outMean[x0 + i], n);
+				if (outSamples)
+					outSamples[x0 + i] = n;
+			}
+		});
+	}
+
+	// overwrites the running mean and sample count of row y, e.g. to restore a checkpoint
+	// returns false when a tile could not be mapped
+	bool WriteRow(int y, const Color* mean, const uint32_t* samples) {
+		return ForEachTileInRow(y, [&](uint8_t* tileRow, int x0, int count) {
+			for (int i = 0; i < count; i++)
+				Store(tileRow + i * pixelBytes, mean[x0 + i], samples[x0 + i]);
+		});
+	}
+
+	// bytes currently mapped into the address space
+	size_t GetResidentBytes() {
+		std::lock_guard<std::mutex> lk(tileMutex);
+		return residentTiles.size() * tileBytes;
+	}
+
+	size_t GetPeakResidentBytes() const { return peakResidentTiles * tileBytes; }
+
+	// bytes of the backing file
+	uint64_t GetFileBytes() const { return file.GetSize(); }
+
+private:
+	struct Tile {
+		uint8_t* view = nullptr;
+		int pins = 0;
+		uint64_t lastUse = 0;
+	};
+
+	int width, height;
+	int tilesX, tilesY;
+	AccumulationFormat format;
+	size_t pixelBytes;
+	size_t tileBytes;
+	size_t tileStride;
+	size_t maxResidentTiles;
+	size_t peakResidentTiles = 0;
+	bool valid = false;
+
+	MappedFile file;
+	std::vector<Tile> tiles;
+	std::vector<size_t> residentTiles;
+	std::mutex tileMutex;
+	uint64_t useCounter = 0;
+	MemoryCounter residentBytes{ MemorySubsystem::Framebuffer };
+
+	// returns false when a tile could not be mapped
+	template <typename Func>
+	bool ForEachTileInRow(int y, Func func) {
+		int tileY = y / tileSize;
+		int localY = y % tileSize;
+
+		for (int tileX = 0; tileX < tilesX; tileX++) {
+			size_t index = static_cast<size_t>(tileY) * tilesX + tileX;
+			uint8_t* view = Acquire(index);
+			if (!view)
+				return false;
+
+			int x0 = tileX * tileSize;
+			int count = std::min(tileSize, width - x0);
+			func(view + static_cast<size_t>(localY) * tileSize * pixelBytes, x0, count);
+
+			Release(index);
+		}
+		return true;
+	}
+
+	// maps a tile and pins it so it cannot be evicted while in use
+	// returns null, leaving it unpinned, when the tile cannot be mapped
+	uint8_t* Acquire(size_t index) {
+		std::lock_guard<std::mutex> lk(tileMutex);
+		Tile& tile = tiles[index];
+		tile.lastUse = ++useCounter;
+
+		if (tile.view) {
+			tile.pins++;
+			return tile.view;
+		}
+
+		// page out least recently used tiles to stay within budget
+		while (residentTiles.size() >= maxResidentTiles && EvictOne()) {}
+
+		tile.view = file.Map(static_cast<uint64_t>(index) * tileStride, tileBytes);
+		if (!tile.view)
+			return nullptr;
+		tile.pins++;
+		residentTiles.push_back(index);
+		peakResidentTiles = std::max(peakResidentTiles, residentTiles.size());
+		residentBytes.Set(residentTiles.size() * tileBytes);
+		return tile.view;
+	}
+
+	void Release(size_t index) {
+		std::lock_guard<std::mutex> lk(tileMutex);
+		tiles[index].pins--;
+	}
+
+	// returns false when every resident tile is pinned
+	bool EvictOne() {
+		size_t victim = residentTiles.size();
+		for (size_t i = 0; i < residentTiles.size(); i++) {
+			const Tile& tile = tiles[residentTiles[i]];
+			if (tile.pins == 0 && (victim == residentTiles.size() || tile.lastUse < tiles[residentTiles[victim]].lastUse))
+				victim = i;
+		}
+
+		if (victim == residentTiles.size())
+			return false;
+
+		Tile& tile = tiles[residentTiles[victim]];
+		MappedFile::Unmap(tile.view, tileBytes);
+		tile.view = nullptr;
+		residentTiles[victim] = residentTiles.back();
+		residentTiles.pop_back();
+		residentBytes.Set(residentTiles.size() * tileBytes);
+		return true;
+	}
+
+	void Load(const uint8_t* pixel, Color& mean, uint32_t& samples) const {
+		if (format == AccumulationFormat::Float32) {
+			float rgb[3];
+			std::memcpy(rgb, pixel, sizeof(rgb));
+			std::memcpy(&samples, pixel + 12, sizeof(samples));
+			mean = Color(rgb[0], rgb[1], rgb[2]);
+		}
+		else {
+			uint16_t rgbn[4];
+			std::memcpy(rgbn, pixel, sizeof(rgbn));
+			mean = Color(HalfToFloat(rgbn[0]), HalfToFloat(rgbn[1]), HalfToFloat(rgbn[2]));
+			samples = rgbn[3];
+		}
+	}
+
+	void Store(uint8_t* pixel, const Color& mean, uint32_t samples) const {
+		if (format == AccumulationFormat::Float32) {
+			float rgb[3] = { static_cast<float>(mean[0]), static_cast<float>(mean[1]), static_cast<float>(mean[2]) };
+			std::memcpy(pixel, rgb, sizeof(rgb));
+			std::memcpy(pixel + 12, &samples, sizeof(samples));
+		}
+		else {
+			uint16_t rgbn[4] = {
+				FloatToHalf(static_cast<float>(mean[0])),
+				FloatToHalf(static_cast<float>(mean[1])),
+				FloatToHalf(static_cast<float>(mean[2])),
+				static_cast<uint16_t>(samples)
+			};
+			std::memcpy(pixel, rgbn, sizeof(rgbn));
+		}
+	}
+};
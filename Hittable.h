@@ -2,17 +2,16 @@
 
 #include "RTWeekend.h"
 
-class Material;
-
-class HitPoint {
+template <typename T>
+class HitPointT {
 public:
-	Point3 position;
-	Vec3 normal;
-	shared_ptr<Material> mat;
-	double t;
+	Vec3T<T> position;
+	Vec3T<T> normal;
+	uint32_t materialId;	// index into the scene's MaterialTable
+	T t;
 	bool isFrontFace;
 
-	void set_face_normal(const Ray& r, const Vec3& outwardNormal) {
+	void set_face_normal(const RayT<T>& r, const Vec3T<T>& outwardNormal) {
 		// Sets the hit record normal vector.
 		// NOTE: the parameter `outward_normal` is assumed to have unit length.
 
@@ -21,9 +20,48 @@ public:
 	}
 };
 
-class Hittable {
+template <typename T>
+class HittableT;
+
+// bounding volume nodes visited and primitives tested by this thread's intersection queries,
+// read around a pixel to build the cost heatmap
+inline uint64_t& TraversalSteps() {
+	thread_local uint64_t steps = 0;
+	return steps;
+}
+
+// Minimal record carried through traversal.
+// Shading data is only computed for the final closest hit, see Hittable::Finalize.
+template <typename T>
+struct RayHitT {
+	T t;
+	const HittableT<T>* primitive;	// identifies the primitive that was hit
+};
+
+template <typename T>
+class HittableT {
 public:
-	virtual ~Hittable() = default;
+	using Scalar = T;
+
+	virtual ~HittableT() = default;
+
+	// finds the closest intersection within rayLengthLimits, recording only its distance and primitive
+	// `hit` is left untouched when nothing is hit
+	virtual bool Intersect(const RayT<T>& r, IntervalT<T> rayLengthLimits, RayHitT<T>& hit) const = 0;
+
+	// computes the position, normal, facing and material of a hit found by Intersect
+	virtual void Finalize(const RayT<T>& r, const RayHitT<T>& hit, HitPointT<T>& record) const = 0;
+
+	bool Hit(const RayT<T>& r, IntervalT<T> rayLengthLimits, HitPointT<T>& record) const {
+		RayHitT<T> hit;
+		if (!Intersect(r, rayLengthLimits, hit))
+			return false;
+
+		hit.primitive->Finalize(r, hit, record);
+		return true;
+	}
+};
 
-	virtual bool Hit(const Ray& r, Interval rayLengthLimits, HitPoint& record) const = 0;
-};
\ No newline at end of file
+using HitPoint = HitPointT<double>;
+using RayHit = RayHitT<double>;
+using Hittable = HittableT<double>;
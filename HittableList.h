@@ -22,19 +22,23 @@ public:
 		objects.push_back(object);
 	}
 
-    bool Hit(const Ray& r, Interval rayLengthLimits, HitPoint& rec) const override {
-        HitPoint tempHit;
+    bool Intersect(const Ray& r, Interval rayLengthLimits, RayHit& hit) const override {
         bool hitSomething = false;
         double closest_so_far = rayLengthLimits.max;
+        TraversalSteps() += objects.size();
 
+        // objects only write the small hit record when they are closer
         for (const auto& object : objects) {
-            if (object->Hit(r, Interval(rayLengthLimits.min, closest_so_far), tempHit)) {
+            if (object->Intersect(r, Interval(rayLengthLimits.min, closest_so_far), hit)) {
                 hitSomething = true;
-                closest_so_far = tempHit.t;
-                rec = tempHit;
+                closest_so_far = hit.t;
             }
         }
 
         return hitSomething;
     }
+
+    void Finalize(const Ray& r, const RayHit& hit, HitPoint& rec) const override {
+        hit.primitive->Finalize(r, hit, rec);
+    }
 };
\ No newline at end of file
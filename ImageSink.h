@@ -0,0 +1,30 @@
+#pragma once
+
+#include "PixelColor.h"
+
+// Destination for finished rows of a render.
+// Rows may be written from any render thread and in any order.
+class ImageSink {
+public:
+	virtual ~ImageSink() = default;
+
+	// called once before the first row is written
+	// returns function's success
+	virtual bool Begin(int width, int height) = 0;
+
+	// row points to `width` pixels of image row y
+	// returns function's success
+	virtual bool WriteRow(int y, const PixelColor* row) = 0;
+
+	// called once after the last row is written
+	// returns function's success
+	virtual bool End() = 0;
+};
+
+// Discards every row, for timing renders without the cost of an image.
+class NullSink : public ImageSink {
+public:
+	bool Begin(int, int) override { return true; }
+	bool WriteRow(int, const PixelColor*) override { return true; }
+	bool End() override { return true; }
+};
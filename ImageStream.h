@@ -0,0 +1,337 @@
+#pragma once
+
+#include "ImageSink.h"
+#include "MemoryStats.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+enum class StreamFormat {
+	RawRGB,	// headerless 8-bit RGB, e.g. for `ffmpeg -f rawvideo -pix_fmt rgb24`
+	PPM,	// binary P6 portable pixmap
+	PNG		// uncompressed RGB PNG, one IDAT chunk per row
+};
+
+// Writes rows to a file, FIFO or stdout as soon as they can be emitted in order.
+// Rows that finish out of order wait in a reorder buffer until the rows above them arrive,
+// so only the rows currently in flight are ever held in memory.
+class ImageStream : public ImageSink {
+public:
+	~ImageStream() {
+		if (file && file != stdout)
+			fclose(file);
+	}
+
+	// path "-" streams to stdout
+	// returns nullptr on failure
+	static std::unique_ptr<ImageStream> Open(const char* path, StreamFormat format);
+
+	// format named raw, ppm or png
+	// returns false for any other name
+	static bool ParseFormat(const char* name, StreamFormat& format) {
+		if (strcmp(name, "raw") == 0) format = StreamFormat::RawRGB;
+		else if (strcmp(name, "ppm") == 0) format = StreamFormat::PPM;
+		else if (strcmp(name, "png") == 0) format = StreamFormat::PNG;
+		else return false;
+		return true;
+	}
+
+	// picks a format from the file extension, defaulting to raw RGB
+	static StreamFormat FormatFromPath(const char* path) {
+		std::string p(path);
+		auto endsWith = [&p](const char* ext) {
+			size_t n = strlen(ext);
+			return p.size() >= n && p.compare(p.size() - n, n, ext) == 0;
+		};
+
+		if (endsWith(".png")) return StreamFormat::PNG;
+		if (endsWith(".ppm")) return StreamFormat::PPM;
+		return StreamFormat::RawRGB;
+	}
+
+	bool Begin(int _width, int _height) override {
+		width = _width;
+		height = _height;
+		nextRow = 0;
+		peakPendingRows = 0;
+		rowBytes.resize(width * 3);
+
+		if (!WriteHeader())
+			return false;
+		return Flush();
+	}
+
+	bool WriteRow(int y, const PixelColor* row) override {
+		std::lock_guard<std::mutex> lk(streamMutex);
+
+		if (y != nextRow) {
+			// hold on to row until every row above it has been written
+			pending.emplace(y, std::vector<PixelColor>(row, row + width));
+			peakPendingRows = std::max(peakPendingRows, pending.size());
+			pendingBytes.Set(pending.size() * width * sizeof(PixelColor));
+			return true;
+		}
+
+		if (!EmitRow(row))
+			return false;
+
+		// drain any queued rows that are now in order
+		auto next = pending.begin();
+		while (next != pending.end() && next->first == nextRow) {
+			if (!EmitRow(next->second.data()))
+				return false;
+			next = pending.erase(next);
+		}
+		pendingBytes.Set(pending.size() * width * sizeof(PixelColor));
+
+		return Flush();
+	}
+
+	bool End() override {
+		std::lock_guard<std::mutex> lk(streamMutex);
+
+		if (nextRow != height)
+			return false; // rows missing
+
+		if (!WriteTrailer())
+			return false;
+		return Flush();
+	}
+
+	// largest number of rows held in the reorder buffer at once
+	size_t GetPeakPendingRows() const { return peakPendingRows; }
+
+protected:
+	FILE* file = nullptr;
+	int width = 0;
+	int height = 0;
+
+	ImageStream(FILE* _file) : file(_file) { }
+
+	virtual bool WriteHeader() = 0;
+	virtual bool WriteRowBytes(const uint8_t* rgb, size_t size) = 0;
+	virtual bool WriteTrailer() = 0;
+
+	bool Write(const void* data, size_t size) {
+		return fwrite(data, 1, size, file) == size;
+	}
+
+private:
+	std::mutex streamMutex;
+	int nextRow = 0;
+	size_t peakPendingRows = 0;
+	std::map<int, std::vector<PixelColor>> pending;
+	std::vector<uint8_t> rowBytes;
+	MemoryCounter pendingBytes{ MemorySubsystem::Output };
+
+	bool EmitRow(const PixelColor* row) {
+		// drop alpha channel
+		for (int x = 0; x < width; x++) {
+			rowBytes[x * 3 + 0] = row[x].rgba[0];
+			rowBytes[x * 3 + 1] = row[x].rgba[1];
+			rowBytes[x * 3 + 2] = row[x].rgba[2];
+		}
+
+		nextRow++;
+		return WriteRowBytes(rowBytes.data(), rowBytes.size());
+	}
+
+	bool Flush() {
+		// push data down the pipe now rather than when the stdio buffer fills
+		return fflush(file) == 0;
+	}
+};
+
+class RawImageStream : public ImageStream {
+public:
+	RawImageStream(FILE* _file) : ImageStream(_file) { }
+
+protected:
+	bool WriteHeader() override { return true; }
+	bool WriteRowBytes(const uint8_t* rgb, size_t size) override { return Write(rgb, size); }
+	bool WriteTrailer() override { return true; }
+};
+
+class PPMImageStream : public ImageStream {
+public:
+	PPMImageStream(FILE* _file) : ImageStream(_file) { }
+
+protected:
+	bool WriteHeader() override {
+		std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+		return Write(header.data(), header.size());
+	}
+
+	bool WriteRowBytes(const uint8_t* rgb, size_t size) override { return Write(rgb, size); }
+	bool WriteTrailer() override { return true; }
+};
+
+// PNG is written without compression using zlib "stored" blocks,
+// which lets every row go out as its own IDAT chunk the moment it is ready.
+class PNGImageStream : public ImageStream {
+public:
+	PNGImageStream(FILE* _file) : ImageStream(_file) { }
+
+protected:
+	bool WriteHeader() override {
+		static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		if (!Write(signature, sizeof(signature)))
+			return false;
+
+		uint8_t ihdr[13];
+		PutBigEndian(ihdr + 0, width);
+		PutBigEndian(ihdr + 4, height);
+		ihdr[8] = 8;	// bit depth
+		ihdr[9] = 2;	// colour type RGB
+		ihdr[10] = 0;	// deflate
+		ihdr[11] = 0;	// adaptive filtering
+		ihdr[12] = 0;	// no interlace
+
+		adler32 = 1;
+		zlibHeaderWritten = false;
+		return WriteChunk("IHDR", ihdr, sizeof(ihdr));
+	}
+
+	bool WriteRowBytes(const uint8_t* rgb, size_t size) override {
+		chunk.clear();
+
+		if (!zlibHeaderWritten) {
+			// deflate, 32K window, no compression
+			chunk.push_back(0x78);
+			chunk.push_back(0x01);
+			zlibHeaderWritten = true;
+		}
+
+		// every scanline starts with its filter type
+		uint8_t filter = 0;
+		UpdateAdler(&filter, 1);
+		UpdateAdler(rgb, size);
+
+		// a stored block holds at most 65535 bytes so wide rows are split
+		size_t remaining = size + 1;
+		size_t offset = 0;
+		while (remaining > 0) {
+			uint16_t blockSize = static_cast<uint16_t>(std::min<size_t>(remaining, 0xFFFF));
+			chunk.push_back(0x00); // BFINAL = 0, BTYPE = stored
+			chunk.push_back(blockSize & 0xFF);
+			chunk.push_back(blockSize >> 8);
+			chunk.push_back(~blockSize & 0xFF);
+			chunk.push_back((~blockSize >> 8) & 0xFF);
+
+			for (uint16_t i = 0; i < blockSize; i++, offset++)
+				chunk.push_back(offset == 0 ? filter : rgb[offset - 1]);
+
+			remaining -= blockSize;
+		}
+
+		return WriteChunk("IDAT", chunk.data(), chunk.size());
+	}
+
+	bool WriteTrailer() override {
+		// empty final stored block followed by the zlib checksum
+		uint8_t tail[9] = { 0x01, 0x00, 0x00, 0xFF, 0xFF };
+		PutBigEndian(tail + 5, adler32);
+
+		if (!WriteChunk("IDAT", tail, sizeof(tail)))
+			return false;
+		return WriteChunk("IEND", nullptr, 0);
+	}
+
+private:
+	uint32_t adler32 = 1;
+	bool zlibHeaderWritten = false;
+	std::vector<uint8_t> chunk;
+
+	static void PutBigEndian(uint8_t* out, uint32_t value) {
+		out[0] = (value >> 24) & 0xFF;
+		out[1] = (value >> 16) & 0xFF;
+		out[2] = (value >> 8) & 0xFF;
+		out[3] = value & 0xFF;
+	}
+
+	void UpdateAdler(const uint8_t* data, size_t size) {
+		uint32_t a = adler32 & 0xFFFF;
+		uint32_t b = adler32 >> 16;
+
+		// 5552 is the longest run that cannot overflow b before taking the modulo
+		while (size > 0) {
+			size_t run = std::min<size_t>(size, 5552);
+			for (size_t i = 0; i < run; i++) {
+				a += data[i];
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+			data += run;
+			size -= run;
+		}
+		adler32 = (b << 16) | a;
+	}
+
+	static uint32_t UpdateCRC(uint32_t crc, const uint8_t* data, size_t size) {
+		static uint32_t table[256];
+		static bool tableReady = [] {
+			for (uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++)
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				table[n] = c;
+			}
+			return true;
+		}();
+		(void)tableReady;
+
+		for (size_t i = 0; i < size; i++)
+			crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		return crc;
+	}
+
+	bool WriteChunk(const char type[4], const uint8_t* data, size_t size) {
+		uint8_t length[4];
+		PutBigEndian(length, static_cast<uint32_t>(size));
+
+		uint32_t crc = UpdateCRC(0xFFFFFFFFu, reinterpret_cast<const uint8_t*>(type), 4);
+		crc = UpdateCRC(crc, data, size);
+		uint8_t crcBytes[4];
+		PutBigEndian(crcBytes, crc ^ 0xFFFFFFFFu);
+
+		return Write(length, 4)
+			&& Write(type, 4)
+			&& (size == 0 || Write(data, size))
+			&& Write(crcBytes, 4);
+	}
+};
+
+inline std::unique_ptr<ImageStream> ImageStream::Open(const char* path, StreamFormat format) {
+	FILE* file;
+	if (strcmp(path, "-") == 0) {
+#ifdef _WIN32
+		// stop the CRT translating '\n' bytes in the image data
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		file = stdout;
+	}
+	else {
+		// opening a FIFO blocks here until a reader connects
+		file = fopen(path, "wb");
+		if (!file)
+			return nullptr;
+	}
+
+	switch (format) {
+		case StreamFormat::PPM: return std::unique_ptr<ImageStream>(new PPMImageStream(file));
+		case StreamFormat::PNG: return std::unique_ptr<ImageStream>(new PNGImageStream(file));
+		default:                return std::unique_ptr<ImageStream>(new RawImageStream(file));
+	}
+}
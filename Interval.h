@@ -2,28 +2,31 @@
 
 #include "Vec3.h"
 
-class Interval {
+#include <limits>
+
+template <typename T>
+class IntervalT {
 public:
-	double min, max;
+	T min, max;
 
-	Interval() : min(+infinity), max(-infinity) {} // Default interval is empty
-    Interval(double _min, double _max) : min(_min), max(_max) {}
+	IntervalT() : min(+std::numeric_limits<T>::infinity()), max(-std::numeric_limits<T>::infinity()) {} // Default interval is empty
+    IntervalT(T _min, T _max) : min(_min), max(_max) {}
 
-    bool contains(double x) const {
+    bool contains(T x) const {
         return min <= x && x <= max;
     }
 
-    bool surrounds(double x) const {
+    bool surrounds(T x) const {
         return min < x && x < max;
     }
 
-    double clamp(double x) const {
+    T clamp(T x) const {
         if (x <= min) return min;
         if (x >= max) return max;
         else          return x;
     }
 
-    Vec3 clamp(const Vec3& x) const {
+    Vec3T<T> clamp(const Vec3T<T>& x) const {
         return {
             clamp(x.e[0]),
             clamp(x.e[1]),
@@ -31,8 +34,11 @@ public:
         };
     }
 
-    static const Interval empty, universe;
+    static const IntervalT empty, universe;
 };
 
+using Interval = IntervalT<double>;
+using Intervalf = IntervalT<float>;
+
 const static Interval empty(+infinity, -infinity);
 const static Interval universe(-infinity, +infinity);
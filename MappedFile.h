@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Thin wrapper around an OS file mapping.
+// Views can cover any granularity-aligned part of the file, so very large files can be paged in piece by piece.
+class MappedFile {
+public:
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile() { Close(); }
+
+	// creates (or truncates) a read-write file of the given size
+	// returns function's success
+	bool Create(const char* path, uint64_t size) {
+		Close();
+		writable = true;
+		fileSize = size;
+
+#ifdef _WIN32
+		file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+		return mapping != nullptr;
+#else
+		fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			return false;
+		// extending with ftruncate leaves the file sparse until tiles are touched
+		return ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+	}
+
+	// opens an existing file
+	// returns function's success
+	bool Open(const char* path, bool _writable = false) {
+		Close();
+		writable = _writable;
+
+#ifdef _WIN32
+		DWORD access = writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+		file = CreateFileA(path, access, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size))
+			return false;
+		fileSize = static_cast<uint64_t>(size.QuadPart);
+		if (fileSize == 0)
+			return true; // empty files cannot be mapped
+
+		mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+		return mapping != nullptr;
+#else
+		fd = open(path, writable ? O_RDWR : O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0)
+			return false;
+		fileSize = static_cast<uint64_t>(info.st_size);
+		return true;
+#endif
+	}
+
+	void Close() {
+#ifdef _WIN32
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+#endif
+		fileSize = 0;
+	}
+
+	uint64_t GetSize() const { return fileSize; }
+
+	// maps `size` bytes starting at `offset`, which must be a multiple of GetGranularity()
+	// returns nullptr on failure
+	uint8_t* Map(uint64_t offset, size_t size) const {
+		if (size == 0)
+			return nullptr;
+
+#ifdef _WIN32
+		DWORD access = writable ? FILE_MAP_WRITE : FILE_MAP_READ;
+		void* view = MapViewOfFile(mapping, access, static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), size);
+		return static_cast<uint8_t*>(view);
+#else
+		int protection = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+		void* view = mmap(nullptr, size, protection, MAP_SHARED, fd, static_cast<off_t>(offset));
+		return view == MAP_FAILED ? nullptr : static_cast<uint8_t*>(view);
+#endif
+	}
+
+	static void Unmap(uint8_t* view, size_t size) {
+		if (!view)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(view);
+#else
+		munmap(view, size);
+#endif
+	}
+
+	// alignment required for view offsets
+	static size_t GetGranularity() {
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return info.dwAllocationGranularity;
+#else
+		return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+	}
+
+private:
+	bool writable = false;
+	uint64_t fileSize = 0;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
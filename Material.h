@@ -1,31 +1,31 @@
 #pragma once
 
 #include "RTWeekend.h"
+#include "Hittable.h"
+#include "MemoryStats.h"
+#include "RenderStats.h"
 
-class HitPoint;
+#include <algorithm>
+#include <variant>
+#include <vector>
 
-class Material {
-public:
-
-	virtual ~Material() = default;
-
-	virtual bool scatter(const Ray& inRay, const HitPoint& rec, Color& attenuation, Ray& outRay) const = 0;
-};
-
-class Lambertian : public Material {
+class Lambertian {
 public:
 
 	Lambertian(const Color& a) : albedo(a) { }
 
-	bool scatter(const Ray& inRay, const HitPoint& rec, Color& attenuation, Ray& outRay) const override {
-		Vec3 scatterDirection = rec.normal + RandomPointOnUnitSphere();
+	template <typename T>
+	bool scatter(const RayT<T>& inRay, const HitPointT<T>& rec, Vec3T<T>& attenuation, RayT<T>& outRay) const {
+		Vec3T<T> scatterDirection = rec.normal + RandomPointOnUnitSphere<T>();
 
 		// Catch degenerate scatter direction
 		if (scatterDirection.isNearZeroLength())
 			scatterDirection = rec.normal;
 
-		outRay = Ray(rec.position, scatterDirection);
-		attenuation = albedo;
+		outRay = RayT<T>(rec.position, scatterDirection);
+		attenuation = Vec3T<T>(albedo);
+		RENDER_STAT(scatters[0]++);
+		RENDER_STAT(rays[RenderStats::DiffuseRay]++);
 		return true;
 	}
 
@@ -33,17 +33,21 @@ private:
 	Color albedo;
 };
 
-class Metal : public Material {
+class Metal {
 public:
 	Metal(const Color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
-	bool scatter(const Ray& inRay, const HitPoint& rec, Color& attenuation, Ray& outRay) const override {
-		Vec3 reflected = reflect(inRay.direction.normalized(), rec.normal);
-		outRay = Ray(rec.position, reflected + fuzz * RandomPointOnUnitSphere());
-		attenuation = albedo;
+	template <typename T>
+	bool scatter(const RayT<T>& inRay, const HitPointT<T>& rec, Vec3T<T>& attenuation, RayT<T>& outRay) const {
+		Vec3T<T> reflected = reflect(inRay.direction.normalized(), rec.normal);
+		outRay = RayT<T>(rec.position, reflected + static_cast<T>(fuzz) * RandomPointOnUnitSphere<T>());
+		attenuation = Vec3T<T>(albedo);
 
 		// check if outgoing ray gets absorbed by surface
-		return (dot(outRay.direction, rec.normal) > 0);
+		bool reflects = dot(outRay.direction, rec.normal) > 0;
+		RENDER_STAT(scatters[1]++);
+		RENDER_STAT(rays[RenderStats::ReflectedRay] += reflects);
+		return reflects;
 	}
 
 private:
@@ -51,37 +55,43 @@ private:
 	double fuzz;
 };
 
-class Dielectric : public Material {
+class Dielectric {
 public:
 	Dielectric(double _IOR) : IOR(_IOR), abspCoeff(0,0,0) {}
 	Dielectric(double _IOR, const Color& absorption) : IOR(_IOR), abspCoeff(absorption) {}
 
-	bool scatter(const Ray& inRay, const HitPoint& rec, Color& attenuation, Ray& outRay) const override {
+	template <typename T>
+	bool scatter(const RayT<T>& inRay, const HitPointT<T>& rec, Vec3T<T>& attenuation, RayT<T>& outRay) const {
 		if (rec.isFrontFace) {
 			// no absorption
-			attenuation = Color(1, 1, 1);
+			attenuation = Vec3T<T>(1, 1, 1);
 		}
 		else {
 			// Beer-Lambert absorption occurs over ray's length
-			double rayLength = (inRay.origin - rec.position).length();
-			attenuation = absorption(rayLength);
+			T rayLength = (inRay.origin - rec.position).length();
+			attenuation = Vec3T<T>(absorption(rayLength));
 		}
 		
-		double refractionRatio = rec.isFrontFace ? (1.0 / IOR) : IOR;
+		T refractionRatio = static_cast<T>(rec.isFrontFace ? (1.0 / IOR) : IOR);
 
-		Vec3 unitRayDir = inRay.direction.normalized();
-		double cosTheta = fmin(dot(-unitRayDir, rec.normal), 1.0);
-		double sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+		Vec3T<T> unitRayDir = inRay.direction.normalized();
+		T cosTheta = std::min(dot(-unitRayDir, rec.normal), static_cast<T>(1));
+		T sinTheta = sqrt(1 - cosTheta * cosTheta);
 
-		bool cannot_refract = refractionRatio * sinTheta > 1.0;
-		Vec3 outDirection;
+		bool cannot_refract = refractionRatio * sinTheta > 1;
+		Vec3T<T> outDirection;
 
-		if (cannot_refract || reflectance(cosTheta, refractionRatio) > Random01())
+		if (cannot_refract || reflectance(cosTheta, refractionRatio) > Random01()) {
 			outDirection = reflect(unitRayDir, rec.normal);
-		else 
+			RENDER_STAT(rays[RenderStats::ReflectedRay]++);
+		}
+		else {
 			outDirection = refract(unitRayDir, rec.normal, refractionRatio);
+			RENDER_STAT(rays[RenderStats::RefractedRay]++);
+		}
+		RENDER_STAT(scatters[2]++);
 
-		outRay = Ray(rec.position, outDirection);
+		outRay = RayT<T>(rec.position, outDirection);
 		return true;
 	}
 
@@ -97,10 +107,70 @@ private:
 		return  Color(R, G, B);
 	}
 
-	static double reflectance(double cosine, double ref_idx) {
+	template <typename T>
+	static T reflectance(T cosine, T ref_idx) {
 		// Use Schlick's approximation for reflectance.
-		auto r0 = (1 - ref_idx) / (1 + ref_idx);
+		T r0 = (1 - ref_idx) / (1 + ref_idx);
 		r0 = r0 * r0;
-		return r0 + (1 - r0) * pow((1 - cosine), 5);
+		T x = 1 - cosine;
+		return r0 + (1 - r0) * (x * x) * (x * x) * x;
+	}
+};
+
+// Any one of the material kinds, stored by value.
+// scatter() dispatches with a switch on the kind instead of a virtual call.
+class Material {
+public:
+	// in the order of the variant's alternatives
+	enum class Kind : uint8_t { Lambertian, Metal, Dielectric, Count };
+	static_assert(static_cast<int>(Kind::Count) == RenderStats::materialKinds, "render statistics count scatters per kind");
+
+	Material(const Lambertian& m) : data(m) { }
+	Material(const Metal& m) : data(m) { }
+	Material(const Dielectric& m) : data(m) { }
+
+	Kind GetKind() const { return static_cast<Kind>(data.index()); }
+
+	// direct access when the kind is already known
+	template <typename M>
+	const M& Get() const { return *std::get_if<M>(&data); }
+
+	template <typename T>
+	bool scatter(const RayT<T>& inRay, const HitPointT<T>& rec, Vec3T<T>& attenuation, RayT<T>& outRay) const {
+		switch (data.index()) {
+			case 0:  return std::get_if<Lambertian>(&data)->scatter(inRay, rec, attenuation, outRay);
+			case 1:  return std::get_if<Metal>(&data)->scatter(inRay, rec, attenuation, outRay);
+			default: return std::get_if<Dielectric>(&data)->scatter(inRay, rec, attenuation, outRay);
+		}
 	}
-};
\ No newline at end of file
+
+private:
+	std::variant<Lambertian, Metal, Dielectric> data;
+};
+
+// Every material in a scene, addressed by a 32-bit ID stored in each primitive.
+class MaterialTable {
+public:
+	uint32_t add(const Material& material) {
+		materials.push_back(material);
+		bytes.Set(materials.capacity() * sizeof(Material));
+		return static_cast<uint32_t>(materials.size() - 1);
+	}
+
+	void reserve(size_t count) {
+		materials.reserve(count);
+		bytes.Set(materials.capacity() * sizeof(Material));
+	}
+
+	void clear() {
+		materials.clear();
+	}
+
+	size_t size() const { return materials.size(); }
+
+	const Material& operator[](uint32_t id) const { return materials[id]; }
+
+private:
+	std::vector<Material> materials;
+	MemoryCounter bytes{ MemorySubsystem::Materials };
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <iostream>
+
+enum class MemorySubsystem {
+	Primitives,		// hittable objects
+	Materials,		// material objects
+	SceneFile,		// scene description records, owned or mapped
+	Framebuffer,	// mapped accumulation tiles
+	Output,			// output images and stream buffers
+	PathQueues,		// wavefront path states
+	Diagnostics,	// per pixel cost and dependency maps
+	Count
+};
+
+// Process wide byte counts per subsystem, with the high water mark of each.
+class MemoryStats {
+public:
+	static const char* GetName(MemorySubsystem subsystem) {
+		static const char* names[] = { "primitives", "materials", "scene file", "framebuffer", "output", "path queues", "diagnostics" };
+		return names[static_cast<int>(subsystem)];
+	}
+
+	static void Add(MemorySubsystem subsystem, ptrdiff_t bytes) {
+		Entry& entry = GetEntry(subsystem);
+		size_t now = entry.current.fetch_add(bytes) + bytes;
+
+		size_t peak = entry.peak.load();
+		while (now > peak && !entry.peak.compare_exchange_weak(peak, now)) {}
+	}
+
+	static size_t GetCurrent(MemorySubsystem subsystem) { return GetEntry(subsystem).current; }
+	static size_t GetPeak(MemorySubsystem subsystem) { return GetEntry(subsystem).peak; }
+
+	static void Print(std::ostream& out) {
+		out << "Memory (current / peak):\n";
+		for (int i = 0; i < static_cast<int>(MemorySubsystem::Count); i++) {
+			MemorySubsystem subsystem = static_cast<MemorySubsystem>(i);
+			char line[128];
+			snprintf(line, sizeof(line), "  %-12s %10.1f KiB / %10.1f KiB\n", GetName(subsystem), GetCurrent(subsystem) / 1024.0, GetPeak(subsystem) / 1024.0);
+			out << line;
+		}
+	}
+
+private:
+	struct Entry {
+		std::atomic<size_t> current{ 0 };
+		std::atomic<size_t> peak{ 0 };
+	};
+
+	static Entry& GetEntry(MemorySubsystem subsystem) {
+		static Entry entries[static_cast<int>(MemorySubsystem::Count)];
+		return entries[static_cast<int>(subsystem)];
+	}
+};
+
+// Attributes a number of bytes to a subsystem for the lifetime of its owner.
+class MemoryCounter {
+public:
+	MemoryCounter(MemorySubsystem _subsystem) : subsystem(_subsystem) {}
+	MemoryCounter(const MemoryCounter&) = delete;
+	MemoryCounter& operator=(const MemoryCounter&) = delete;
+	~MemoryCounter() { Set(0); }
+
+	void Set(size_t _bytes) {
+		MemoryStats::Add(subsystem, static_cast<ptrdiff_t>(_bytes) - static_cast<ptrdiff_t>(bytes));
+		bytes = _bytes;
+	}
+
+	size_t Get() const { return bytes; }
+
+private:
+	MemorySubsystem subsystem;
+	size_t bytes = 0;
+};
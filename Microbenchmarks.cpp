@@ -0,0 +1,256 @@
+// Times the renderer's hot kernels one at a time.
+// Usage: microbench [--filter <text>] [--json <path|->] [--runs <n>] [--min-time <ms>] [--isa scalar|sse4|avx2|avx512]
+
+#include "RTWeekend.h"
+
+#include "Benchmark.h"
+#include "FlatScene.h"
+#include "HittableList.h"
+#include "Material.h"
+#include "PixelColor.h"
+#include "Resolve.h"
+#include "Simd.h"
+#include "Sphere.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// inputs are cycled through so every call sees different data, the count is a power of two
+static const int inputCount = 1024;
+
+std::vector<Vec3> RandomVectors(double min, double max) {
+	std::vector<Vec3> vectors(inputCount);
+	for (Vec3& v : vectors)
+		v = Vec3::random(min, max);
+	return vectors;
+}
+
+// rays from a box around the origin aimed near it, so some hit a unit sphere there and some miss
+std::vector<Ray> RandomRays() {
+	std::vector<Ray> rays(inputCount);
+	for (Ray& r : rays) {
+		Point3 origin = RandomPointOnUnitSphere<double>() * 5;
+		Point3 target = Vec3::random(-1.5, 1.5);
+		r = Ray(origin, target - origin);
+	}
+	return rays;
+}
+
+void AddRandomSpheres(HittableList& world, int count, double extent) {
+	for (int i = 0; i < count; i++)
+		world.add(make_shared<Sphere>(Vec3::random(-extent, extent), RandomRange(0.1, 0.5), 0));
+}
+
+void RunBenchmarks(BenchmarkSuite& suite) {
+	const std::vector<Vec3> a = RandomVectors(-1, 1);
+	const std::vector<Vec3> b = RandomVectors(-1, 1);
+	const std::vector<Ray> rays = RandomRays();
+	const Interval limits(0.001, infinity);
+
+	suite.Run("random01", [](uint64_t n) {
+		double sum = 0;
+		for (uint64_t i = 0; i < n; i++)
+			sum += Random01();
+		KeepValue(sum);
+	});
+
+	suite.Run("vec3_add", [&](uint64_t n) {
+		for (uint64_t i = 0; i < n; i++) {
+			Vec3 v = a[i & (inputCount - 1)] + b[i & (inputCount - 1)];
+			KeepValue(v);
+		}
+	});
+
+	suite.Run("vec3_dot", [&](uint64_t n) {
+		for (uint64_t i = 0; i < n; i++) {
+			double d = dot(a[i & (inputCount - 1)], b[i & (inputCount - 1)]);
+			KeepValue(d);
+		}
+	});
+
+	suite.Run("vec3_cross", [&](uint64_t n) {
+		for (uint64_t i = 0; i < n; i++) {
+			Vec3 v = cross(a[i & (inputCount - 1)], b[i & (inputCount - 1)]);
+			KeepValue(v);
+		}
+	});
+
+	suite.Run("vec3_normalized", [&](uint64_t n) {
+		for (uint64_t i = 0; i < n; i++) {
+			Vec3 v = a[i & (inputCount - 1)].normalized();
+			KeepValue(v);
+		}
+	});
+
+	suite.Run("vec3_random_on_unit_sphere", [](uint64_t n) {
+		for (uint64_t i = 0; i < n; i++) {
+			Vec3 v = RandomPointOnUnitSphere<double>();
+			KeepValue(v);
+		}
+	});
+
+	Sphere sphere(Point3(0, 0, 0), 1, 0);
+
+	suite.Run("sphere_hit", [&](uint64_t n) {
+		HitPoint record;
+		for (uint64_t i = 0; i < n; i++) {
+			bool hit = sphere.Hit(rays[i & (inputCount - 1)], limits, record);
+			KeepValue(hit);
+		}
+	});
+
+	suite.Run("sphere_intersect", [&](uint64_t n) {
+		RayHit hit;
+		for (uint64_t i = 0; i < n; i++) {
+			bool found = sphere.Intersect(rays[i & (inputCount - 1)], limits, hit);
+			KeepValue(found);
+		}
+	});
+
+	for (int count : { 16, 486 }) {
+		HittableList world;
+		AddRandomSpheres(world, count, 2);
+
+		suite.Run(("hittable_list_hit_" + std::to_string(count)).c_str(), [&](uint64_t n) {
+			HitPoint record;
+			for (uint64_t i = 0; i < n; i++) {
+				bool hit = world.Hit(rays[i & (inputCount - 1)], limits, record);
+				KeepValue(hit);
+			}
+		});
+
+		// SIMD lanes below the hierarchy threshold, the sphere BVH above it
+		FlatScene<Sphere> flat;
+		flat.Gather(world);
+		suite.Run(("flat_scene_intersect_" + std::to_string(count)).c_str(), [&](uint64_t n) {
+			RayHit hit;
+			for (uint64_t i = 0; i < n; i++) {
+				bool found = flat.Intersect(rays[i & (inputCount - 1)], limits, hit);
+				KeepValue(found);
+			}
+		});
+	}
+
+	// a hit on the unit sphere seen by rays arriving from random directions
+	HitPoint record;
+	record.position = Point3(0, 1, 0);
+	record.normal = Vec3(0, 1, 0);
+	record.materialId = 0;
+	record.t = 1;
+	record.isFrontFace = true;
+	std::vector<Ray> incoming(inputCount);
+	for (Ray& r : incoming) {
+		Vec3 direction = RandomPointOnUnitHemisphere(Vec3(0, 1, 0));
+		r = Ray(record.position + direction, -direction);
+	}
+
+	auto scatter = [&](const Material& material) {
+		return [&, material](uint64_t n) {
+			for (uint64_t i = 0; i < n; i++) {
+				Vec3 attenuation;
+				Ray scattered;
+				bool kept = material.scatter(incoming[i & (inputCount - 1)], record, attenuation, scattered);
+				KeepValue(kept);
+				KeepValue(scattered);
+			}
+		};
+	};
+	suite.Run("scatter_lambertian", scatter(Lambertian(Color(0.5, 0.5, 0.5))));
+	suite.Run("scatter_metal", scatter(Metal(Color(0.7, 0.6, 0.5), 0.2)));
+	suite.Run("scatter_dielectric", scatter(Dielectric(1.5, Color(0.1, 0.2, 0.3))));
+
+	const std::vector<Vec3> colors = RandomVectors(0, 1);
+
+	suite.Run("pixel_color_from_color", [&](uint64_t n) {
+		for (uint64_t i = 0; i < n; i++) {
+			PixelColor pixel(colors[i & (inputCount - 1)]);
+			KeepValue(pixel);
+		}
+	});
+
+	// one operation is one pixel of a row resolved with ACES and the sRGB curve
+	ResolveSettings settings;
+	settings.tonemapper = Tonemapper::ACES;
+	Resolver resolver(settings);
+	std::vector<PixelColor> row(inputCount);
+	suite.Run("resolve_pixel", [&](uint64_t n) {
+		for (uint64_t i = 0; i < n; i += inputCount) {
+			int count = static_cast<int>(std::min<uint64_t>(inputCount, n - i));
+			resolver.ResolveRow(colors.data(), count, static_cast<int>(i / inputCount), row.data());
+			KeepValue(row[0]);
+		}
+	});
+}
+
+int main(int argc, char* argv[]) {
+	BenchmarkSuite suite;
+	const char* jsonPath = nullptr;		// "-" writes JSON to stdout instead of the table
+	const char* isa = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			suite.filter = argv[++i];
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+			jsonPath = argv[++i];
+		else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+			suite.runs = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+			suite.minRunSeconds = atof(argv[++i]) / 1000;
+		else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc)
+			isa = argv[++i];
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--filter <text>] [--json <path|->] [--runs <n>] [--min-time <ms>] [--isa scalar|sse4|avx2|avx512]\n";
+			return 1;
+		}
+	}
+
+	SimdLevel simdLevel = DetectSimdLevel();
+	if (isa) {
+		SimdLevel limit;
+		if (!ParseSimdLevel(isa, limit)) {
+			std::cerr << "Unknown instruction set " << isa << "\n";
+			return 1;
+		}
+		simdLevel = SetSimdLevel(limit);
+	}
+
+	// same inputs on every run
+	SeedRandom(1);
+
+	bool jsonToStdout = jsonPath && strcmp(jsonPath, "-") == 0;
+	suite.SetLog(jsonToStdout ? &std::clog : &std::cout);
+	RunBenchmarks(suite);
+
+	if (jsonPath) {
+		std::vector<std::pair<std::string, std::string>> context = {
+			{ "simd", GetSimdName(simdLevel) },
+#ifdef NDEBUG
+			{ "build", "release" },
+#else
+			{ "build", "debug" },
+#endif
+#if defined(__VERSION__)
+			{ "compiler", __VERSION__ },
+#elif defined(_MSC_VER)
+			{ "compiler", "msvc " + std::to_string(_MSC_VER) },
+#endif
+		};
+
+		if (jsonToStdout) {
+			suite.WriteJson(std::cout, context);
+		}
+		else {
+			std::ofstream file(jsonPath);
+			suite.WriteJson(file, context);
+			if (!file) {
+				std::cerr << "Could not write " << jsonPath << "\n";
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
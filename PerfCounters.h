@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware cache counters of the thread that calls Start, read with perf_event_open on Linux.
+// A render's workers each count their own share, including pool threads started long before the render,
+// and Add their counts to the render's totals as they leave it.
+// Elsewhere, or when the kernel refuses access, IsAvailable returns false and the counts stay 0.
+class PerfCounters {
+public:
+	enum Event { CacheReferences, CacheMisses, Instructions, EventCount };
+
+	PerfCounters() {}
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+	~PerfCounters() { Close(); }
+
+	// opens and zeroes the counters of the calling thread
+	// returns function's success
+	bool Start() {
+		Close();
+		Reset();
+#ifdef __linux__
+		static const uint64_t configs[] = { PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_INSTRUCTIONS };
+		for (int i = 0; i < EventCount; i++) {
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.size = sizeof(attr);
+			attr.config = configs[i];
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+			if (fds[i] < 0) {
+				Close();
+				return false;
+			}
+		}
+		available = true;
+#endif
+		return available;
+	}
+
+	// stops counting and keeps the counts, to be called on the thread that started them
+	void Stop() {
+#ifdef __linux__
+		for (int i = 0; i < EventCount && available; i++) {
+			uint64_t value = 0;
+			if (read(fds[i], &value, sizeof(value)) == sizeof(value))
+				counts[i] = value;
+		}
+#endif
+		valid = available;
+		Close();
+	}
+
+	// zeroes the counts, e.g. of totals before the workers Add to them
+	void Reset() {
+		for (std::atomic<uint64_t>& count : counts)
+			count = 0;
+		valid = false;
+	}
+
+	// adds the counts of a stopped set, safe to call from several threads at once
+	void Add(const PerfCounters& other) {
+		if (!other.valid)
+			return;
+		for (int i = 0; i < EventCount; i++)
+			counts[i] += other.counts[i];
+		valid = true;
+	}
+
+	bool IsAvailable() const { return valid; }
+
+	uint64_t Get(Event event) const { return counts[event]; }
+
+private:
+	int fds[EventCount] = { -1, -1, -1 };
+	std::atomic<uint64_t> counts[EventCount] = {};
+	bool available = false;			// counters are open
+	std::atomic<bool> valid{ false };	// counts hold a Start..Stop, or the sum of some
+
+	void Close() {
+#ifdef __linux__
+		for (int i = 0; i < EventCount; i++) {
+			if (fds[i] >= 0)
+				close(fds[i]);
+			fds[i] = -1;
+		}
+#endif
+		available = false;
+	}
+};
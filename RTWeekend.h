@@ -1,7 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <limits>
 #include <memory>
 
@@ -28,9 +31,55 @@ inline double Rad2Deg(double radians) {
     return radians * 180.0 / pi;
 }
 
+// Per-thread generator state. Zero means not yet seeded.
+inline uint64_t& RandomState() {
+    thread_local uint64_t state = 0;
+    return state;
+}
+
+inline void SeedRandom(uint64_t seed) {
+    // avoid the unseeded marker
+    RandomState() = seed ? seed : 0x9E3779B97F4A7C15ull;
+}
+
+// splitmix64 output function, scrambles a 64-bit value
+inline uint64_t MixBits(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// 64-bit hash of a block of bytes, built from MixBits a word at a time
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = MixBits(seed + 0x9E3779B97F4A7C15ull);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash = MixBits(hash ^ word);
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes + i, size - i);
+    return MixBits(hash ^ tail ^ (static_cast<uint64_t>(size - i) << 56));
+}
+
+inline uint64_t RandomBits() {
+    // Returns 64 random bits from a splitmix64 generator.
+    // Each thread has its own state so the render threads never touch shared memory here.
+    uint64_t& state = RandomState();
+    if (state == 0) {
+        // first use on this thread, give every thread its own sequence
+        static std::atomic<uint64_t> nextSeed(1);
+        SeedRandom(nextSeed.fetch_add(1) * 0xD1B54A32D192ED03ull);
+    }
+
+    return MixBits(state += 0x9E3779B97F4A7C15ull);
+}
+
 inline double Random01() {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    return (RandomBits() >> 11) * (1.0 / 9007199254740992.0);
 }
 
 inline double RandomRange(double min, double max) {
@@ -41,5 +90,5 @@ inline double RandomRange(double min, double max) {
 // Common Headers
 
 #include "Interval.h"
-#include "ray.h"
-#include "vec3.h"
\ No newline at end of file
+#include "Ray.h"
+#include "Vec3.h"
\ No newline at end of file
@@ -2,16 +2,59 @@
 
 #include "Vec3.h"
 
-class Ray {
+#include <algorithm>
+#include <cmath>
+
+template <typename T>
+class RayT {
 public:
-	Point3 origin;
-	Vec3 direction;
+	using Scalar = T;
+
+	Vec3T<T> origin;
+	Vec3T<T> direction;
+
+	RayT() {}
 
-	Ray() {}
+	RayT(const Vec3T<T>& origin, const Vec3T<T>& direction) : origin(origin), direction(direction) {}
 
-	Ray(const Point3& origin, const Vec3& direction) : origin(origin), direction(direction) {}
+	// converts between precisions
+	template <typename U>
+	explicit RayT(const RayT<U>& r) : origin(r.origin), direction(r.direction) {}
 
-	Point3 at(double t) const {
+	Vec3T<T> at(T t) const {
 		return origin + t * direction;
 	}
-};
\ No newline at end of file
+};
+
+using Ray = RayT<double>;
+using Rayf = RayT<float>;
+
+// Self-intersection handling for secondary rays, per scalar type.
+// Double relies on the minimum hit distance alone, as the original renderer did.
+// Float cannot resolve a hit point on a large sphere well enough for that, so new rays are
+// also pushed off the surface by a distance relative to the magnitude of the hit point.
+template <typename T>
+struct RayEpsilon;
+
+template <>
+struct RayEpsilon<double> {
+	static constexpr double minDistance = 0.001;
+	static constexpr double originOffset = 0;
+};
+
+template <>
+struct RayEpsilon<float> {
+	static constexpr float minDistance = 0.001f;
+	static constexpr float originOffset = 1.0f / (1 << 16);	// ~500 float ulps at the hit point's magnitude
+};
+
+// moves a ray origin on a surface with normal n to the side that `direction` leaves from
+template <typename T>
+inline Vec3T<T> OffsetRayOrigin(const Vec3T<T>& position, const Vec3T<T>& n, const Vec3T<T>& direction) {
+	if (RayEpsilon<T>::originOffset == 0)
+		return position;
+
+	T magnitude = std::max({ std::abs(position.e[0]), std::abs(position.e[1]), std::abs(position.e[2]), static_cast<T>(1) });
+	T offset = magnitude * RayEpsilon<T>::originOffset;
+	return position + (dot(direction, n) > 0 ? offset : -offset) * n;
+}
\ No newline at end of file
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "Camera.h"
+#include "ImageSink.h"
+#include "Scene.h"
+#include "SceneArena.h"
+#include "Scenes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Fixed render settings, so results can be compared between builds.
+struct RenderBenchmarkSettings {
+	int width = 640;
+	int height = 360;
+	int samplesPerPixel = 4;
+	int maxRayBounces = 10;
+	int warmupRuns = 1;
+	int runs = 5;
+	std::string filter;		// only scenes whose name contains this
+};
+
+// Timings of one scene over the timed runs, rates in Mrays/s.
+struct RenderBenchmarkResult {
+	std::string name;
+	size_t spheres = 0;
+	uint64_t rays = 0;			// per run, the same for every run because the camera is seeded
+	int runs = 0;
+	double median = 0;
+	double min = 0;
+	double max = 0;
+	double deviation = 0;		// standard deviation
+	double secondsPerSpp = 0;	// median render time divided by samples per pixel
+
+	// max - min relative to the median, in percent
+	double GetSpread() const { return median > 0 ? 100 * (max - min) / median : 0; }
+};
+
+// Renders each canonical scene several times to a NullSink with a seeded camera and reports rays traced,
+// Mrays/s with its spread, and time per sample per pixel. Results can be saved as JSON and compared against
+// an earlier file to catch slowdowns.
+class RenderBenchmark {
+public:
+	RenderBenchmarkSettings settings;
+	std::function<void(Camera&)> configure;		// applies render loop options to every camera
+
+	// returns function's success
+	bool Run(std::ostream& out) {
+		results.clear();
+
+		char line[160];
+		snprintf(line, sizeof(line), "%-14s %9s %10s %10s %10s %10s %8s %10s\n", "scene", "spheres", "Mrays", "Mrays/s", "min", "max", "spread", "ms/spp");
+		out << line;
+
+		for (const CanonicalScene& canonical : GetCanonicalScenes()) {
+			if (!settings.filter.empty() && canonical.name.find(settings.filter) == std::string::npos)
+				continue;
+
+			std::clog << "Benchmark: building " << canonical.name << "\n";
+			SceneDescription scene;
+			CreateCanonicalScene(canonical, scene);
+
+			auto arena = make_shared<SceneArena>();
+			HittableList world;
+			MaterialTable materials;
+			scene.Build(world, materials, *arena);
+
+			RenderBenchmarkResult result;
+			result.name = canonical.name;
+			result.spheres = scene.GetSphereCount();
+
+			std::vector<double> rates;
+			std::vector<double> seconds;
+			for (int run = -settings.warmupRuns; run < settings.runs; run++) {
+				Camera camera(settings.width, settings.height, make_shared<NullSink>());
+				if (configure)
+					configure(camera);
+				SetCameraView(camera, scene.camera);
+				camera.samplesPerPixel = settings.samplesPerPixel;
+				camera.maxRayBounces = settings.maxRayBounces;
+				camera.seed = 1;
+				camera.verbose = false;
+
+				if (!camera.Render(world, materials))
+					return false;
+				if (run < 0)
+					continue;
+
+				result.rays = camera.GetRayCount();
+				rates.push_back(camera.GetRayCount() / camera.GetRenderSeconds() / 1e6);
+				seconds.push_back(camera.GetRenderSeconds());
+			}
+			if (rates.empty())
+				continue;
+
+			std::sort(rates.begin(), rates.end());
+			std::sort(seconds.begin(), seconds.end());
+			result.runs = static_cast<int>(rates.size());
+			result.median = Median(rates);
+			result.min = rates.front();
+			result.max = rates.back();
+			double mean = 0, squares = 0;
+			for (double rate : rates)
+				mean += rate / rates.size();
+			for (double rate : rates)
+				squares += (rate - mean) * (rate - mean) / rates.size();
+			result.deviation = std::sqrt(squares);
+			result.secondsPerSpp = Median(seconds) / settings.samplesPerPixel;
+			results.push_back(result);
+
+			snprintf(line, sizeof(line), "%-14s %9zu %10.3f %10.3f %10.3f %10.3f %7.1f%% %10.2f\n", result.name.c_str(), result.spheres,
+				result.rays / 1e6, result.median, result.min, result.max, result.GetSpread(), result.secondsPerSpp * 1000);
+			out << line << std::flush;
+		}
+
+		return true;
+	}
+
+	const std::vector<RenderBenchmarkResult>& GetResults() const { return results; }
+
+	void WriteJson(std::ostream& out) const {
+		out << "{\n  \"settings\": { \"width\": " << settings.width << ", \"height\": " << settings.height
+			<< ", \"spp\": " << settings.samplesPerPixel << ", \"bounces\": " << settings.maxRayBounces << ", \"runs\": " << settings.runs << " },\n";
+		out << "  \"scenes\": [\n";
+		for (size_t i = 0; i < results.size(); i++) {
+			const RenderBenchmarkResult& r = results[i];
+			char line[512];
+			snprintf(line, sizeof(line),
+				"    { \"name\": \"%s\", \"spheres\": %zu, \"rays\": %llu, \"runs\": %d, \"mrays_per_sec\": %.4f, "
+				"\"min\": %.4f, \"max\": %.4f, \"stddev\": %.4f, \"spread_percent\": %.2f, \"ms_per_spp\": %.4f }%s\n",
+				r.name.c_str(), r.spheres, static_cast<unsigned long long>(r.rays), r.runs, r.median,
+				r.min, r.max, r.deviation, r.GetSpread(), r.secondsPerSpp * 1000, i + 1 < results.size() ? "," : "");
+			out << line;
+		}
+		out << "  ]\n}\n";
+	}
+
+	// reads the scene names and Mrays/s of a file written by WriteJson
+	// returns function's success
+	static bool LoadBaseline(const char* path, std::vector<std::pair<std::string, double>>& baseline) {
+		std::ifstream file(path);
+		if (!file)
+			return false;
+		std::stringstream buffer;
+		buffer << file.rdbuf();
+		const std::string text = buffer.str();
+
+		baseline.clear();
+		const std::string nameKey = "\"name\": \"";
+		const std::string rateKey = "\"mrays_per_sec\": ";
+		for (size_t at = text.find(nameKey); at != std::string::npos; at = text.find(nameKey, at)) {
+			at += nameKey.size();
+			size_t nameEnd = text.find('"', at);
+			size_t rate = text.find(rateKey, nameEnd);
+			if (nameEnd == std::string::npos || rate == std::string::npos)
+				return false;
+			baseline.emplace_back(text.substr(at, nameEnd - at), atof(text.c_str() + rate + rateKey.size()));
+		}
+		return !baseline.empty();
+	}
+
+	// prints the change of every scene against the baseline
+	// returns false if any scene is slower by more than thresholdPercent
+	bool CompareBaseline(const std::vector<std::pair<std::string, double>>& baseline, double thresholdPercent, std::ostream& out) const {
+		bool passed = true;
+		for (const RenderBenchmarkResult& result : results) {
+			auto match = std::find_if(baseline.begin(), baseline.end(), [&](const auto& entry) { return entry.first == result.name; });
+			char line[160];
+			if (match == baseline.end() || match->second <= 0) {
+				snprintf(line, sizeof(line), "%-14s no baseline\n", result.name.c_str());
+				out << line;
+				continue;
+			}
+
+			double change = 100 * (result.median / match->second - 1);
+			bool regressed = change < -thresholdPercent;
+			passed = passed && !regressed;
+			snprintf(line, sizeof(line), "%-14s %10.3f vs %10.3f Mrays/s %+7.1f%% %s\n", result.name.c_str(), result.median, match->second, change,
+				regressed ? "REGRESSION" : "ok");
+			out << line;
+		}
+		return passed;
+	}
+
+private:
+	std::vector<RenderBenchmarkResult> results;
+
+	static double Median(const std::vector<double>& sorted) {
+		size_t n = sorted.size();
+		return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+	}
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "FlatScene.h"
+#include "PixelColor.h"
+#include "Sphere.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Progress of a render, updated as bands of rows finish.
+struct RenderProgress {
+	int completedRows = 0;
+	int totalRows = 0;
+	double elapsedSeconds = 0;
+	double remainingSeconds = 0;	// estimated from the rate so far
+
+	double GetFraction() const { return totalRows > 0 ? static_cast<double>(completedRows) / totalRows : 1.0; }
+};
+
+// Handle of a render started by Camera::RenderAsync.
+// The workers complete the render themselves, so no thread has to wait on it. The camera, scene and materials
+// must outlive the job, and destroying the last handle waits for the workers to exit. A job on a WorkerPool is
+// held by the pool until its workers are done with it.
+class RenderJob {
+public:
+	RenderJob(const RenderJob&) = delete;
+	RenderJob& operator=(const RenderJob&) = delete;
+	~RenderJob() { Join(); }
+
+	// workers finish the bands they are tracing and claim no more, the render then completes as failed
+	void Cancel() { cancelled = true; }
+	bool IsCancelled() const { return cancelled; }
+
+	bool IsDone() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return done;
+	}
+
+	// blocks until the render is done, must not be called from a progress callback
+	// returns function's success, false when cancelled
+	bool Wait() {
+		future.wait();
+		Join();
+		return future.get();
+	}
+
+	// becomes ready with the render's success when it is done
+	std::shared_future<bool> GetFuture() const { return future; }
+
+	RenderProgress GetProgress() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return MakeProgress();
+	}
+
+	// blocks until more than completedRows rows are finished or the render is done
+	RenderProgress WaitForProgress(int completedRows) const {
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [&] { return done || finishedRows > completedRows; });
+		return MakeProgress();
+	}
+
+	// copies the rows finished so far into pixels, unfinished rows are left as they are
+	// finishedRows, when given, gets 1 for every finished row
+	// returns false when the camera did not keep a partial image, see Camera::keepPartialImage
+	bool GetPartialImage(std::vector<PixelColor>& pixels, std::vector<uint8_t>* finishedRows = nullptr) const {
+		if (image.empty())
+			return false;
+		pixels.resize(image.size());
+		if (finishedRows)
+			finishedRows->assign(height, 0);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int y = 0; y < height; y++) {
+			if (!rowFinished[y])
+				continue;
+			std::memcpy(pixels.data() + static_cast<size_t>(y) * width, image.data() + static_cast<size_t>(y) * width, width * sizeof(PixelColor));
+			if (finishedRows)
+				(*finishedRows)[y] = 1;
+		}
+		return true;
+	}
+
+private:
+	friend class Camera;
+
+	const int width, height;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::atomic<bool> cancelled{ false };
+
+	// must outlive the workers
+	FlatScene<Sphere> flatWorld;
+	FlatScene<Spheref> flatWorldFloat;
+	std::vector<std::thread> workers;
+	std::mutex joinMutex;
+	std::atomic_uint32_t bandCounter{ 0 };
+	std::atomic<int> activeWorkers{ 0 };
+	WorkerPool::Job* pooled = nullptr;	// the pool's side of the job, null when the workers are threads of its own
+
+	// rows written so far, guarded by mutex
+	mutable std::mutex mutex;
+	mutable std::condition_variable changed;
+	int finishedRows = 0;
+	std::vector<uint8_t> rowFinished;
+	std::vector<PixelColor> image;		// copies of the finished rows, when kept
+	bool done = false;
+
+	std::mutex callbackMutex;			// progress callbacks run one at a time
+	std::promise<bool> result;
+	std::shared_future<bool> future = result.get_future().share();
+
+	RenderJob(int _width, int _height, bool keepImage)
+		: width(_width), height(_height), rowFinished(_height, 0) {
+		if (keepImage)
+			image.resize(static_cast<size_t>(_width) * _height);
+	}
+
+	// called by a worker once the resolved row y has been written out
+	void FinishRow(int y, const PixelColor* row) {
+		if (!image.empty())
+			std::memcpy(image.data() + static_cast<size_t>(y) * width, row, width * sizeof(PixelColor));
+		std::lock_guard<std::mutex> lock(mutex);
+		rowFinished[y] = 1;
+		finishedRows++;
+	}
+
+	// called by a worker after the rows of a band have finished
+	RenderProgress FinishBand() {
+		RenderProgress progress;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			progress = MakeProgress();
+		}
+		changed.notify_all();
+		return progress;
+	}
+
+	void Complete(bool success) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			done = true;
+		}
+		changed.notify_all();
+		result.set_value(success);
+	}
+
+	void Join() {
+		std::lock_guard<std::mutex> lock(joinMutex);
+		for (std::thread& worker : workers) {
+			if (worker.joinable())
+				worker.join();
+		}
+	}
+
+	// with mutex held
+	RenderProgress MakeProgress() const {
+		RenderProgress progress;
+		progress.completedRows = finishedRows;
+		progress.totalRows = height;
+		progress.elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (finishedRows > 0)
+			progress.remainingSeconds = progress.elapsedSeconds * (height - finishedRows) / finishedRows;
+		return progress;
+	}
+};
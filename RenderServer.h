@@ -0,0 +1,513 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "Camera.h"
+#include "FlatScene.h"
+#include "Scene.h"
+#include "SceneArena.h"
+#include "Scenes.h"
+#include "Texture.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// A scene kept ready to render: the built objects and the flat copies the specialised kernels trace,
+// so a render of it from any camera skips loading, building and gathering.
+class CachedScene {
+public:
+	uint64_t hash = 0;
+	std::string reference;
+	CameraRecord camera;
+	RenderRecord render;
+	size_t sphereCount = 0;
+	HittableList world;
+	MaterialTable materials;
+
+	// gathered on first use, null when the world holds more than spheres
+	shared_ptr<const FlatScene<Sphere>> GetFlatScene() { return GetFlat(flat, flatGathered); }
+	shared_ptr<const FlatScene<Spheref>> GetFlatSceneFloat() { return GetFlat(flatFloat, flatFloatGathered); }
+
+private:
+	friend class SceneCache;
+
+	shared_ptr<SceneArena> arena;
+	std::mutex mutex;				// held while building and gathering
+	shared_ptr<FlatScene<Sphere>> flat;
+	shared_ptr<FlatScene<Spheref>> flatFloat;
+	bool flatGathered = false, flatFloatGathered = false;
+
+	template <typename Flat>
+	shared_ptr<const Flat> GetFlat(shared_ptr<Flat>& cached, bool& gathered) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!gathered) {
+			gathered = true;
+			auto created = make_shared<Flat>();
+			if (created->Gather(world))
+				cached = created;
+		}
+		return cached;
+	}
+
+	// builds the scene loaded when its hash was taken, so what is cached under the hash is what was hashed
+	void Build(const SceneDescription& scene) {
+		camera = scene.camera;
+		render = scene.render;
+		sphereCount = scene.GetSphereCount();
+		arena = make_shared<SceneArena>();
+		scene.Build(world, materials, *arena);
+	}
+};
+
+// Scenes by content hash, evicting the least recently used past capacity. Scenes still being rendered stay alive
+// until their renders finish. Concurrent requests for a scene that is not built yet wait for one build.
+// A scene file is only read again when its size or modification time changed since it was last hashed,
+// so a request for a cached scene costs a file stamp rather than a pass over the file.
+class SceneCache {
+public:
+	explicit SceneCache(size_t _capacity) : capacity(std::max<size_t>(_capacity, 1)) { }
+
+	// reference is a scene file or "@" and the name of a canonical scene
+	// returns nullptr with error set when the scene cannot be read
+	shared_ptr<CachedScene> Get(const std::string& reference, bool& hit, std::string& error) {
+		// a second pass reads the file after its scene was evicted while this one looked it up
+		for (bool reload = false;; reload = true) {
+			std::unique_ptr<SceneDescription> loaded;
+			uint64_t hash;
+			if (!Identify(reference, reload, loaded, hash, error))
+				return nullptr;
+
+			shared_ptr<CachedScene> scene;
+			std::unique_lock<std::mutex> building;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				auto found = index.find(hash);
+				hit = found != index.end();
+				if (hit) {
+					// most recently used first
+					order.splice(order.begin(), order, found->second);
+					scene = *found->second;
+					hits++;
+				}
+				else if (loaded) {
+					scene = make_shared<CachedScene>();
+					scene->hash = hash;
+					scene->reference = reference;
+					order.push_front(scene);
+					index[hash] = order.begin();
+					misses++;
+					for (; order.size() > capacity; evictions++) {
+						index.erase(order.back()->hash);
+						order.pop_back();
+					}
+					// taken before it can be found, so requests that hit it wait for the build
+					building = std::unique_lock<std::mutex>(scene->mutex);
+				}
+			}
+			if (!scene)
+				continue;
+
+			if (building.owns_lock()) {
+				scene->Build(*loaded);
+				return scene;
+			}
+			std::lock_guard<std::mutex> lock(scene->mutex);
+			return scene;
+		}
+	}
+
+	// entries, hits, misses and evictions
+	std::string GetStats() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return "scenes " + std::to_string(order.size()) + " hits " + std::to_string(hits) + " misses " + std::to_string(misses)
+			+ " evictions " + std::to_string(evictions);
+	}
+
+	// hash of a loaded scene's records, the camera and render settings included
+	static uint64_t HashScene(const SceneDescription& scene) {
+		uint64_t hash = HashBytes(&scene.camera, sizeof(scene.camera), 0x5CE7E5);
+		hash = HashBytes(&scene.render, sizeof(scene.render), hash);
+		hash = HashBytes(scene.GetMaterials(), scene.GetMaterialCount() * sizeof(MaterialRecord), hash);
+		return HashBytes(scene.GetSpheres(), scene.GetSphereCount() * sizeof(SphereRecord), hash);
+	}
+
+private:
+	struct FileStamp {
+		uint64_t size;
+		int64_t time;
+		uint64_t hash;		// of the scene the file held at this stamp
+	};
+
+	size_t capacity;
+	std::mutex mutex;
+	std::list<shared_ptr<CachedScene>> order;
+	std::unordered_map<uint64_t, std::list<shared_ptr<CachedScene>>::iterator> index;
+	std::unordered_map<std::string, FileStamp> stamps;		// of the scene files hashed so far
+	uint64_t hits = 0, misses = 0, evictions = 0;
+
+	// Finds the hash of a scene. A canonical scene is hashed by name, since it is generated from a fixed seed, and
+	// a scene file by its content, taken from the stamp when the file has not changed. The scene is loaded into
+	// `loaded` when its hash had to be taken from it, or when it is not cached and so has to be built.
+	// returns function's success
+	bool Identify(const std::string& reference, bool reload, std::unique_ptr<SceneDescription>& loaded, uint64_t& hash,
+		std::string& error) {
+		if (reference.empty()) {
+			error = "missing scene";
+			return false;
+		}
+		if (reference[0] == '@') {
+			const std::vector<CanonicalScene>& scenes = GetCanonicalScenes();
+			auto canonical = std::find_if(scenes.begin(), scenes.end(), [&](const CanonicalScene& s) { return s.name == reference.substr(1); });
+			if (canonical == scenes.end()) {
+				error = "unknown scene " + reference;
+				return false;
+			}
+			hash = HashBytes(reference.data(), reference.size(), 0x5CE7E5);
+			if (reload || !IsCached(hash)) {
+				loaded = std::make_unique<SceneDescription>();
+				CreateCanonicalScene(*canonical, *loaded);
+			}
+			return true;
+		}
+
+		// stamped before reading, so a change while loading shows up as a new stamp on the next request
+		FileStamp stamp;
+		if (!SceneDescription::GetFileStamp(reference.c_str(), stamp.size, stamp.time)) {
+			error = "cannot open " + reference;
+			return false;
+		}
+		if (!reload) {
+			std::lock_guard<std::mutex> lock(mutex);
+			auto known = stamps.find(reference);
+			if (known != stamps.end() && known->second.size == stamp.size && known->second.time == stamp.time
+				&& index.count(known->second.hash)) {
+				hash = known->second.hash;
+				return true;
+			}
+		}
+
+		loaded = std::make_unique<SceneDescription>();
+		if (!loaded->Load(reference.c_str())) {
+			error = loaded->GetError();
+			return false;
+		}
+		hash = stamp.hash = HashScene(*loaded);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		stamps[reference] = stamp;
+		// stamps only matter for the files of cached scenes
+		for (auto entry = stamps.begin(); entry != stamps.end();) {
+			if (entry->first != reference && !index.count(entry->second.hash))
+				entry = stamps.erase(entry);
+			else
+				++entry;
+		}
+		return true;
+	}
+
+	bool IsCached(uint64_t hash) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return index.count(hash) != 0;
+	}
+};
+
+struct RenderServerSettings {
+	std::string socketPath;
+	size_t cachedScenes = 4;	// scenes kept built between jobs
+	std::string outputDirectory = ".";	// every image a job writes goes here
+	int threadCount = 0;		// workers shared by every job, 0 for one per hardware thread
+	int maxWidth = 16384;		// largest request a client may make
+	int maxHeight = 16384;
+	int maxSamplesPerPixel = 1 << 16;
+	int maxRayBounces = 1024;
+};
+
+// Long running renderer listening on a local socket. Clients send one request per line and get one reply line:
+//
+//   render <scene> [output <png>] [width <px>] [height <px>] [spp <n>] [bounces <n>] [seed <n>]
+//          [lookfrom <x y z>] [lookat <x y z>] [vup <x y z>] [vfov <deg>] [defocus <deg>] [focus <dist>]
+//          [priority <n>] [weight <w>] [deadline <s>]
+//     -> ok <png> render <s> setup <ms> cache hit|miss
+//   stats       -> ok scenes <n> hits <n> misses <n> evictions <n>
+//   shutdown    -> ok, then the server exits once the jobs in flight have finished
+//   anything that fails -> error <message>
+//
+// <scene> is a scene file or @<canonical scene>; settings not given come from the scene, and requests beyond the
+// settings' limits or the machine's memory are answered with an error. <png> is a file name in the output directory,
+// job-<n>.png with a number no other job of the server has when not given. Every connection is served
+// by its own thread, and the renders of all of them share one worker pool by priority, weight and deadline.
+class RenderServer {
+public:
+	RenderServerSettings settings;
+	std::function<void(Camera&)> configure;		// render loop options applied to every job
+
+	RenderServer() { }
+	RenderServer(const RenderServer&) = delete;
+	RenderServer& operator=(const RenderServer&) = delete;
+
+	// serves until a client asks it to shut down
+	// returns function's success
+	bool Run() {
+#ifdef _WIN32
+		std::cerr << "The render server needs Unix domain sockets, which this build does not support\n";
+		return false;
+#else
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if (settings.socketPath.empty() || settings.socketPath.size() >= sizeof(address.sun_path)) {
+			std::cerr << "Invalid socket path " << settings.socketPath << "\n";
+			return false;
+		}
+		std::memcpy(address.sun_path, settings.socketPath.c_str(), settings.socketPath.size());
+
+		// a broken connection shows up as a failed send rather than ending the process
+		signal(SIGPIPE, SIG_IGN);
+
+		int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		unlink(settings.socketPath.c_str());
+		if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0) {
+			std::cerr << "Could not listen on " << settings.socketPath << "\n";
+			if (listener >= 0)
+				close(listener);
+			return false;
+		}
+
+		cache = std::make_unique<SceneCache>(settings.cachedScenes);
+		pool = make_shared<WorkerPool>(settings.threadCount);
+		std::clog << "Serving on " << settings.socketPath << " with " << pool->GetThreadCount() << " workers, caching "
+			<< settings.cachedScenes << " scenes\n";
+
+		// polls so a shutdown request is noticed without another connection
+		std::list<Connection> connections;
+		while (!stopping) {
+			// joins the threads of clients that have gone
+			for (auto connection = connections.begin(); connection != connections.end();) {
+				if (connection->done) {
+					connection->thread.join();
+					connection = connections.erase(connection);
+				}
+				else
+					++connection;
+			}
+
+			pollfd waiting = { listener, POLLIN, 0 };
+			if (poll(&waiting, 1, 100) <= 0)
+				continue;
+			int client = accept(listener, nullptr, nullptr);
+			if (client >= 0) {
+				Connection& connection = connections.emplace_back();
+				connection.thread = std::thread([this, client, &connection] {
+					Serve(client);
+					connection.done = true;
+				});
+			}
+		}
+
+		close(listener);
+		unlink(settings.socketPath.c_str());
+		{
+			// wakes the connections waiting on their clients
+			std::lock_guard<std::mutex> lock(clientsMutex);
+			for (int client : clients)
+				shutdown(client, SHUT_RD);
+		}
+		for (Connection& connection : connections)
+			connection.thread.join();
+		pool.reset();
+		return true;
+#endif
+	}
+
+private:
+	struct Connection {
+		std::thread thread;
+		std::atomic<bool> done{ false };	// Serve returned, the thread can be joined
+	};
+
+	std::unique_ptr<SceneCache> cache;
+	shared_ptr<WorkerPool> pool;
+	std::atomic<bool> stopping{ false };
+	std::atomic<uint64_t> jobCount{ 0 };
+	std::mutex clientsMutex;
+	std::vector<int> clients;
+
+#ifndef _WIN32
+	void Serve(int client) {
+		{
+			std::lock_guard<std::mutex> lock(clientsMutex);
+			clients.push_back(client);
+		}
+
+		std::string buffer, line;
+		while (ReadLine(client, buffer, line)) {
+			std::string reply = Handle(line);
+			reply += "\n";
+			if (send(client, reply.data(), reply.size(), 0) != static_cast<ssize_t>(reply.size()))
+				break;
+		}
+
+		std::lock_guard<std::mutex> lock(clientsMutex);
+		clients.erase(std::find(clients.begin(), clients.end(), client));
+		close(client);
+	}
+
+	// returns false when the client has gone
+	static bool ReadLine(int client, std::string& buffer, std::string& line) {
+		size_t end;
+		while ((end = buffer.find('\n')) == std::string::npos) {
+			char bytes[4096];
+			ssize_t received = recv(client, bytes, sizeof(bytes), 0);
+			if (received <= 0)
+				return false;
+			buffer.append(bytes, static_cast<size_t>(received));
+		}
+		line = buffer.substr(0, end);
+		buffer.erase(0, end + 1);
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		return true;
+	}
+#endif
+
+	std::string Handle(const std::string& line) {
+		std::vector<std::string> words;
+		for (size_t start = line.find_first_not_of(" \t"); start != std::string::npos; start = line.find_first_not_of(" \t", start)) {
+			size_t end = std::min(line.find_first_of(" \t", start), line.size());
+			words.push_back(line.substr(start, end - start));
+			start = end;
+		}
+
+		if (words.empty())
+			return "error empty request";
+		if (words[0] == "stats")
+			return "ok " + cache->GetStats();
+		if (words[0] == "shutdown") {
+			stopping = true;
+			return "ok";
+		}
+		if (words[0] == "render" && words.size() >= 2) {
+			// a request too large for the machine fails on its own, rather than ending the server
+			try {
+				return Render(words);
+			}
+			catch (const std::bad_alloc&) {
+				return "error out of memory";
+			}
+		}
+		return "error unknown request " + words[0];
+	}
+
+	std::string Render(const std::vector<std::string>& words) {
+		auto setupStart = high_resolution_clock::now();
+		bool hit = false;
+		std::string error;
+		shared_ptr<CachedScene> scene = cache->Get(words[1], hit, error);
+		if (!scene)
+			return "error " + error;
+
+		// the scene's settings, then the request's
+		std::string output;
+		CameraRecord view = scene->camera;
+		int width = static_cast<int>(scene->render.width);
+		int height = static_cast<int>(scene->render.height);
+		int samplesPerPixel = static_cast<int>(scene->render.samplesPerPixel);
+		int maxRayBounces = static_cast<int>(scene->render.maxRayBounces);
+		uint64_t seed = 0;
+		JobSchedule schedule;
+
+		for (size_t i = 2; i < words.size(); i++) {
+			const std::string& key = words[i];
+			size_t values = key == "lookfrom" || key == "lookat" || key == "vup" ? 3 : 1;
+			if (i + values >= words.size())
+				return "error missing value for " + key;
+			const char* value = words[i + 1].c_str();
+
+			if (key == "output") output = value;
+			else if (key == "width") width = atoi(value);
+			else if (key == "height") height = atoi(value);
+			else if (key == "spp") samplesPerPixel = atoi(value);
+			else if (key == "bounces") maxRayBounces = atoi(value);
+			else if (key == "seed") seed = strtoull(value, nullptr, 10);
+			else if (key == "vfov") view.vfov = static_cast<float>(atof(value));
+			else if (key == "defocus") view.defocusAngle = static_cast<float>(atof(value));
+			else if (key == "focus") view.focusDist = static_cast<float>(atof(value));
+			else if (key == "priority") schedule.priority = atoi(value);
+			else if (key == "weight") schedule.weight = atof(value);
+			else if (key == "deadline") schedule.deadlineSeconds = atof(value);
+			else if (values == 3) {
+				float* vector = key == "lookfrom" ? view.lookfrom : key == "lookat" ? view.lookat : view.vup;
+				for (size_t c = 0; c < 3; c++)
+					vector[c] = static_cast<float>(atof(words[i + 1 + c].c_str()));
+			}
+			else
+				return "error unknown setting " + key;
+			i += values;
+		}
+		if (width <= 0 || height <= 0 || samplesPerPixel <= 0 || maxRayBounces <= 0)
+			return "error invalid render settings";
+		// a bare file name, so clients cannot write anywhere but the output directory
+		if (output == "." || output == ".." || output.find_first_of("/\\") != std::string::npos)
+			return "error output must be a file name";
+		if (!(schedule.weight > 0) || !std::isfinite(schedule.weight) || !(schedule.deadlineSeconds >= 0))
+			return "error weight must be positive and deadline not negative";
+		if (width > settings.maxWidth || height > settings.maxHeight || samplesPerPixel > settings.maxSamplesPerPixel
+			|| maxRayBounces > settings.maxRayBounces)
+			return "error render settings exceed the server's limits of " + std::to_string(settings.maxWidth) + "x"
+				+ std::to_string(settings.maxHeight) + ", spp " + std::to_string(settings.maxSamplesPerPixel) + ", bounces "
+				+ std::to_string(settings.maxRayBounces);
+
+		if (output.empty())
+			output = "job-" + std::to_string(++jobCount) + ".png";
+
+		auto image = make_shared<Texture>(width, height);
+		Camera camera(image);
+		if (configure)
+			configure(camera);
+		SetCameraView(camera, view);
+		camera.samplesPerPixel = samplesPerPixel;
+		camera.maxRayBounces = maxRayBounces;
+		camera.seed = seed;
+		camera.verbose = false;
+		camera.workerPool = pool;
+		camera.schedule = schedule;
+		if (camera.specializedKernels) {
+			if (camera.singlePrecision)
+				camera.flatSceneFloat = scene->GetFlatSceneFloat();
+			else
+				camera.flatScene = scene->GetFlatScene();
+		}
+		double setupMs = duration_cast<microseconds>(high_resolution_clock::now() - setupStart).count() / 1000.0;
+
+		if (!camera.Render(scene->world, scene->materials))
+			return "error render failed";
+		if (!image->SaveToFile((settings.outputDirectory + "/" + output).c_str()))
+			return "error cannot write " + output;
+
+		char reply[128];
+		snprintf(reply, sizeof(reply), " render %.3f setup %.3f cache %s", camera.GetRenderSeconds(), setupMs, hit ? "hit" : "miss");
+		std::clog << words[1] << " -> " << output << ":" << reply << "\n";
+		return "ok " + output + reply;
+	}
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <ostream>
+
+// Render statistics are counted in debug builds and compiled out of release builds,
+// define RENDER_STATS=1 to count them in a release build too.
+#ifndef RENDER_STATS
+#ifdef NDEBUG
+#define RENDER_STATS 0
+#else
+#define RENDER_STATS 1
+#endif
+#endif
+
+#if RENDER_STATS
+// applies an expression to this thread's counters, e.g. RENDER_STAT(intersectionTests++)
+#define RENDER_STAT(expression) (RenderStats::Local().expression)
+// adds this thread's counters to the totals of a render, once when the thread's share of it is done
+#define RENDER_STATS_MERGE(stats) (stats).Merge()
+#else
+#define RENDER_STAT(expression) ((void)0)
+#define RENDER_STATS_MERGE(stats) ((void)0)
+#endif
+
+// Counters of where a render spends its work. Each thread counts into its own copy without synchronisation,
+// the copies are merged into the totals of the render when the thread's share of it is done.
+// Every render keeps its own totals, so renders running at the same time do not mix their counts.
+class RenderStats {
+public:
+	enum RayType { CameraRay, DiffuseRay, ReflectedRay, RefractedRay, RayTypeCount };
+	enum Termination { Escaped, Absorbed, DepthLimit, TerminationCount };
+	static const int materialKinds = 3;		// in the order of Material::Kind
+	static const int maxPathLength = 64;	// longer paths are counted in the last bucket
+
+	struct Counters {
+		uint64_t samples = 0;
+		uint64_t rays[RayTypeCount] = {};
+		uint64_t intersectionTests = 0;		// primitive tests
+		uint64_t primitiveHits = 0;			// tests that found a new closest hit
+		uint64_t nodeVisits = 0;			// bounding volume nodes visited by single rays and packets
+		uint64_t terminations[TerminationCount] = {};
+		uint64_t pathLengths[maxPathLength + 1] = {};	// by rays traced along the path
+		uint64_t scatters[materialKinds] = {};
+
+		void EndPath(Termination reason, int length, uint64_t count = 1) {
+			terminations[reason] += count;
+			pathLengths[length < maxPathLength ? length : maxPathLength] += count;
+		}
+
+		void Add(const Counters& other) {
+			samples += other.samples;
+			for (int i = 0; i < RayTypeCount; i++)
+				rays[i] += other.rays[i];
+			intersectionTests += other.intersectionTests;
+			primitiveHits += other.primitiveHits;
+			nodeVisits += other.nodeVisits;
+			for (int i = 0; i < TerminationCount; i++)
+				terminations[i] += other.terminations[i];
+			for (int i = 0; i <= maxPathLength; i++)
+				pathLengths[i] += other.pathLengths[i];
+			for (int i = 0; i < materialKinds; i++)
+				scatters[i] += other.scatters[i];
+		}
+	};
+
+	static constexpr bool IsEnabled() { return RENDER_STATS != 0; }
+
+	static Counters& Local() {
+		thread_local Counters counters;
+		return counters;
+	}
+
+	// moves this thread's counters into the totals
+	void Merge() {
+		std::lock_guard<std::mutex> lock(mutex);
+		merged.Add(Local());
+		Local() = Counters();
+	}
+
+	void Reset() {
+		std::lock_guard<std::mutex> lock(mutex);
+		merged = Counters();
+	}
+
+	Counters GetTotals() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return merged;
+	}
+
+	static const char* GetName(RayType type) {
+		static const char* names[] = { "camera", "diffuse", "reflected", "refracted" };
+		return names[type];
+	}
+
+	static const char* GetName(Termination reason) {
+		static const char* names[] = { "escaped", "absorbed", "depth limit" };
+		return names[reason];
+	}
+
+	static const char* GetMaterialName(int kind) {
+		static const char* names[] = { "lambertian", "metal", "dielectric" };
+		return names[kind];
+	}
+
+	void PrintText(std::ostream& out) const {
+		const Counters totals = GetTotals();
+		uint64_t rays = 0, paths = 0;
+		for (uint64_t n : totals.rays)
+			rays += n;
+		for (uint64_t n : totals.terminations)
+			paths += n;
+
+		char line[160];
+		out << "Render statistics:\n";
+		snprintf(line, sizeof(line), "  samples %llu, rays %llu (", ULL(totals.samples), ULL(rays));
+		out << line;
+		for (int i = 0; i < RayTypeCount; i++)
+			out << (i ? ", " : "") << GetName(static_cast<RayType>(i)) << " " << totals.rays[i];
+		out << ")\n";
+
+		snprintf(line, sizeof(line), "  intersection tests %llu, primitive hits %llu, misses %llu, node visits %llu, %.1f tests/ray\n",
+			ULL(totals.intersectionTests), ULL(totals.primitiveHits), ULL(totals.intersectionTests - totals.primitiveHits),
+			ULL(totals.nodeVisits), rays ? static_cast<double>(totals.intersectionTests) / rays : 0.0);
+		out << line;
+
+		out << "  paths ended:";
+		for (int i = 0; i < TerminationCount; i++) {
+			snprintf(line, sizeof(line), "%s %s %llu (%.1f%%)", i ? "," : "", GetName(static_cast<Termination>(i)), ULL(totals.terminations[i]),
+				paths ? 100.0 * totals.terminations[i] / paths : 0.0);
+			out << line;
+		}
+		out << "\n  scatters:";
+		for (int i = 0; i < materialKinds; i++)
+			out << (i ? ", " : " ") << GetMaterialName(i) << " " << totals.scatters[i];
+
+		out << "\n  path length:";
+		for (int i = 0; i <= maxPathLength; i++) {
+			if (totals.pathLengths[i] == 0)
+				continue;
+			snprintf(line, sizeof(line), " %d%s:%llu", i, i == maxPathLength ? "+" : "", ULL(totals.pathLengths[i]));
+			out << line;
+		}
+		out << "\n";
+	}
+
+	void WriteJson(std::ostream& out) const {
+		const Counters totals = GetTotals();
+		out << "{\n  \"enabled\": " << (IsEnabled() ? "true" : "false") << ",\n  \"samples\": " << totals.samples << ",\n  \"rays\": {";
+		for (int i = 0; i < RayTypeCount; i++)
+			out << (i ? ", " : " ") << "\"" << GetName(static_cast<RayType>(i)) << "\": " << totals.rays[i];
+		out << " },\n  \"intersection_tests\": " << totals.intersectionTests
+			<< ",\n  \"primitive_hits\": " << totals.primitiveHits
+			<< ",\n  \"primitive_misses\": " << totals.intersectionTests - totals.primitiveHits
+			<< ",\n  \"node_visits\": " << totals.nodeVisits << ",\n  \"terminations\": {";
+		for (int i = 0; i < TerminationCount; i++)
+			out << (i ? ", " : " ") << "\"" << GetName(static_cast<Termination>(i)) << "\": " << totals.terminations[i];
+		out << " },\n  \"scatters\": {";
+		for (int i = 0; i < materialKinds; i++)
+			out << (i ? ", " : " ") << "\"" << GetMaterialName(i) << "\": " << totals.scatters[i];
+		out << " },\n  \"path_lengths\": [";
+		for (int i = 0; i <= maxPathLength; i++)
+			out << (i ? ", " : " ") << totals.pathLengths[i];
+		out << " ]\n}\n";
+	}
+
+private:
+	static unsigned long long ULL(uint64_t value) { return static_cast<unsigned long long>(value); }
+
+	mutable std::mutex mutex;
+	Counters merged;	// totals of the threads done so far
+};
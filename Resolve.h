@@ -0,0 +1,127 @@
+#pragma once
+
+#include "PixelColor.h"
+#include "Simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+enum class Tonemapper {
+	Clamp,		// clip to [0, 1]
+	Reinhard,	// x / (1 + x)
+	ACES		// Narkowicz's fit of the ACES filmic curve
+};
+
+// tonemapper named clamp, reinhard or aces
+// returns false for any other name
+inline bool ParseTonemapper(const char* name, Tonemapper& tonemapper) {
+	if (strcmp(name, "clamp") == 0) tonemapper = Tonemapper::Clamp;
+	else if (strcmp(name, "reinhard") == 0) tonemapper = Tonemapper::Reinhard;
+	else if (strcmp(name, "aces") == 0) tonemapper = Tonemapper::ACES;
+	else return false;
+	return true;
+}
+
+enum class TransferFunction {
+	SRGB,		// exact piecewise sRGB curve
+	Gamma2		// x^(1/2), the original book's approximation
+};
+
+struct ResolveSettings {
+	float exposure = 1.0f;							// linear radiance multiplier applied before tonemapping
+	Tonemapper tonemapper = Tonemapper::Clamp;
+	TransferFunction transfer = TransferFunction::SRGB;
+	bool dither = false;							// ordered dither before quantizing to 8 bits
+};
+
+// Converts linear float radiance to 8-bit display colour.
+// Works on planar spans of pixels at a time; the per-channel loop is built for each instruction set in Simd.h.
+class Resolver {
+public:
+	static const int maxSpan = 256;		// pixels processed per pass through the kernels
+	static const int lutSize = 4096;	// entries in the transfer curve table
+
+	Resolver(const ResolveSettings& _settings = ResolveSettings()) : settings(_settings), kernels(&GetSimdKernels()) {
+		// every tonemapper is the rational curve x(ax + b) / (x(cx + d) + e)
+		static const float reinhard[5] = { 0, 1, 0, 1, 1 };
+		static const float aces[5] = { 2.51f, 0.03f, 2.43f, 0.59f, 0.14f };
+		curve = settings.tonemapper == Tonemapper::Reinhard ? reinhard : settings.tonemapper == Tonemapper::ACES ? aces : nullptr;
+
+		// tabulate the transfer curve in 0..255 output units, with one extra entry for interpolation
+		for (int i = 0; i <= lutSize; i++) {
+			double linear = static_cast<double>(i) / lutSize;
+			double encoded;
+			if (settings.transfer == TransferFunction::SRGB)
+				encoded = linear <= 0.0031308 ? 12.92 * linear : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+			else
+				encoded = sqrt(linear);
+			lut[i] = static_cast<float>(encoded * 255.0);
+		}
+	}
+
+	const ResolveSettings& GetSettings() const { return settings; }
+
+	// resolves `count` pixels of image row y, starting at column x0
+	// r, g and b are planar linear radiance
+	void ResolveSpan(const float* r, const float* g, const float* b, int count, int x0, int y, PixelColor* out) const {
+		alignas(32) float offset[maxSpan];
+
+		for (int start = 0; start < count; start += maxSpan) {
+			int n = std::min(maxSpan, count - start);
+
+			// quantization offset, 0.5 rounds to nearest
+			if (settings.dither)
+				for (int i = 0; i < n; i++)
+					offset[i] = bayer8x8[(y & 7) * 8 + ((x0 + start + i) & 7)];
+			else
+				for (int i = 0; i < n; i++)
+					offset[i] = 0.5f;
+
+			const float* planes[3] = { r + start, g + start, b + start };
+			for (int c = 0; c < 3; c++)
+				kernels->resolveChannel(planes[c], offset, n, settings.exposure, curve, lut, lutSize, c, out + start);
+
+			for (int i = 0; i < n; i++)
+				out[start + i].rgba[3] = 255;
+		}
+	}
+
+	// resolves a row of double precision colours
+	void ResolveRow(const Color* colors, int count, int y, PixelColor* out) const {
+		alignas(32) float r[maxSpan];
+		alignas(32) float g[maxSpan];
+		alignas(32) float b[maxSpan];
+
+		for (int start = 0; start < count; start += maxSpan) {
+			int n = std::min(maxSpan, count - start);
+
+			// deinterleave into planes
+			for (int i = 0; i < n; i++) {
+				r[i] = static_cast<float>(colors[start + i].e[0]);
+				g[i] = static_cast<float>(colors[start + i].e[1]);
+				b[i] = static_cast<float>(colors[start + i].e[2]);
+			}
+
+			ResolveSpan(r, g, b, n, start, y, out + start);
+		}
+	}
+
+private:
+	ResolveSettings settings;
+	const SimdKernels* kernels;
+	const float* curve;		// null for Clamp
+	float lut[lutSize + 1];
+
+	static constexpr float bayer8x8[64] = {
+		 0.5f / 64, 32.5f / 64,  8.5f / 64, 40.5f / 64,  2.5f / 64, 34.5f / 64, 10.5f / 64, 42.5f / 64,
+		48.5f / 64, 16.5f / 64, 56.5f / 64, 24.5f / 64, 50.5f / 64, 18.5f / 64, 58.5f / 64, 26.5f / 64,
+		12.5f / 64, 44.5f / 64,  4.5f / 64, 36.5f / 64, 14.5f / 64, 46.5f / 64,  6.5f / 64, 38.5f / 64,
+		60.5f / 64, 28.5f / 64, 52.5f / 64, 20.5f / 64, 62.5f / 64, 30.5f / 64, 54.5f / 64, 22.5f / 64,
+		 3.5f / 64, 35.5f / 64, 11.5f / 64, 43.5f / 64,  1.5f / 64, 33.5f / 64,  9.5f / 64, 41.5f / 64,
+		51.5f / 64, 19.5f / 64, 59.5f / 64, 27.5f / 64, 49.5f / 64, 17.5f / 64, 57.5f / 64, 25.5f / 64,
+		15.5f / 64, 47.5f / 64,  7.5f / 64, 39.5f / 64, 13.5f / 64, 45.5f / 64,  5.5f / 64, 37.5f / 64,
+		63.5f / 64, 31.5f / 64, 55.5f / 64, 23.5f / 64, 61.5f / 64, 29.5f / 64, 53.5f / 64, 21.5f / 64
+	};
+};
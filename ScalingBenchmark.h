@@ -0,0 +1,140 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "Camera.h"
+#include "CostMap.h"
+#include "ImageSink.h"
+#include "Scene.h"
+#include "SceneArena.h"
+#include "Scenes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class ScalingMode {
+	Strong,		// the same image at every thread count
+	Weak		// pixels grow in proportion to the thread count
+};
+
+struct ScalingBenchmarkSettings {
+	ScalingMode mode = ScalingMode::Strong;
+	int width = 640;			// image at one thread
+	int height = 360;
+	int samplesPerPixel = 4;
+	int maxRayBounces = 10;
+	int runs = 3;				// the fastest run of each thread count is reported
+	int maxThreads = 0;			// 0 for one per hardware thread
+	std::string scene = "book";	// first canonical scene whose name contains this
+};
+
+// One thread count of a sweep.
+struct ScalingResult {
+	int threads = 0;
+	int width = 0;
+	int height = 0;
+	double seconds = 0;
+	double raysPerSecond = 0;
+	double speedup = 0;			// throughput relative to one thread
+	double efficiency = 0;		// speedup per thread
+	uint64_t syncCycles = 0;	// claiming bands and reporting progress, summed over the workers
+	double syncPercent = 0;		// of the workers' cycles
+	double idlePercent = 0;		// of the workers' time, spent finished while others still render
+};
+
+// Renders one canonical scene with 1, 2, 4, ... up to maxThreads workers and reports how throughput scales.
+// Speedup is measured in rays per second so strong and weak scaling read the same way: 1.0 efficiency is
+// perfect scaling in both.
+class ScalingBenchmark {
+public:
+	ScalingBenchmarkSettings settings;
+	std::function<void(Camera&)> configure;		// applies render loop options to every camera
+
+	// returns function's success
+	bool Run(std::ostream& out) {
+		results.clear();
+
+		const std::vector<CanonicalScene>& scenes = GetCanonicalScenes();
+		auto canonical = std::find_if(scenes.begin(), scenes.end(), [&](const CanonicalScene& s) { return s.name.find(settings.scene) != std::string::npos; });
+		if (canonical == scenes.end())
+			return false;
+
+		std::clog << "Scaling: building " << canonical->name << "\n";
+		SceneDescription scene;
+		CreateCanonicalScene(*canonical, scene);
+		auto arena = make_shared<SceneArena>();
+		HittableList world;
+		MaterialTable materials;
+		scene.Build(world, materials, *arena);
+
+		char line[160];
+		snprintf(line, sizeof(line), "%s scaling, %s\n%7s %11s %10s %8s %10s %12s %8s %8s\n", settings.mode == ScalingMode::Strong ? "Strong" : "Weak",
+			canonical->name.c_str(), "threads", "image", "Mrays/s", "speedup", "efficiency", "sync Mcycles", "sync", "idle");
+		out << line;
+
+		for (int threads : GetThreadCounts()) {
+			ScalingResult result;
+			result.threads = threads;
+			double scale = settings.mode == ScalingMode::Weak ? std::sqrt(static_cast<double>(threads)) : 1.0;
+			result.width = std::max(1, static_cast<int>(settings.width * scale + 0.5));
+			result.height = std::max(1, static_cast<int>(settings.height * scale + 0.5));
+
+			for (int run = 0; run < settings.runs; run++) {
+				Camera camera(result.width, result.height, make_shared<NullSink>());
+				if (configure)
+					configure(camera);
+				SetCameraView(camera, scene.camera);
+				camera.samplesPerPixel = settings.samplesPerPixel;
+				camera.maxRayBounces = settings.maxRayBounces;
+				camera.seed = 1;
+				camera.verbose = false;
+				camera.threadCount = threads;
+
+				uint64_t startCycles = ReadCycleCounter();
+				if (!camera.Render(world, materials))
+					return false;
+				uint64_t wallCycles = ReadCycleCounter() - startCycles;
+
+				double rate = camera.GetRayCount() / camera.GetRenderSeconds();
+				if (rate <= result.raysPerSecond)
+					continue;
+				result.seconds = camera.GetRenderSeconds();
+				result.raysPerSecond = rate;
+				result.syncCycles = camera.GetSyncCycles();
+				result.syncPercent = wallCycles ? 100.0 * camera.GetSyncCycles() / (static_cast<double>(wallCycles) * threads) : 0;
+				result.idlePercent = 100 * camera.GetIdleSeconds() / (camera.GetRenderSeconds() * threads);
+			}
+
+			const double baseline = results.empty() ? result.raysPerSecond : results.front().raysPerSecond;
+			result.speedup = baseline > 0 ? result.raysPerSecond / baseline : 0;
+			result.efficiency = result.speedup / threads;
+			results.push_back(result);
+
+			snprintf(line, sizeof(line), "%7d %5dx%-5d %10.3f %8.2f %10.2f %12.3f %7.2f%% %7.2f%%\n", result.threads, result.width, result.height,
+				result.raysPerSecond / 1e6, result.speedup, result.efficiency, result.syncCycles / 1e6, result.syncPercent, result.idlePercent);
+			out << line << std::flush;
+		}
+
+		return true;
+	}
+
+	const std::vector<ScalingResult>& GetResults() const { return results; }
+
+private:
+	std::vector<ScalingResult> results;
+
+	// powers of two up to the maximum, and the maximum itself
+	std::vector<int> GetThreadCounts() const {
+		int maxThreads = settings.maxThreads > 0 ? settings.maxThreads : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		std::vector<int> counts;
+		for (int threads = 1; threads < maxThreads; threads *= 2)
+			counts.push_back(threads);
+		counts.push_back(maxThreads);
+		return counts;
+	}
+};
@@ -0,0 +1,604 @@
+#pragma once
+
+#include "RTWeekend.h"
+
+#include "HittableList.h"
+#include "Material.h"
+#include "Sphere.h"
+#include "MappedFile.h"
+#include "MemoryStats.h"
+#include "SceneArena.h"
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+enum class MaterialType : uint32_t {
+	Lambertian = 0,
+	Metal = 1,
+	Dielectric = 2
+};
+
+// Plain records shared by the in-memory scene and the binary scene file.
+// The binary file is little-endian and is used in place through a file mapping.
+
+struct MaterialRecord {
+	uint32_t type;		// MaterialType
+	float color[3];		// albedo, or absorption coefficient for dielectrics
+	float fuzz;			// metal only
+	float ior;			// dielectric only
+};
+
+struct SphereRecord {
+	float center[3];
+	float radius;
+	uint32_t material;	// index into the material records
+};
+
+struct CameraRecord {
+	float lookfrom[3] = { 0, 0, -1 };
+	float lookat[3] = { 0, 0, 0 };
+	float vup[3] = { 0, 1, 0 };
+	float vfov = 90;
+	float defocusAngle = 0;
+	float focusDist = 10;
+};
+
+struct RenderRecord {
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	uint32_t samplesPerPixel = 10;
+	uint32_t maxRayBounces = 10;
+};
+
+struct SceneFileHeader {
+	char magic[8];				// "RTSCENE" followed by a zero byte
+	uint32_t version;
+	uint32_t materialCount;
+	uint64_t sphereCount;
+	uint64_t materialOffset;	// byte offset of the material records
+	uint64_t sphereOffset;		// byte offset of the sphere records
+	uint64_t sourceSize;		// size of the text scene this file caches, 0 if none
+	int64_t sourceTime;			// modification time of the text scene this file caches
+	CameraRecord camera;
+	RenderRecord render;
+};
+
+static_assert(sizeof(MaterialRecord) == 24, "MaterialRecord layout changed");
+static_assert(sizeof(SphereRecord) == 20, "SphereRecord layout changed");
+static_assert(sizeof(SceneFileHeader) == 120, "SceneFileHeader layout changed");
+
+// Description of everything needed to render a frame: materials, spheres, camera and render settings.
+// Text scenes are parsed into owned arrays, binary scenes are read straight from the mapped file.
+class SceneDescription {
+public:
+	static const uint32_t binaryVersion = 1;
+	static const uint32_t maxImageSize = 16384;			// pixels along either side
+	static const uint32_t maxSamplesPerPixel = 1 << 16;
+	static const uint32_t maxRayBounces = 1024;
+
+	CameraRecord camera;
+	RenderRecord render;
+
+	SceneDescription() {}
+	SceneDescription(const SceneDescription&) = delete;
+	SceneDescription& operator=(const SceneDescription&) = delete;
+	~SceneDescription() { Clear(); }
+
+	void Clear() {
+		MappedFile::Unmap(view, viewSize);
+		view = nullptr;
+		viewSize = 0;
+		file.Close();
+
+		ownedMaterials = std::vector<MaterialRecord>();
+		ownedSpheres = std::vector<SphereRecord>();
+		recordBytes.Set(0);
+		materials = nullptr;
+		spheres = nullptr;
+		materialCount = 0;
+		sphereCount = 0;
+		camera = CameraRecord();
+		render = RenderRecord();
+		loadedFromCache = false;
+	}
+
+	const MaterialRecord* GetMaterials() const { return materials; }
+	const SphereRecord* GetSpheres() const { return spheres; }
+	size_t GetMaterialCount() const { return materialCount; }
+	size_t GetSphereCount() const { return sphereCount; }
+
+	// true when records are read from a mapped binary scene rather than owned
+	bool IsMapped() const { return view != nullptr; }
+
+	const std::string& GetError() const { return error; }
+
+	// building a scene in code
+	uint32_t AddMaterial(const MaterialRecord& material) {
+		ownedMaterials.push_back(material);
+		SyncOwned();
+		return static_cast<uint32_t>(ownedMaterials.size() - 1);
+	}
+
+	void AddSphere(const Point3& center, double radius, uint32_t material) {
+		ownedSpheres.push_back({ { static_cast<float>(center[0]), static_cast<float>(center[1]), static_cast<float>(center[2]) }, static_cast<float>(radius), material });
+		SyncOwned();
+	}
+
+	static MaterialRecord MakeLambertian(const Color& albedo) {
+		return { static_cast<uint32_t>(MaterialType::Lambertian), { ToFloat(albedo[0]), ToFloat(albedo[1]), ToFloat(albedo[2]) }, 0, 0 };
+	}
+
+	static MaterialRecord MakeMetal(const Color& albedo, double fuzz) {
+		return { static_cast<uint32_t>(MaterialType::Metal), { ToFloat(albedo[0]), ToFloat(albedo[1]), ToFloat(albedo[2]) }, ToFloat(fuzz), 0 };
+	}
+
+	static MaterialRecord MakeDielectric(double ior, const Color& absorption = Color(0, 0, 0)) {
+		return { static_cast<uint32_t>(MaterialType::Dielectric), { ToFloat(absorption[0]), ToFloat(absorption[1]), ToFloat(absorption[2]) }, 0, ToFloat(ior) };
+	}
+
+	// loads a text or binary scene, detected from the file contents
+	// a text scene is cached as a binary scene next to it (`<path>.rtsb`) which is used while the text is unchanged
+	// returns function's success
+	bool Load(const char* path, bool useCache = true) {
+		Clear();
+
+		if (IsBinaryFile(path))
+			return LoadBinary(path, 0, 0);
+
+		uint64_t sourceSize = 0;
+		int64_t sourceTime = 0;
+		if (!GetFileStamp(path, sourceSize, sourceTime)) {
+			error = std::string("cannot open ") + path;
+			return false;
+		}
+
+		std::string cachePath = std::string(path) + ".rtsb";
+		if (useCache && IsBinaryFile(cachePath.c_str())) {
+			if (LoadBinary(cachePath.c_str(), sourceSize, sourceTime)) {
+				loadedFromCache = true;
+				return true;
+			}
+			Clear(); // stale or invalid cache, fall back to the text
+		}
+
+		if (!LoadText(path))
+			return false;
+
+		// failing to write the cache is not fatal
+		if (useCache)
+			SaveBinary(cachePath.c_str(), sourceSize, sourceTime);
+		return true;
+	}
+
+	// true if the last Load() was satisfied by the binary cache of a text scene
+	bool WasLoadedFromCache() const { return loadedFromCache; }
+
+	// returns function's success
+	bool SaveBinary(const char* path, uint64_t sourceSize = 0, int64_t sourceTime = 0) const {
+		SceneFileHeader header = {};
+		std::memcpy(header.magic, "RTSCENE", 8);
+		header.version = binaryVersion;
+		header.materialCount = static_cast<uint32_t>(materialCount);
+		header.sphereCount = sphereCount;
+		header.materialOffset = AlignUp(sizeof(SceneFileHeader));
+		header.sphereOffset = AlignUp(header.materialOffset + materialCount * sizeof(MaterialRecord));
+		header.sourceSize = sourceSize;
+		header.sourceTime = sourceTime;
+		header.camera = camera;
+		header.render = render;
+
+		FILE* out = fopen(path, "wb");
+		if (!out)
+			return false;
+
+		static const char padding[alignment] = {};
+		bool ok = fwrite(&header, sizeof(header), 1, out) == 1
+			&& fwrite(padding, 1, header.materialOffset - sizeof(header), out) == header.materialOffset - sizeof(header)
+			&& fwrite(materials, sizeof(MaterialRecord), materialCount, out) == materialCount
+			&& fwrite(padding, 1, header.sphereOffset - header.materialOffset - materialCount * sizeof(MaterialRecord), out)
+				== header.sphereOffset - header.materialOffset - materialCount * sizeof(MaterialRecord)
+			&& fwrite(spheres, sizeof(SphereRecord), sphereCount, out) == sphereCount;
+
+		return fclose(out) == 0 && ok;
+	}
+
+	// returns function's success
+	bool SaveText(const char* path) const {
+		FILE* out = fopen(path, "w");
+		if (!out)
+			return false;
+
+		const CameraRecord& c = camera;
+		fprintf(out, "camera lookfrom %.9g %.9g %.9g lookat %.9g %.9g %.9g vup %.9g %.9g %.9g vfov %.9g defocus %.9g focus %.9g\n",
+			c.lookfrom[0], c.lookfrom[1], c.lookfrom[2], c.lookat[0], c.lookat[1], c.lookat[2],
+			c.vup[0], c.vup[1], c.vup[2], c.vfov, c.defocusAngle, c.focusDist);
+		fprintf(out, "render width %u height %u spp %u bounces %u\n", render.width, render.height, render.samplesPerPixel, render.maxRayBounces);
+
+		for (size_t i = 0; i < materialCount; i++) {
+			const MaterialRecord& m = materials[i];
+			switch (static_cast<MaterialType>(m.type)) {
+				case MaterialType::Lambertian:
+					fprintf(out, "material m%zu lambertian %.9g %.9g %.9g\n", i, m.color[0], m.color[1], m.color[2]);
+					break;
+				case MaterialType::Metal:
+					fprintf(out, "material m%zu metal %.9g %.9g %.9g %.9g\n", i, m.color[0], m.color[1], m.color[2], m.fuzz);
+					break;
+				case MaterialType::Dielectric:
+					fprintf(out, "material m%zu dielectric %.9g %.9g %.9g %.9g\n", i, m.ior, m.color[0], m.color[1], m.color[2]);
+					break;
+			}
+		}
+
+		for (size_t i = 0; i < sphereCount; i++) {
+			const SphereRecord& s = spheres[i];
+			fprintf(out, "sphere %.9g %.9g %.9g %.9g m%u\n", s.center[0], s.center[1], s.center[2], s.radius, s.material);
+		}
+
+		return fclose(out) == 0;
+	}
+
+	// creates the renderable objects described by the scene
+	// primitives are allocated from the arena, which the world's pointers to them keep alive;
+	// they refer to their materials by index, so nothing in the arena holds on to the arena itself
+	void Build(HittableList& world, MaterialTable& materialTable, SceneArena& arena) const {
+		// material IDs in the records are relative to the first material added here
+		uint32_t firstMaterial = static_cast<uint32_t>(materialTable.size());
+		materialTable.reserve(materialTable.size() + materialCount);
+
+		for (size_t i = 0; i < materialCount; i++) {
+			const MaterialRecord& m = materials[i];
+			Color color(m.color[0], m.color[1], m.color[2]);
+
+			switch (static_cast<MaterialType>(m.type)) {
+				case MaterialType::Lambertian: materialTable.add(Lambertian(color)); break;
+				case MaterialType::Metal:      materialTable.add(Metal(color, m.fuzz)); break;
+				case MaterialType::Dielectric: materialTable.add(Dielectric(m.ior, color)); break;
+			}
+		}
+
+		// one contiguous block for every sphere
+		arena.Reserve<Sphere>(sphereCount);
+		world.objects.reserve(world.objects.size() + sphereCount);
+		for (size_t i = 0; i < sphereCount; i++) {
+			const SphereRecord& s = spheres[i];
+			world.add(arena.Make<Sphere>(Point3(s.center[0], s.center[1], s.center[2]), s.radius, firstMaterial + s.material));
+		}
+	}
+
+	// size and modification time of a file, which change whenever its contents do
+	// returns function's success
+	static bool GetFileStamp(const char* path, uint64_t& size, int64_t& time) {
+		std::error_code ec;
+		size = std::filesystem::file_size(path, ec);
+		if (ec)
+			return false;
+		time = static_cast<int64_t>(std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+		return !ec;
+	}
+
+private:
+	static const size_t alignment = 8;
+
+	const MaterialRecord* materials = nullptr;
+	const SphereRecord* spheres = nullptr;
+	size_t materialCount = 0;
+	size_t sphereCount = 0;
+
+	std::vector<MaterialRecord> ownedMaterials;
+	std::vector<SphereRecord> ownedSpheres;
+
+	MappedFile file;
+	uint8_t* view = nullptr;
+	size_t viewSize = 0;
+
+	bool loadedFromCache = false;
+	std::string error;
+	MemoryCounter recordBytes{ MemorySubsystem::SceneFile };
+
+	static float ToFloat(double value) { return static_cast<float>(value); }
+	static uint64_t AlignUp(uint64_t value) { return (value + alignment - 1) / alignment * alignment; }
+
+	void SyncOwned() {
+		materials = ownedMaterials.data();
+		materialCount = ownedMaterials.size();
+		spheres = ownedSpheres.data();
+		sphereCount = ownedSpheres.size();
+		recordBytes.Set(ownedMaterials.capacity() * sizeof(MaterialRecord) + ownedSpheres.capacity() * sizeof(SphereRecord));
+	}
+
+	static bool IsBinaryFile(const char* path) {
+		FILE* in = fopen(path, "rb");
+		if (!in)
+			return false;
+		char magic[8] = {};
+		size_t read = fread(magic, 1, sizeof(magic), in);
+		fclose(in);
+		return read == sizeof(magic) && std::memcmp(magic, "RTSCENE", 8) == 0;
+	}
+
+	// maps a binary scene and validates it, records are not copied
+	// a non-zero sourceSize requires the file to be a cache of that source
+	bool LoadBinary(const char* path, uint64_t sourceSize, int64_t sourceTime) {
+		if (!file.Open(path) || file.GetSize() < sizeof(SceneFileHeader)) {
+			error = std::string("cannot open ") + path;
+			return false;
+		}
+
+		viewSize = static_cast<size_t>(file.GetSize());
+		recordBytes.Set(viewSize);
+		view = file.Map(0, viewSize);
+		if (!view) {
+			error = std::string("cannot map ") + path;
+			return false;
+		}
+
+		SceneFileHeader header;
+		std::memcpy(&header, view, sizeof(header));
+
+		if (header.version != binaryVersion) {
+			error = "unsupported scene file version";
+			return false;
+		}
+		if (sourceSize != 0 && (header.sourceSize != sourceSize || header.sourceTime != sourceTime)) {
+			error = "scene cache is out of date";
+			return false;
+		}
+		// offsets first, so the sizes left after them cannot wrap
+		if (header.materialOffset % alignment != 0 || header.sphereOffset % alignment != 0
+			|| header.materialOffset > viewSize || header.sphereOffset > viewSize
+			|| header.materialCount > (viewSize - header.materialOffset) / sizeof(MaterialRecord)
+			|| header.sphereCount > (viewSize - header.sphereOffset) / sizeof(SphereRecord)) {
+			error = "scene file is truncated or corrupt";
+			return false;
+		}
+
+		materials = reinterpret_cast<const MaterialRecord*>(view + header.materialOffset);
+		spheres = reinterpret_cast<const SphereRecord*>(view + header.sphereOffset);
+		materialCount = header.materialCount;
+		sphereCount = static_cast<size_t>(header.sphereCount);
+		camera = header.camera;
+		render = header.render;
+
+		return Validate();
+	}
+
+	// checks every record can be used safely
+	bool Validate() {
+		// the render settings size the image and the loops over it, so a corrupt file must not make them huge
+		if (render.width > maxImageSize || render.height > maxImageSize) {
+			error = "image size exceeds " + std::to_string(maxImageSize) + " pixels";
+			return false;
+		}
+		if (render.samplesPerPixel > maxSamplesPerPixel || render.maxRayBounces > maxRayBounces) {
+			error = "samples per pixel or bounces exceed " + std::to_string(maxSamplesPerPixel) + " or " + std::to_string(maxRayBounces);
+			return false;
+		}
+
+		for (size_t i = 0; i < materialCount; i++) {
+			if (materials[i].type > static_cast<uint32_t>(MaterialType::Dielectric)) {
+				error = "material " + std::to_string(i) + " has an unknown type";
+				return false;
+			}
+		}
+
+		// a single pass over the spheres, kept branch-light since it is the bulk of a large scene
+		uint32_t badMaterial = 0;
+		bool badRadius = false;
+		for (size_t i = 0; i < sphereCount; i++) {
+			badMaterial |= spheres[i].material >= materialCount;
+			badRadius |= !(spheres[i].radius > 0);
+		}
+
+		if (badMaterial || badRadius) {
+			error = badMaterial ? "sphere references a missing material" : "sphere has a non-positive radius";
+			return false;
+		}
+		return true;
+	}
+
+	// streaming parser over the mapped text, one statement per line
+	bool LoadText(const char* path) {
+		MappedFile source;
+		if (!source.Open(path)) {
+			error = std::string("cannot open ") + path;
+			return false;
+		}
+
+		size_t size = static_cast<size_t>(source.GetSize());
+		uint8_t* text = source.Map(0, size);
+		if (size > 0 && !text) {
+			error = std::string("cannot map ") + path;
+			return false;
+		}
+
+		TextParser parser(reinterpret_cast<const char*>(text), size);
+		bool ok = parser.Parse(*this);
+		if (!ok)
+			error = std::string(path) + ":" + std::to_string(parser.line) + ": " + parser.error;
+
+		MappedFile::Unmap(text, size);
+		SyncOwned();
+		return ok && Validate();
+	}
+
+	struct TextParser {
+		const char* cursor;
+		const char* end;
+		int line = 1;
+		std::string error;
+		std::unordered_map<std::string_view, uint32_t> materialNames;
+
+		TextParser(const char* text, size_t size) : cursor(text), end(text + size) {}
+
+		bool Parse(SceneDescription& scene) {
+			while (cursor < end) {
+				std::string_view keyword = Token();
+
+				if (keyword.empty() || keyword[0] == '#') {
+					// blank line or comment
+				}
+				else if (keyword == "sphere") {
+					SphereRecord s;
+					std::string_view name;
+					if (!Number(s.center[0]) || !Number(s.center[1]) || !Number(s.center[2]) || !Number(s.radius) || (name = Token()).empty())
+						return Fail("expected: sphere <x> <y> <z> <radius> <material>");
+
+					auto found = materialNames.find(name);
+					if (found == materialNames.end())
+						return Fail("unknown material '" + std::string(name) + "'");
+					s.material = found->second;
+					scene.ownedSpheres.push_back(s);
+				}
+				else if (keyword == "material") {
+					if (!ParseMaterial(scene))
+						return false;
+				}
+				else if (keyword == "camera") {
+					if (!ParseCamera(scene.camera))
+						return false;
+				}
+				else if (keyword == "render") {
+					if (!ParseRender(scene.render))
+						return false;
+				}
+				else {
+					return Fail("unknown statement '" + std::string(keyword) + "'");
+				}
+
+				if (!EndOfLine())
+					return Fail("unexpected text at end of line");
+			}
+			return true;
+		}
+
+		bool ParseMaterial(SceneDescription& scene) {
+			std::string_view name = Token();
+			std::string_view type = Token();
+			MaterialRecord m = {};
+
+			if (type == "lambertian") {
+				m.type = static_cast<uint32_t>(MaterialType::Lambertian);
+				if (!Number(m.color[0]) || !Number(m.color[1]) || !Number(m.color[2]))
+					return Fail("expected: material <name> lambertian <r> <g> <b>");
+			}
+			else if (type == "metal") {
+				m.type = static_cast<uint32_t>(MaterialType::Metal);
+				if (!Number(m.color[0]) || !Number(m.color[1]) || !Number(m.color[2]) || !Number(m.fuzz))
+					return Fail("expected: material <name> metal <r> <g> <b> <fuzz>");
+				m.fuzz = std::min(m.fuzz, 1.0f);
+			}
+			else if (type == "dielectric") {
+				m.type = static_cast<uint32_t>(MaterialType::Dielectric);
+				if (!Number(m.ior))
+					return Fail("expected: material <name> dielectric <ior> [<absorption r> <g> <b>]");
+				// absorption is optional
+				if (!AtLineEnd() && (!Number(m.color[0]) || !Number(m.color[1]) || !Number(m.color[2])))
+					return Fail("expected: material <name> dielectric <ior> [<absorption r> <g> <b>]");
+			}
+			else {
+				return Fail("unknown material type '" + std::string(type) + "'");
+			}
+
+			if (name.empty() || !materialNames.emplace(name, static_cast<uint32_t>(scene.ownedMaterials.size())).second)
+				return Fail("material needs a unique name");
+			scene.ownedMaterials.push_back(m);
+			return true;
+		}
+
+		bool ParseCamera(CameraRecord& c) {
+			while (!AtLineEnd()) {
+				std::string_view key = Token();
+				bool ok;
+				if (key == "lookfrom")     ok = Number(c.lookfrom[0]) && Number(c.lookfrom[1]) && Number(c.lookfrom[2]);
+				else if (key == "lookat")  ok = Number(c.lookat[0]) && Number(c.lookat[1]) && Number(c.lookat[2]);
+				else if (key == "vup")     ok = Number(c.vup[0]) && Number(c.vup[1]) && Number(c.vup[2]);
+				else if (key == "vfov")    ok = Number(c.vfov);
+				else if (key == "defocus") ok = Number(c.defocusAngle);
+				else if (key == "focus")   ok = Number(c.focusDist);
+				else return Fail("unknown camera setting '" + std::string(key) + "'");
+
+				if (!ok)
+					return Fail("bad value for camera setting '" + std::string(key) + "'");
+			}
+			return true;
+		}
+
+		bool ParseRender(RenderRecord& r) {
+			while (!AtLineEnd()) {
+				std::string_view key = Token();
+				bool ok;
+				if (key == "width")        ok = Number(r.width);
+				else if (key == "height")  ok = Number(r.height);
+				else if (key == "spp")     ok = Number(r.samplesPerPixel);
+				else if (key == "bounces") ok = Number(r.maxRayBounces);
+				else return Fail("unknown render setting '" + std::string(key) + "'");
+
+				if (!ok)
+					return Fail("bad value for render setting '" + std::string(key) + "'");
+			}
+			return true;
+		}
+
+		bool Fail(const std::string& message) {
+			error = message;
+			return false;
+		}
+
+		void SkipSpaces() {
+			while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r'))
+				cursor++;
+		}
+
+		// true if only whitespace or a comment remains on the line
+		bool AtLineEnd() {
+			SkipSpaces();
+			if (cursor < end && *cursor == '#')
+				while (cursor < end && *cursor != '\n')
+					cursor++;
+
+			return cursor >= end || *cursor == '\n';
+		}
+
+		// consumes the newline if at the end of a statement
+		bool EndOfLine() {
+			if (!AtLineEnd())
+				return false;
+
+			if (cursor < end) {
+				cursor++;
+				line++;
+			}
+			return true;
+		}
+
+		std::string_view Token() {
+			SkipSpaces();
+			const char* start = cursor;
+			if (cursor < end && *cursor == '#') {
+				// swallow comment lines whole
+				while (cursor < end && *cursor != '\n')
+					cursor++;
+				return std::string_view(start, 1);
+			}
+			while (cursor < end && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '\n')
+				cursor++;
+			return std::string_view(start, cursor - start);
+		}
+
+		template <typename T>
+		bool Number(T& value) {
+			SkipSpaces();
+			auto result = std::from_chars(cursor, end, value);
+			if (result.ec != std::errc())
+				return false;
+			cursor = result.ptr;
+			return true;
+		}
+	};
+};
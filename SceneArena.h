@@ -0,0 +1,124 @@
+#pragma once
+
+#include "MemoryStats.h"
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Allocates scene objects contiguously, one pool per type, and frees everything at once.
+// Make returns shared_ptrs that share the arena's single control block,
+// so creating one costs no heap allocation and keeps the arena alive while in use.
+// Objects in the arena must not hold such a pointer themselves: the arena would then keep itself alive and never
+// be freed. They refer to each other with raw pointers from New, or by index as spheres do to their materials.
+class SceneArena : public std::enable_shared_from_this<SceneArena> {
+public:
+	// must be owned by a shared_ptr, e.g. make_shared<SceneArena>()
+	SceneArena() {}
+	SceneArena(const SceneArena&) = delete;
+	SceneArena& operator=(const SceneArena&) = delete;
+
+	// for holders outside the arena
+	template <typename T, typename... Args>
+	std::shared_ptr<T> Make(Args&&... args) {
+		return std::shared_ptr<T>(shared_from_this(), New<T>(std::forward<Args>(args)...));
+	}
+
+	// for references from other objects in the arena, valid as long as the arena is
+	template <typename T, typename... Args>
+	T* New(Args&&... args) {
+		return GetPool<T>().Allocate(std::forward<Args>(args)...);
+	}
+
+	// makes room for `count` more objects of type T in a single block
+	template <typename T>
+	void Reserve(size_t count) {
+		GetPool<T>().Reserve(count);
+	}
+
+	// bytes of object storage in use, and reserved including unused block space
+	size_t GetBytesUsed() const {
+		size_t total = 0;
+		for (auto& pool : pools)
+			total += pool.second->used * pool.second->objectSize;
+		return total;
+	}
+
+	size_t GetBytesReserved() const {
+		size_t total = 0;
+		for (auto& pool : pools)
+			total += pool.second->reserved.Get();
+		return total;
+	}
+
+private:
+	struct PoolBase {
+		size_t objectSize;
+		size_t used = 0;
+		MemoryCounter reserved;
+
+		PoolBase(size_t _objectSize, MemorySubsystem subsystem) : objectSize(_objectSize), reserved(subsystem) {}
+		virtual ~PoolBase() = default;
+	};
+
+	template <typename T>
+	struct Pool : PoolBase {
+		static const size_t minBlockObjects = 256;
+
+		struct Block {
+			T* objects;
+			size_t count;		// constructed objects
+			size_t capacity;
+		};
+		std::vector<Block> blocks;
+
+		Pool() : PoolBase(sizeof(T), MemorySubsystem::Primitives) {}
+
+		~Pool() {
+			// destroy in reverse order of construction
+			for (auto block = blocks.rbegin(); block != blocks.rend(); ++block) {
+				for (size_t i = block->count; i > 0; i--)
+					block->objects[i - 1].~T();
+				::operator delete(block->objects, std::align_val_t(alignof(T)));
+			}
+		}
+
+		void Reserve(size_t count) {
+			if (!blocks.empty() && blocks.back().capacity - blocks.back().count >= count)
+				return;
+			AddBlock(count);
+		}
+
+		template <typename... Args>
+		T* Allocate(Args&&... args) {
+			if (blocks.empty() || blocks.back().count == blocks.back().capacity)
+				AddBlock(std::max(minBlockObjects, used)); // geometric growth
+
+			Block& block = blocks.back();
+			T* object = new (block.objects + block.count) T(std::forward<Args>(args)...);
+			block.count++;
+			used++;
+			return object;
+		}
+
+		void AddBlock(size_t capacity) {
+			void* memory = ::operator new(capacity * sizeof(T), std::align_val_t(alignof(T)));
+			blocks.push_back({ static_cast<T*>(memory), 0, capacity });
+			reserved.Set(reserved.Get() + capacity * sizeof(T));
+		}
+	};
+
+	std::unordered_map<std::type_index, std::unique_ptr<PoolBase>> pools;
+
+	template <typename T>
+	Pool<T>& GetPool() {
+		auto& pool = pools[std::type_index(typeid(T))];
+		if (!pool)
+			pool.reset(new Pool<T>());
+		return static_cast<Pool<T>&>(*pool);
+	}
+};
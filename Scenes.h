@@ -0,0 +1,151 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "Camera.h"
+#include "Scene.h"
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// copies a scene's camera transform and lens settings to a camera
+inline void SetCameraView(Camera& camera, const CameraRecord& view) {
+	camera.lookfrom = Point3(view.lookfrom[0], view.lookfrom[1], view.lookfrom[2]);
+	camera.lookat = Point3(view.lookat[0], view.lookat[1], view.lookat[2]);
+	camera.vup = Vec3(view.vup[0], view.vup[1], view.vup[2]);
+
+	camera.vfov = view.vfov;
+	camera.defocusAngle = view.defocusAngle;
+	camera.focusDist = view.focusDist;
+}
+
+// camera and render settings of the book's final scene
+inline void SetBookView(SceneDescription& scene) {
+	// camera transform
+	scene.camera.lookfrom[0] = 13; scene.camera.lookfrom[1] = 2; scene.camera.lookfrom[2] = 3;
+	scene.camera.lookat[0] = 0; scene.camera.lookat[1] = 0; scene.camera.lookat[2] = 0;
+	scene.camera.vup[0] = 0; scene.camera.vup[1] = 1; scene.camera.vup[2] = 0;
+
+	// lens settings
+	scene.camera.vfov = 20;
+	scene.camera.defocusAngle = 0.6f;
+	scene.camera.focusDist = 10.0f;
+
+	// render settings
+	scene.render.width = 1280;
+	scene.render.height = 720;
+	scene.render.samplesPerPixel = 500;
+	scene.render.maxRayBounces = 50;
+}
+
+// the final scene from the book
+inline void CreateBookScene(SceneDescription& scene) {
+	uint32_t ground_material = scene.AddMaterial(SceneDescription::MakeLambertian(Color(0.5, 0.5, 0.5)));
+	scene.AddSphere(Point3(0, -1000, 0), 1000, ground_material);
+
+	for (int a = -11; a < 11; a++) {
+		for (int b = -11; b < 11; b++) {
+			auto choose_mat = Random01();
+			Point3 center(a + 0.9 * Random01(), 0.2, b + 0.9 * Random01());
+
+			if ((center - Point3(4, 0.2, 0)).length() > 0.9) {
+				MaterialRecord sphere_material;
+
+				if (choose_mat < 0.8) {
+					// diffuse
+					auto albedo = Color::random() * Color::random();
+					sphere_material = SceneDescription::MakeLambertian(albedo);
+				}
+				else if (choose_mat < 0.95) {
+					// metal
+					auto albedo = Color::random(0.5, 1);
+					auto fuzz = RandomRange(0, 0.5);
+					sphere_material = SceneDescription::MakeMetal(albedo, fuzz);
+				}
+				else {
+					// glass
+					sphere_material = SceneDescription::MakeDielectric(1.5, 5 * HSV(Random01(), 1, 1));
+				}
+
+				scene.AddSphere(center, 0.2, scene.AddMaterial(sphere_material));
+			}
+		}
+	}
+
+	uint32_t material1 = scene.AddMaterial(SceneDescription::MakeDielectric(1.5));
+	scene.AddSphere(Point3(0, 1, 0), 1.0, material1);
+
+	uint32_t material2 = scene.AddMaterial(SceneDescription::MakeLambertian(Color(0.4, 0.2, 0.1)));
+	scene.AddSphere(Point3(-4, 1, 0), 1.0, material2);
+
+	uint32_t material3 = scene.AddMaterial(SceneDescription::MakeMetal(Color(0.7, 0.6, 0.5), 0.0));
+	scene.AddSphere(Point3(4, 1, 0), 1.0, material3);
+
+	SetBookView(scene);
+}
+
+// The book's scene grown to about `count` small spheres on a larger jittered grid, with the same mix of
+// materials drawn from a shared palette and the three large spheres in the middle, seen from the book's camera.
+inline void CreateScaledBookScene(SceneDescription& scene, uint32_t count) {
+	// flat enough over the whole grid
+	uint32_t ground_material = scene.AddMaterial(SceneDescription::MakeLambertian(Color(0.5, 0.5, 0.5)));
+	scene.AddSphere(Point3(0, -100000, 0), 100000, ground_material);
+
+	std::vector<uint32_t> palette;
+	for (int i = 0; i < 64; i++) {
+		auto choose_mat = Random01();
+		if (choose_mat < 0.8)
+			palette.push_back(scene.AddMaterial(SceneDescription::MakeLambertian(Color::random() * Color::random())));
+		else if (choose_mat < 0.95)
+			palette.push_back(scene.AddMaterial(SceneDescription::MakeMetal(Color::random(0.5, 1), RandomRange(0, 0.5))));
+		else
+			palette.push_back(scene.AddMaterial(SceneDescription::MakeDielectric(1.5, 5 * HSV(Random01(), 1, 1))));
+	}
+
+	const int side = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count))));
+	uint32_t added = 0;
+	for (int a = -side / 2; a < side - side / 2 && added < count; a++) {
+		for (int b = -side / 2; b < side - side / 2 && added < count; b++) {
+			Point3 center(a + 0.9 * Random01(), 0.2, b + 0.9 * Random01());
+			scene.AddSphere(center, 0.2, palette[static_cast<size_t>(Random01() * palette.size())]);
+			added++;
+		}
+	}
+
+	uint32_t material1 = scene.AddMaterial(SceneDescription::MakeDielectric(1.5));
+	scene.AddSphere(Point3(0, 1, 0), 1.0, material1);
+
+	uint32_t material2 = scene.AddMaterial(SceneDescription::MakeLambertian(Color(0.4, 0.2, 0.1)));
+	scene.AddSphere(Point3(-4, 1, 0), 1.0, material2);
+
+	uint32_t material3 = scene.AddMaterial(SceneDescription::MakeMetal(Color(0.7, 0.6, 0.5), 0.0));
+	scene.AddSphere(Point3(4, 1, 0), 1.0, material3);
+
+	SetBookView(scene);
+}
+
+// A scene used by the render benchmark, created from a fixed random seed so it is the same on every run.
+struct CanonicalScene {
+	std::string name;
+	uint32_t sphereCount;	// 0 for the book's scene
+};
+
+inline const std::vector<CanonicalScene>& GetCanonicalScenes() {
+	static const std::vector<CanonicalScene> scenes = {
+		{ "book", 0 },
+		{ "spheres-1k", 1000 },
+		{ "spheres-10k", 10000 },
+		{ "spheres-100k", 100000 },
+		{ "spheres-1m", 1000000 },
+	};
+	return scenes;
+}
+
+inline void CreateCanonicalScene(const CanonicalScene& canonical, SceneDescription& scene) {
+	SeedRandom(1);
+	if (canonical.sphereCount == 0)
+		CreateBookScene(scene);
+	else
+		CreateScaledBookScene(scene, canonical.sphereCount);
+}
@@ -0,0 +1,488 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "PixelColor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define SIMD_X86 0
+#endif
+
+// Instruction sets with their own build of the hot kernels, in increasing order of width.
+enum class SimdLevel {
+	Scalar,		// portable C++, always available
+	SSE4,		// SSE4.1, 4 floats / 2 doubles
+	AVX2,		// AVX2 + FMA, 8 floats / 4 doubles
+	AVX512,		// AVX-512F, 16 floats / 8 doubles
+	Count
+};
+
+inline const char* GetSimdName(SimdLevel level) {
+	static const char* names[] = { "scalar", "sse4", "avx2", "avx512" };
+	return names[static_cast<int>(level)];
+}
+
+// returns false if the name is not one of GetSimdName's
+inline bool ParseSimdLevel(const char* name, SimdLevel& level) {
+	for (int i = 0; i < static_cast<int>(SimdLevel::Count); i++) {
+		if (strcmp(name, GetSimdName(static_cast<SimdLevel>(i))) == 0) {
+			level = static_cast<SimdLevel>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+// widest instruction set supported by both the CPU and the operating system
+inline SimdLevel DetectSimdLevel() {
+#if SIMD_X86
+	auto cpuid = [](int leaf, int subleaf, unsigned int regs[4]) {
+#if defined(_MSC_VER)
+		__cpuidex(reinterpret_cast<int*>(regs), leaf, subleaf);
+#else
+		__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+	};
+
+	unsigned int regs[4];
+	cpuid(0, 0, regs);
+	unsigned int maxLeaf = regs[0];
+
+	cpuid(1, 0, regs);
+	bool sse41 = (regs[2] >> 19) & 1;
+	bool fma = (regs[2] >> 12) & 1;
+	bool osxsave = (regs[2] >> 27) & 1;
+	bool avx = (regs[2] >> 28) & 1;
+
+	if (!sse41)
+		return SimdLevel::Scalar;
+	if (!osxsave || !avx || maxLeaf < 7)
+		return SimdLevel::SSE4;
+
+	// the OS must save the wider registers on context switches
+#if defined(_MSC_VER)
+	uint64_t xcr0 = _xgetbv(0);
+#else
+	unsigned int xcr0Low, xcr0High;
+	__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+	uint64_t xcr0 = (static_cast<uint64_t>(xcr0High) << 32) | xcr0Low;
+#endif
+
+	cpuid(7, 0, regs);
+	bool avx2 = (regs[1] >> 5) & 1;
+	bool avx512f = (regs[1] >> 16) & 1;
+
+	if (avx512f && fma && (xcr0 & 0xE6) == 0xE6)
+		return SimdLevel::AVX512;
+	if (avx2 && fma && (xcr0 & 0x6) == 0x6)
+		return SimdLevel::AVX2;
+	return SimdLevel::SSE4;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+// Sphere centres and squared radii in structure-of-arrays form for the intersection kernels.
+// Padded to a multiple of the widest vector with spheres that can never be hit.
+template <typename T>
+struct SphereLanes {
+	static const size_t padding = 16;
+
+	std::vector<T> centerX, centerY, centerZ, radiusSquared;
+	size_t count = 0;
+
+	void Clear() {
+		centerX.clear();
+		centerY.clear();
+		centerZ.clear();
+		radiusSquared.clear();
+		count = 0;
+	}
+
+	void Add(const Vec3T<T>& center, T radius) {
+		// insert before the padding
+		centerX.resize(count);
+		centerY.resize(count);
+		centerZ.resize(count);
+		radiusSquared.resize(count);
+
+		centerX.push_back(center.e[0]);
+		centerY.push_back(center.e[1]);
+		centerZ.push_back(center.e[2]);
+		radiusSquared.push_back(radius * radius);
+		count++;
+
+		// a negative squared radius makes the discriminant negative
+		size_t padded = (count + padding - 1) / padding * padding;
+		centerX.resize(padded, 0);
+		centerY.resize(padded, 0);
+		centerZ.resize(padded, 0);
+		radiusSquared.resize(padded, -1);
+	}
+
+	size_t GetPaddedCount() const { return radiusSquared.size(); }
+
+	size_t GetBytes() const { return radiusSquared.capacity() * sizeof(T) * 4; }
+};
+
+// One instruction set's build of the hot kernels.
+struct SimdKernels {
+	SimdLevel level;
+
+	// index of the closest sphere hit in (tMin, tMax), or -1; tMax is lowered to its distance
+	int64_t (*closestSphereFloat)(const SphereLanes<float>& spheres, const Rayf& r, float tMin, float& tMax);
+	int64_t (*closestSphereDouble)(const SphereLanes<double>& spheres, const Ray& r, double tMin, double& tMax);
+
+	// exposes, tonemaps, encodes and quantizes one colour channel of a span
+	// curve is the rational tonemapper x(ax + b) / (x(cx + d) + e), or null to only clamp
+	void (*resolveChannel)(const float* in, const float* offset, int n, float exposure, const float* curve,
+		const float* lut, int lutSize, int channel, PixelColor* out);
+
+	int64_t ClosestSphere(const SphereLanes<float>& spheres, const Rayf& r, float tMin, float& tMax) const {
+		return closestSphereFloat(spheres, r, tMin, tMax);
+	}
+
+	int64_t ClosestSphere(const SphereLanes<double>& spheres, const Ray& r, double tMin, double& tMax) const {
+		return closestSphereDouble(spheres, r, tMin, tMax);
+	}
+};
+
+// Each namespace below defines FloatLanes and DoubleLanes for one instruction set
+// then includes SimdKernels.h, so the kernels are compiled once per instruction set.
+// Lane operations are members rather than friends, as GCC does not apply the target pragma to friend definitions.
+
+namespace SimdScalar {
+	template <typename T>
+	struct ScalarLanes {
+		using Scalar = T;
+		struct Mask {
+			bool m;
+			Mask operator&(Mask b) const { return { m && b.m }; }
+		};
+		static const int width = 1;
+
+		T v;
+
+		static ScalarLanes Load(const T* p) { return { *p }; }
+		static ScalarLanes Set(T x) { return { x }; }
+		void Store(T* p) const { *p = v; }
+
+		ScalarLanes operator+(ScalarLanes b) const { return { v + b.v }; }
+		ScalarLanes operator-(ScalarLanes b) const { return { v - b.v }; }
+		ScalarLanes operator*(ScalarLanes b) const { return { v * b.v }; }
+		ScalarLanes operator/(ScalarLanes b) const { return { v / b.v }; }
+		Mask operator<(ScalarLanes b) const { return { v < b.v }; }
+		Mask operator>(ScalarLanes b) const { return { v > b.v }; }
+		Mask operator>=(ScalarLanes b) const { return { v >= b.v }; }
+
+		// same operand order and NaN behaviour as the SSE/AVX min and max
+		static ScalarLanes Min(ScalarLanes a, ScalarLanes b) { return { a.v < b.v ? a.v : b.v }; }
+		static ScalarLanes Max(ScalarLanes a, ScalarLanes b) { return { a.v > b.v ? a.v : b.v }; }
+		static ScalarLanes Sqrt(ScalarLanes a) { return { std::sqrt(a.v) }; }
+		static ScalarLanes CopySign(ScalarLanes magnitude, ScalarLanes sign) { return { std::copysign(magnitude.v, sign.v) }; }
+		static ScalarLanes Select(Mask m, ScalarLanes a, ScalarLanes b) { return m.m ? a : b; }
+		static bool Any(Mask m) { return m.m; }
+		static int Bits(Mask m) { return m.m ? 1 : 0; }
+	};
+
+	using FloatLanes = ScalarLanes<float>;
+	using DoubleLanes = ScalarLanes<double>;
+
+#include "SimdKernels.h"
+}
+
+#if SIMD_X86
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.1"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#endif
+
+namespace SimdSSE4 {
+	struct FloatLanes {
+		using Scalar = float;
+		struct Mask {
+			__m128 m;
+			Mask operator&(Mask b) const { return { _mm_and_ps(m, b.m) }; }
+		};
+		static const int width = 4;
+
+		__m128 v;
+
+		static FloatLanes Load(const float* p) { return { _mm_loadu_ps(p) }; }
+		static FloatLanes Set(float x) { return { _mm_set1_ps(x) }; }
+		void Store(float* p) const { _mm_storeu_ps(p, v); }
+
+		FloatLanes operator+(FloatLanes b) const { return { _mm_add_ps(v, b.v) }; }
+		FloatLanes operator-(FloatLanes b) const { return { _mm_sub_ps(v, b.v) }; }
+		FloatLanes operator*(FloatLanes b) const { return { _mm_mul_ps(v, b.v) }; }
+		FloatLanes operator/(FloatLanes b) const { return { _mm_div_ps(v, b.v) }; }
+		Mask operator<(FloatLanes b) const { return { _mm_cmplt_ps(v, b.v) }; }
+		Mask operator>(FloatLanes b) const { return { _mm_cmpgt_ps(v, b.v) }; }
+		Mask operator>=(FloatLanes b) const { return { _mm_cmpge_ps(v, b.v) }; }
+
+		static FloatLanes Min(FloatLanes a, FloatLanes b) { return { _mm_min_ps(a.v, b.v) }; }
+		static FloatLanes Max(FloatLanes a, FloatLanes b) { return { _mm_max_ps(a.v, b.v) }; }
+		static FloatLanes Sqrt(FloatLanes a) { return { _mm_sqrt_ps(a.v) }; }
+		static FloatLanes CopySign(FloatLanes magnitude, FloatLanes sign) {
+			const __m128 signBit = _mm_set1_ps(-0.0f);
+			return { _mm_or_ps(_mm_andnot_ps(signBit, magnitude.v), _mm_and_ps(signBit, sign.v)) };
+		}
+		static FloatLanes Select(Mask m, FloatLanes a, FloatLanes b) { return { _mm_blendv_ps(b.v, a.v, m.m) }; }
+		static bool Any(Mask m) { return _mm_movemask_ps(m.m) != 0; }
+		static int Bits(Mask m) { return _mm_movemask_ps(m.m); }
+	};
+
+	struct DoubleLanes {
+		using Scalar = double;
+		struct Mask {
+			__m128d m;
+			Mask operator&(Mask b) const { return { _mm_and_pd(m, b.m) }; }
+		};
+		static const int width = 2;
+
+		__m128d v;
+
+		static DoubleLanes Load(const double* p) { return { _mm_loadu_pd(p) }; }
+		static DoubleLanes Set(double x) { return { _mm_set1_pd(x) }; }
+		void Store(double* p) const { _mm_storeu_pd(p, v); }
+
+		DoubleLanes operator+(DoubleLanes b) const { return { _mm_add_pd(v, b.v) }; }
+		DoubleLanes operator-(DoubleLanes b) const { return { _mm_sub_pd(v, b.v) }; }
+		DoubleLanes operator*(DoubleLanes b) const { return { _mm_mul_pd(v, b.v) }; }
+		DoubleLanes operator/(DoubleLanes b) const { return { _mm_div_pd(v, b.v) }; }
+		Mask operator<(DoubleLanes b) const { return { _mm_cmplt_pd(v, b.v) }; }
+		Mask operator>(DoubleLanes b) const { return { _mm_cmpgt_pd(v, b.v) }; }
+		Mask operator>=(DoubleLanes b) const { return { _mm_cmpge_pd(v, b.v) }; }
+
+		static DoubleLanes Min(DoubleLanes a, DoubleLanes b) { return { _mm_min_pd(a.v, b.v) }; }
+		static DoubleLanes Max(DoubleLanes a, DoubleLanes b) { return { _mm_max_pd(a.v, b.v) }; }
+		static DoubleLanes Sqrt(DoubleLanes a) { return { _mm_sqrt_pd(a.v) }; }
+		static DoubleLanes CopySign(DoubleLanes magnitude, DoubleLanes sign) {
+			const __m128d signBit = _mm_set1_pd(-0.0);
+			return { _mm_or_pd(_mm_andnot_pd(signBit, magnitude.v), _mm_and_pd(signBit, sign.v)) };
+		}
+		static DoubleLanes Select(Mask m, DoubleLanes a, DoubleLanes b) { return { _mm_blendv_pd(b.v, a.v, m.m) }; }
+		static bool Any(Mask m) { return _mm_movemask_pd(m.m) != 0; }
+		static int Bits(Mask m) { return _mm_movemask_pd(m.m); }
+	};
+
+#include "SimdKernels.h"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+namespace SimdAVX2 {
+	struct FloatLanes {
+		using Scalar = float;
+		struct Mask {
+			__m256 m;
+			Mask operator&(Mask b) const { return { _mm256_and_ps(m, b.m) }; }
+		};
+		static const int width = 8;
+
+		__m256 v;
+
+		static FloatLanes Load(const float* p) { return { _mm256_loadu_ps(p) }; }
+		static FloatLanes Set(float x) { return { _mm256_set1_ps(x) }; }
+		void Store(float* p) const { _mm256_storeu_ps(p, v); }
+
+		FloatLanes operator+(FloatLanes b) const { return { _mm256_add_ps(v, b.v) }; }
+		FloatLanes operator-(FloatLanes b) const { return { _mm256_sub_ps(v, b.v) }; }
+		FloatLanes operator*(FloatLanes b) const { return { _mm256_mul_ps(v, b.v) }; }
+		FloatLanes operator/(FloatLanes b) const { return { _mm256_div_ps(v, b.v) }; }
+		Mask operator<(FloatLanes b) const { return { _mm256_cmp_ps(v, b.v, _CMP_LT_OQ) }; }
+		Mask operator>(FloatLanes b) const { return { _mm256_cmp_ps(v, b.v, _CMP_GT_OQ) }; }
+		Mask operator>=(FloatLanes b) const { return { _mm256_cmp_ps(v, b.v, _CMP_GE_OQ) }; }
+
+		static FloatLanes Min(FloatLanes a, FloatLanes b) { return { _mm256_min_ps(a.v, b.v) }; }
+		static FloatLanes Max(FloatLanes a, FloatLanes b) { return { _mm256_max_ps(a.v, b.v) }; }
+		static FloatLanes Sqrt(FloatLanes a) { return { _mm256_sqrt_ps(a.v) }; }
+		static FloatLanes CopySign(FloatLanes magnitude, FloatLanes sign) {
+			const __m256 signBit = _mm256_set1_ps(-0.0f);
+			return { _mm256_or_ps(_mm256_andnot_ps(signBit, magnitude.v), _mm256_and_ps(signBit, sign.v)) };
+		}
+		static FloatLanes Select(Mask m, FloatLanes a, FloatLanes b) { return { _mm256_blendv_ps(b.v, a.v, m.m) }; }
+		static bool Any(Mask m) { return _mm256_movemask_ps(m.m) != 0; }
+		static int Bits(Mask m) { return _mm256_movemask_ps(m.m); }
+	};
+
+	struct DoubleLanes {
+		using Scalar = double;
+		struct Mask {
+			__m256d m;
+			Mask operator&(Mask b) const { return { _mm256_and_pd(m, b.m) }; }
+		};
+		static const int width = 4;
+
+		__m256d v;
+
+		static DoubleLanes Load(const double* p) { return { _mm256_loadu_pd(p) }; }
+		static DoubleLanes Set(double x) { return { _mm256_set1_pd(x) }; }
+		void Store(double* p) const { _mm256_storeu_pd(p, v); }
+
+		DoubleLanes operator+(DoubleLanes b) const { return { _mm256_add_pd(v, b.v) }; }
+		DoubleLanes operator-(DoubleLanes b) const { return { _mm256_sub_pd(v, b.v) }; }
+		DoubleLanes operator*(DoubleLanes b) const { return { _mm256_mul_pd(v, b.v) }; }
+		DoubleLanes operator/(DoubleLanes b) const { return { _mm256_div_pd(v, b.v) }; }
+		Mask operator<(DoubleLanes b) const { return { _mm256_cmp_pd(v, b.v, _CMP_LT_OQ) }; }
+		Mask operator>(DoubleLanes b) const { return { _mm256_cmp_pd(v, b.v, _CMP_GT_OQ) }; }
+		Mask operator>=(DoubleLanes b) const { return { _mm256_cmp_pd(v, b.v, _CMP_GE_OQ) }; }
+
+		static DoubleLanes Min(DoubleLanes a, DoubleLanes b) { return { _mm256_min_pd(a.v, b.v) }; }
+		static DoubleLanes Max(DoubleLanes a, DoubleLanes b) { return { _mm256_max_pd(a.v, b.v) }; }
+		static DoubleLanes Sqrt(DoubleLanes a) { return { _mm256_sqrt_pd(a.v) }; }
+		static DoubleLanes CopySign(DoubleLanes magnitude, DoubleLanes sign) {
+			const __m256d signBit = _mm256_set1_pd(-0.0);
+			return { _mm256_or_pd(_mm256_andnot_pd(signBit, magnitude.v), _mm256_and_pd(signBit, sign.v)) };
+		}
+		static DoubleLanes Select(Mask m, DoubleLanes a, DoubleLanes b) { return { _mm256_blendv_pd(b.v, a.v, m.m) }; }
+		static bool Any(Mask m) { return _mm256_movemask_pd(m.m) != 0; }
+		static int Bits(Mask m) { return _mm256_movemask_pd(m.m); }
+	};
+
+#include "SimdKernels.h"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push(__attribute__((target("avx512f,avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2,fma")
+#endif
+
+namespace SimdAVX512 {
+	// comparisons produce bit masks, and bitwise float operations go through the integer unit as they need AVX-512DQ otherwise
+	struct FloatLanes {
+		using Scalar = float;
+		struct Mask {
+			__mmask16 m;
+			Mask operator&(Mask b) const { return { static_cast<__mmask16>(m & b.m) }; }
+		};
+		static const int width = 16;
+
+		__m512 v;
+
+		static FloatLanes Load(const float* p) { return { _mm512_loadu_ps(p) }; }
+		static FloatLanes Set(float x) { return { _mm512_set1_ps(x) }; }
+		void Store(float* p) const { _mm512_storeu_ps(p, v); }
+
+		FloatLanes operator+(FloatLanes b) const { return { _mm512_add_ps(v, b.v) }; }
+		FloatLanes operator-(FloatLanes b) const { return { _mm512_sub_ps(v, b.v) }; }
+		FloatLanes operator*(FloatLanes b) const { return { _mm512_mul_ps(v, b.v) }; }
+		FloatLanes operator/(FloatLanes b) const { return { _mm512_div_ps(v, b.v) }; }
+		Mask operator<(FloatLanes b) const { return { _mm512_cmp_ps_mask(v, b.v, _CMP_LT_OQ) }; }
+		Mask operator>(FloatLanes b) const { return { _mm512_cmp_ps_mask(v, b.v, _CMP_GT_OQ) }; }
+		Mask operator>=(FloatLanes b) const { return { _mm512_cmp_ps_mask(v, b.v, _CMP_GE_OQ) }; }
+
+		static FloatLanes Min(FloatLanes a, FloatLanes b) { return { _mm512_min_ps(a.v, b.v) }; }
+		static FloatLanes Max(FloatLanes a, FloatLanes b) { return { _mm512_max_ps(a.v, b.v) }; }
+		static FloatLanes Sqrt(FloatLanes a) { return { _mm512_sqrt_ps(a.v) }; }
+		static FloatLanes CopySign(FloatLanes magnitude, FloatLanes sign) {
+			const __m512i signBit = _mm512_set1_epi32(static_cast<int>(0x80000000u));
+			__m512i bits = _mm512_or_si512(_mm512_andnot_si512(signBit, _mm512_castps_si512(magnitude.v)), _mm512_and_si512(signBit, _mm512_castps_si512(sign.v)));
+			return { _mm512_castsi512_ps(bits) };
+		}
+		static FloatLanes Select(Mask m, FloatLanes a, FloatLanes b) { return { _mm512_mask_blend_ps(m.m, b.v, a.v) }; }
+		static bool Any(Mask m) { return m.m != 0; }
+		static int Bits(Mask m) { return m.m; }
+	};
+
+	struct DoubleLanes {
+		using Scalar = double;
+		struct Mask {
+			__mmask8 m;
+			Mask operator&(Mask b) const { return { static_cast<__mmask8>(m & b.m) }; }
+		};
+		static const int width = 8;
+
+		__m512d v;
+
+		static DoubleLanes Load(const double* p) { return { _mm512_loadu_pd(p) }; }
+		static DoubleLanes Set(double x) { return { _mm512_set1_pd(x) }; }
+		void Store(double* p) const { _mm512_storeu_pd(p, v); }
+
+		DoubleLanes operator+(DoubleLanes b) const { return { _mm512_add_pd(v, b.v) }; }
+		DoubleLanes operator-(DoubleLanes b) const { return { _mm512_sub_pd(v, b.v) }; }
+		DoubleLanes operator*(DoubleLanes b) const { return { _mm512_mul_pd(v, b.v) }; }
+		DoubleLanes operator/(DoubleLanes b) const { return { _mm512_div_pd(v, b.v) }; }
+		Mask operator<(DoubleLanes b) const { return { _mm512_cmp_pd_mask(v, b.v, _CMP_LT_OQ) }; }
+		Mask operator>(DoubleLanes b) const { return { _mm512_cmp_pd_mask(v, b.v, _CMP_GT_OQ) }; }
+		Mask operator>=(DoubleLanes b) const { return { _mm512_cmp_pd_mask(v, b.v, _CMP_GE_OQ) }; }
+
+		static DoubleLanes Min(DoubleLanes a, DoubleLanes b) { return { _mm512_min_pd(a.v, b.v) }; }
+		static DoubleLanes Max(DoubleLanes a, DoubleLanes b) { return { _mm512_max_pd(a.v, b.v) }; }
+		static DoubleLanes Sqrt(DoubleLanes a) { return { _mm512_sqrt_pd(a.v) }; }
+		static DoubleLanes CopySign(DoubleLanes magnitude, DoubleLanes sign) {
+			const __m512i signBit = _mm512_set1_epi64(static_cast<long long>(0x8000000000000000ull));
+			__m512i bits = _mm512_or_si512(_mm512_andnot_si512(signBit, _mm512_castpd_si512(magnitude.v)), _mm512_and_si512(signBit, _mm512_castpd_si512(sign.v)));
+			return { _mm512_castsi512_pd(bits) };
+		}
+		static DoubleLanes Select(Mask m, DoubleLanes a, DoubleLanes b) { return { _mm512_mask_blend_pd(m.m, b.v, a.v) }; }
+		static bool Any(Mask m) { return m.m != 0; }
+		static int Bits(Mask m) { return m.m; }
+	};
+
+#include "SimdKernels.h"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif // SIMD_X86
+
+// Highest instruction set the kernels may use, lowered by SetSimdLevel for testing or comparison.
+inline SimdLevel& SimdLevelLimit() {
+	static SimdLevel limit = SimdLevel::AVX512;
+	return limit;
+}
+
+// requests a lower instruction set than the CPU supports, returns the level actually used
+inline SimdLevel SetSimdLevel(SimdLevel level) {
+	SimdLevelLimit() = level;
+	return std::min(level, DetectSimdLevel());
+}
+
+// kernels for the widest instruction set that is both supported and allowed
+inline const SimdKernels& GetSimdKernels() {
+	static const SimdKernels table[] = {
+		{ SimdLevel::Scalar, SimdScalar::ClosestSphereFloat, SimdScalar::ClosestSphereDouble, SimdScalar::ResolveChannel },
+#if SIMD_X86
+		{ SimdLevel::SSE4, SimdSSE4::ClosestSphereFloat, SimdSSE4::ClosestSphereDouble, SimdSSE4::ResolveChannel },
+		{ SimdLevel::AVX2, SimdAVX2::ClosestSphereFloat, SimdAVX2::ClosestSphereDouble, SimdAVX2::ResolveChannel },
+		{ SimdLevel::AVX512, SimdAVX512::ClosestSphereFloat, SimdAVX512::ClosestSphereDouble, SimdAVX512::ResolveChannel },
+#endif
+	};
+	static const SimdLevel detected = DetectSimdLevel();
+
+	SimdLevel level = std::min(detected, SimdLevelLimit());
+	return table[static_cast<int>(level)];
+}
@@ -0,0 +1,105 @@
+// Kernels shared by every instruction set.
+// No include guard: Simd.h includes this once per instruction set, inside a namespace
+// that defines FloatLanes and DoubleLanes, with that instruction set's target options in effect.
+
+// Same maths as SphereT::Intersect, applied to V::width spheres at a time.
+template <typename V>
+inline int64_t ClosestSphere(const SphereLanes<typename V::Scalar>& spheres, const RayT<typename V::Scalar>& r, typename V::Scalar tMin, typename V::Scalar& tMax) {
+	using T = typename V::Scalar;
+
+	const V ox = V::Set(r.origin.e[0]), oy = V::Set(r.origin.e[1]), oz = V::Set(r.origin.e[2]);
+	const V dx = V::Set(r.direction.e[0]), dy = V::Set(r.direction.e[1]), dz = V::Set(r.direction.e[2]);
+	const V a = V::Set(r.direction.lengthSquared());
+	const V zero = V::Set(0);
+	const V lower = V::Set(tMin);
+	const V never = V::Set(std::numeric_limits<T>::infinity());
+	V upper = V::Set(tMax);
+
+	int64_t closest = -1;
+	T distances[V::width];
+
+	const size_t count = spheres.GetPaddedCount();
+	for (size_t i = 0; i < count; i += V::width) {
+		V ocx = ox - V::Load(spheres.centerX.data() + i);
+		V ocy = oy - V::Load(spheres.centerY.data() + i);
+		V ocz = oz - V::Load(spheres.centerZ.data() + i);
+		V radiusSquared = V::Load(spheres.radiusSquared.data() + i);
+
+		V halfB = ocx * dx + ocy * dy + ocz * dz;
+		V k = halfB / a;
+		V lx = ocx - k * dx;
+		V ly = ocy - k * dy;
+		V lz = ocz - k * dz;
+		V discriminant = a * (radiusSquared - (lx * lx + ly * ly + lz * lz));
+
+		auto hit = discriminant >= zero;
+		if (!V::Any(hit))
+			continue;
+
+		V q = zero - (halfB + V::CopySign(V::Sqrt(V::Max(discriminant, zero)), halfB));
+		V c = (ocx * ocx + ocy * ocy + ocz * ocz) - radiusSquared;
+		V root0 = c / q;
+		V root1 = q / a;
+		V nearRoot = V::Min(root0, root1);
+		V farRoot = V::Max(root0, root1);
+
+		// nearest root strictly inside (tMin, tMax)
+		V t = V::Select((nearRoot > lower) & (nearRoot < upper), nearRoot, V::Select((farRoot > lower) & (farRoot < upper), farRoot, never));
+		int closer = V::Bits(hit & (t < upper));
+		if (closer == 0)
+			continue;
+
+		// rare: at least one lane is closer than the best so far, pick the first closest in order
+		t.Store(distances);
+		for (int lane = 0; lane < V::width; lane++) {
+			if (((closer >> lane) & 1) && distances[lane] < tMax) {
+				tMax = distances[lane];
+				closest = static_cast<int64_t>(i) + lane;
+			}
+		}
+		upper = V::Set(tMax);
+	}
+
+	return closest;
+}
+
+inline int64_t ClosestSphereFloat(const SphereLanes<float>& spheres, const Rayf& r, float tMin, float& tMax) {
+	return ClosestSphere<FloatLanes>(spheres, r, tMin, tMax);
+}
+
+inline int64_t ClosestSphereDouble(const SphereLanes<double>& spheres, const Ray& r, double tMin, double& tMax) {
+	return ClosestSphere<DoubleLanes>(spheres, r, tMin, tMax);
+}
+
+// plain loops, vectorized by the compiler for the enclosing target
+template <bool Tonemap>
+inline void ResolveChannelLoop(const float* in, const float* offset, int n, float exposure, const float* curve,
+	const float* lut, int lutSize, int channel, PixelColor* out) {
+	const float a = Tonemap ? curve[0] : 0, b = Tonemap ? curve[1] : 0, c = Tonemap ? curve[2] : 0;
+	const float d = Tonemap ? curve[3] : 0, e = Tonemap ? curve[4] : 0;
+
+	for (int i = 0; i < n; i++) {
+		float x = in[i] * exposure;
+		if (Tonemap)
+			x = (x * (a * x + b)) / (x * (c * x + d) + e);
+
+		// clamp color gammut, also catches negative and NaN input
+		x = std::min(std::max(0.0f, x), 1.0f);
+
+		// piecewise linear interpolation of the transfer curve
+		float position = x * lutSize;
+		int index = std::min(static_cast<int>(position), lutSize - 1);
+		float t = position - index;
+		x = lut[index] + (lut[index + 1] - lut[index]) * t;
+
+		out[i].rgba[channel] = static_cast<uint8_t>(std::min(x + offset[i], 255.0f));
+	}
+}
+
+inline void ResolveChannel(const float* in, const float* offset, int n, float exposure, const float* curve,
+	const float* lut, int lutSize, int channel, PixelColor* out) {
+	if (curve)
+		ResolveChannelLoop<true>(in, offset, n, exposure, curve, lut, lutSize, channel, out);
+	else
+		ResolveChannelLoop<false>(in, offset, n, exposure, curve, lut, lutSize, channel, out);
+}
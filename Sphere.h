@@ -1,46 +1,84 @@
 #pragma once
 
 #include "Hittable.h"
+#include "RenderStats.h"
 #include "Vec3.h"
 
-class Sphere : public Hittable {
+#include <cmath>
+#include <utility>
+
+template <typename T>
+class SphereT final : public HittableT<T> {
 public:
-	Sphere(Point3 _center, double _radius, shared_ptr<Material> _material) 
-		: center(_center), radius(_radius), mat(_material) {}
+	// the same sphere in another precision
+	template <typename U>
+	using Rebind = SphereT<U>;
+
+	SphereT(Vec3T<T> _center, T _radius, uint32_t _materialId) 
+		: center(_center), radius(_radius), materialId(_materialId) {}
+
+	template <typename U>
+	explicit SphereT(const SphereT<U>& other)
+		: center(other.center), radius(static_cast<T>(other.radius)), materialId(other.materialId) {}
 
-	bool Hit(const Ray& r, Interval rayLengthLimits, HitPoint& record) const override {
-		Vec3 oc = r.origin - center;
-		double a = r.direction.lengthSquared();
-		double half_b = dot(oc, r.direction);
-		double c = dot(oc, oc) - radius * radius;
+	const Vec3T<T>& GetCenter() const { return center; }
+	T GetRadius() const { return radius; }
 
-		double discriminant = half_b * half_b - a * c;
+	bool Intersect(const RayT<T>& r, IntervalT<T> rayLengthLimits, RayHitT<T>& hit) const override {
+		RENDER_STAT(intersectionTests++);
+		Vec3T<T> oc = r.origin - center;
+		T a = r.direction.lengthSquared();
+		T half_b = dot(oc, r.direction);
+
+		// half_b^2 - a*c rewritten with the distance of the centre from the ray's line,
+		// which does not cancel catastrophically for large or distant spheres
+		Vec3T<T> l = oc - (half_b / a) * r.direction;
+		T discriminant = a * (radius * radius - l.lengthSquared());
 		if (discriminant < 0) {
 			return false;
 		}
-		double sqrtd = sqrt(discriminant);
+		T sqrtd = sqrt(discriminant);
+
+		// roots from the numerically stable quadratic formula
+		T q = -(half_b + std::copysign(sqrtd, half_b));
+		T c = oc.lengthSquared() - radius * radius;
+		T root0 = c / q;
+		T root1 = q / a;
+		if (root0 > root1)
+			std::swap(root0, root1);
 
 		// Find the nearest root that lies in the acceptable range.
-		double root = (-half_b - sqrtd) / a;
+		T root = root0;
 		if (!rayLengthLimits.surrounds(root)) {
 			// check second root
-			root = (-half_b + sqrtd) / a; 
+			root = root1;
 			if (!rayLengthLimits.surrounds(root)) {
 				return false;
 			}
 		}
 
-		record.t = root;
+		hit.t = root;
+		hit.primitive = this;
+		RENDER_STAT(primitiveHits++);
+		return true;
+	}
+
+	void Finalize(const RayT<T>& r, const RayHitT<T>& hit, HitPointT<T>& record) const override {
+		record.t = hit.t;
 		record.position = r.at(record.t);
-		Vec3 outward_normal = (record.position - center) / radius;
+		Vec3T<T> outward_normal = (record.position - center) / radius;
 		record.set_face_normal(r, outward_normal);
-		record.mat = mat;
-
-		return true;
+		record.materialId = materialId;
 	}
 
 private:
-	Point3 center;
-	double radius;
-	shared_ptr<Material> mat;
-};
\ No newline at end of file
+	template <typename U>
+	friend class SphereT;
+
+	Vec3T<T> center;
+	T radius;
+	uint32_t materialId;
+};
+
+using Sphere = SphereT<double>;
+using Spheref = SphereT<float>;
\ No newline at end of file
@@ -1,21 +1,39 @@
 #pragma once
 
 #include "PixelColor.h"
+#include "ImageSink.h"
+#include "MemoryStats.h"
+
+#include <cstring>
 
 #include "stb_image_write.h"
 #define STBI_DISABLE_PNG_COMPRESSION stbi_write_png_compression_level = 0;
 
-class Texture {
+class Texture : public ImageSink {
 public:
 
-	Texture(int x, int y) : resolutionX(x), resolutionY(y), buffer(new PixelColor[x * y]) { }
+	Texture(int x, int y) : resolutionX(x), resolutionY(y), buffer(new PixelColor[static_cast<size_t>(x) * y]) {
+		bufferBytes.Set(sizeof(PixelColor) * static_cast<size_t>(x) * y);
+	}
 	~Texture() { delete[] buffer; }
 
 	void SetPixel(const int coordX, const int coordY, const PixelColor& color)
 	{
-		buffer[coordX + coordY * resolutionX] = color;
+		buffer[coordX + static_cast<size_t>(coordY) * resolutionX] = color;
 	}
 
+	bool Begin(int width, int height) override {
+		return width == resolutionX && height == resolutionY;
+	}
+
+	bool WriteRow(int y, const PixelColor* row) override {
+		// rows are independent so no ordering is required
+		std::memcpy(buffer + static_cast<size_t>(y) * resolutionX, row, resolutionX * sizeof(PixelColor));
+		return true;
+	}
+
+	bool End() override { return true; }
+
 	// returns function's success
 	bool SaveToFile(char const* filename)
 	{
@@ -29,6 +47,8 @@ public:
 		return true;
 	}
 
+	const PixelColor* GetPixels() const { return buffer; }
+
 	int GetResolutionX() { return resolutionX; }
 	int GetResolutionY() { return resolutionY; }
 	double GetAspectRatio() { return static_cast<double>(resolutionX) / resolutionY; }
@@ -37,4 +57,5 @@ private:
 
 	int resolutionX, resolutionY;
 	PixelColor* buffer;
-};
\ No newline at end of file
+	MemoryCounter bufferBytes{ MemorySubsystem::Output };
+};
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Timeline of what every thread did, exported in the Chrome Trace Event format that Perfetto and chrome://tracing open.
+// Each thread writes completed events into its own ring buffer without locking; when a buffer is full the oldest
+// events are overwritten. With tracing off an event costs one relaxed atomic load.
+class Trace {
+public:
+	static const uint32_t eventsPerThread = 1 << 16;	// a power of two
+
+	struct Event {
+		const char* name;		// string literal
+		const char* argName;	// string literal, or null for no argument
+		int64_t arg;
+		uint64_t start;			// nanoseconds since tracing was enabled
+		uint64_t duration;
+	};
+
+	static void Enable() {
+		GetEpoch() = std::chrono::steady_clock::now();
+		GetEnabled().store(true, std::memory_order_relaxed);
+	}
+
+	static bool IsEnabled() { return GetEnabled().load(std::memory_order_relaxed); }
+
+	static uint64_t Now() {
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - GetEpoch()).count());
+	}
+
+	// names the calling thread in the timeline, name must be a string literal
+	static void SetThreadName(const char* name) {
+		if (IsEnabled())
+			GetBuffer().name = name;
+	}
+
+	static void Record(const char* name, uint64_t start, uint64_t end, const char* argName = nullptr, int64_t arg = 0) {
+		Buffer& buffer = GetBuffer();
+		// only this thread writes, the count is atomic so an export sees whole events
+		uint64_t count = buffer.count.load(std::memory_order_relaxed);
+		buffer.events[count & (eventsPerThread - 1)] = { name, argName, arg, start, end - start };
+		buffer.count.store(count + 1, std::memory_order_release);
+	}
+
+	// writes the events of every thread that recorded any, call once the traced threads are idle
+	// returns function's success
+	static bool WriteJson(std::ostream& out) {
+		std::lock_guard<std::mutex> lock(GetRegistry().mutex);
+		char line[256];
+		bool first = true;
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		for (const std::shared_ptr<Buffer>& buffer : GetRegistry().buffers) {
+			uint64_t count = buffer->count.load(std::memory_order_acquire);
+			if (count == 0)
+				continue;
+
+			snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+				first ? "" : ",\n", buffer->id, buffer->name, buffer->id);
+			out << line;
+			first = false;
+
+			uint64_t begin = count > eventsPerThread ? count - eventsPerThread : 0;
+			for (uint64_t i = begin; i < count; i++) {
+				const Event& e = buffer->events[i & (eventsPerThread - 1)];
+				int n = snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+					e.name, buffer->id, e.start / 1e3, e.duration / 1e3);
+				if (e.argName)
+					snprintf(line + n, sizeof(line) - n, ",\"args\":{\"%s\":%lld}", e.argName, static_cast<long long>(e.arg));
+				out << line << "}";
+			}
+		}
+		out << "\n]}\n";
+		return static_cast<bool>(out);
+	}
+
+private:
+	struct Buffer {
+		uint32_t id = 0;
+		bool inUse = true;			// owned by a running thread
+		const char* name = "thread";
+		std::atomic<uint64_t> count{ 0 };
+		std::vector<Event> events = std::vector<Event>(eventsPerThread);
+	};
+
+	struct Registry {
+		std::mutex mutex;
+		std::vector<std::shared_ptr<Buffer>> buffers;	// kept after their threads exit so they can be exported
+	};
+
+	// hands the buffer to the next new thread when its thread exits, so each render does not add buffers
+	struct Owner {
+		Buffer* buffer = nullptr;
+
+		~Owner() {
+			if (!buffer)
+				return;
+			std::lock_guard<std::mutex> lock(GetRegistry().mutex);
+			buffer->inUse = false;
+		}
+	};
+
+	static std::atomic<bool>& GetEnabled() {
+		static std::atomic<bool> enabled{ false };
+		return enabled;
+	}
+
+	static std::chrono::steady_clock::time_point& GetEpoch() {
+		static std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+		return epoch;
+	}
+
+	static Registry& GetRegistry() {
+		static Registry registry;
+		return registry;
+	}
+
+	// takes a free buffer, or registers a new one, the first time a thread records
+	static Buffer& GetBuffer() {
+		thread_local Owner owner;
+		if (owner.buffer)
+			return *owner.buffer;
+
+		Registry& registry = GetRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		for (const std::shared_ptr<Buffer>& buffer : registry.buffers) {
+			if (!buffer->inUse) {
+				buffer->inUse = true;
+				owner.buffer = buffer.get();
+				return *owner.buffer;
+			}
+		}
+
+		auto created = std::make_shared<Buffer>();
+		created->id = static_cast<uint32_t>(registry.buffers.size());
+		registry.buffers.push_back(created);
+		owner.buffer = created.get();
+		return *owner.buffer;
+	}
+};
+
+// Records the lifetime of a scope as one event when tracing is on.
+class TraceScope {
+public:
+	TraceScope(const char* _name, const char* _argName = nullptr, int64_t _arg = 0)
+		: name(_name), argName(_argName), arg(_arg), start(Trace::IsEnabled() ? Trace::Now() : notTracing) { }
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+	~TraceScope() {
+		if (start != notTracing)
+			Trace::Record(name, start, Trace::Now(), argName, arg);
+	}
+
+private:
+	static const uint64_t notTracing = ~0ull;
+
+	const char* name;
+	const char* argName;
+	int64_t arg;
+	uint64_t start;
+};
@@ -1,78 +1,92 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 
 using std::sqrt;
 
-class Vec3 {
+// 3 component vector, templated on the scalar type so paths can be traced in float or double.
+template <typename T>
+class Vec3T {
 public:
-    double e[3];
+    using Scalar = T;
 
-    Vec3() : e{ 0,0,0 } {}
-    Vec3(double e0, double e1, double e2) : e{ e0, e1, e2 } {}
+    T e[3];
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    Vec3T() : e{ 0,0,0 } {}
+    Vec3T(T e0, T e1, T e2) : e{ e0, e1, e2 } {}
 
-    Vec3 operator-() const { return Vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int i) const { return e[i]; }
-    double& operator[](int i) { return e[i]; }
+    // converts between precisions
+    template <typename U>
+    explicit Vec3T(const Vec3T<U>& v) : e{ static_cast<T>(v.e[0]), static_cast<T>(v.e[1]), static_cast<T>(v.e[2]) } {}
 
-    Vec3& operator+=(const Vec3& v) {
+    T x() const { return e[0]; }
+    T y() const { return e[1]; }
+    T z() const { return e[2]; }
+
+    Vec3T operator-() const { return Vec3T(-e[0], -e[1], -e[2]); }
+    T operator[](int i) const { return e[i]; }
+    T& operator[](int i) { return e[i]; }
+
+    Vec3T& operator+=(const Vec3T& v) {
         e[0] += v.e[0];
         e[1] += v.e[1];
         e[2] += v.e[2];
         return *this;
     }
 
-    Vec3& operator*=(double t) {
+    Vec3T& operator*=(T t) {
         e[0] *= t;
         e[1] *= t;
         e[2] *= t;
         return *this;
     }
 
-    Vec3& operator/=(double t) {
+    Vec3T& operator/=(T t) {
         return *this *= 1 / t;
     }
 
-    double length() const {
+    T length() const {
         return sqrt(lengthSquared());
     }
 
-    double lengthSquared() const {
+    T lengthSquared() const {
         return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
     }
 
     bool isNearZeroLength() const {
         // Return true if the vector is close to zero in all dimensions.
-        auto s = 1e-8;
-        return (fabs(e[0]) < s) && (fabs(e[1]) < s) && (fabs(e[2]) < s);
+        const T s = static_cast<T>(1e-8);
+        return (std::abs(e[0]) < s) && (std::abs(e[1]) < s) && (std::abs(e[2]) < s);
     }
 
-    Vec3 normalized() const {
-        double invLength = (1 / this->length());
-        return Vec3(e[0] * invLength, e[1] * invLength, e[2] * invLength);
+    Vec3T normalized() const {
+        T invLength = (1 / this->length());
+        return Vec3T(e[0] * invLength, e[1] * invLength, e[2] * invLength);
     }
 
     void normalize() {
         *this *= 1 / this->length();
     }
 
-    static Vec3 random() {
-        return Vec3(Random01(), Random01(), Random01());
+    static Vec3T random() {
+        return Vec3T(static_cast<T>(Random01()), static_cast<T>(Random01()), static_cast<T>(Random01()));
     }
 
-    static Vec3 random(double min, double max) {
-        return Vec3(RandomRange(min, max), RandomRange(min, max), RandomRange(min, max));
+    static Vec3T random(double min, double max) {
+        return Vec3T(static_cast<T>(RandomRange(min, max)), static_cast<T>(RandomRange(min, max)), static_cast<T>(RandomRange(min, max)));
     }
 };
 
+using Vec3 = Vec3T<double>;
+using Vec3f = Vec3T<float>;
+
 // point3 is just an alias for vec3, but useful for geometric clarity in the code.
 using Point3 = Vec3;
 using Color = Vec3;
+using Point3f = Vec3f;
+using Colorf = Vec3f;
 
 inline Color HSV(double h, double s, double v) {
     double r, g, b;
@@ -96,67 +110,82 @@ inline Color HSV(double h, double s, double v) {
 }
 
 // Vector Utility Functions
+// scalar operands are taken as Vec3T<T>::Scalar so any arithmetic type converts to the vector's precision
 
-inline std::ostream& operator<<(std::ostream& out, const Vec3& v) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream& out, const Vec3T<T>& v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline Vec3 operator+(const Vec3& u, const Vec3& v) {
-    return Vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+template <typename T>
+inline Vec3T<T> operator+(const Vec3T<T>& u, const Vec3T<T>& v) {
+    return Vec3T<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
-inline Vec3 operator-(const Vec3& u, const Vec3& v) {
-    return Vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+template <typename T>
+inline Vec3T<T> operator-(const Vec3T<T>& u, const Vec3T<T>& v) {
+    return Vec3T<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 
-inline Vec3 operator*(const Vec3& u, const Vec3& v) {
-    return Vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+template <typename T>
+inline Vec3T<T> operator*(const Vec3T<T>& u, const Vec3T<T>& v) {
+    return Vec3T<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline Vec3 operator+(double t, const Vec3& v) {
-    return Vec3(t + v.e[0], t + v.e[1], t + v.e[2]);
+template <typename T>
+inline Vec3T<T> operator+(typename Vec3T<T>::Scalar t, const Vec3T<T>& v) {
+    return Vec3T<T>(t + v.e[0], t + v.e[1], t + v.e[2]);
 }
 
-inline Vec3 operator+(const Vec3& v, double t) {
+template <typename T>
+inline Vec3T<T> operator+(const Vec3T<T>& v, typename Vec3T<T>::Scalar t) {
     return t + v;
 }
 
-inline Vec3 operator*(double t, const Vec3& v) {
-    return Vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+template <typename T>
+inline Vec3T<T> operator*(typename Vec3T<T>::Scalar t, const Vec3T<T>& v) {
+    return Vec3T<T>(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline Vec3 operator*(const Vec3& v, double t) {
+template <typename T>
+inline Vec3T<T> operator*(const Vec3T<T>& v, typename Vec3T<T>::Scalar t) {
     return t * v;
 }
 
-inline Vec3 operator/(Vec3 v, double t) {
+template <typename T>
+inline Vec3T<T> operator/(Vec3T<T> v, typename Vec3T<T>::Scalar t) {
     return (1 / t) * v;
 }
 
-inline double dot(const Vec3& u, const Vec3& v) {
+template <typename T>
+inline T dot(const Vec3T<T>& u, const Vec3T<T>& v) {
     return u.e[0] * v.e[0]
         + u.e[1] * v.e[1]
         + u.e[2] * v.e[2];
 }
 
-inline Vec3 cross(const Vec3& u, const Vec3& v) {
-    return Vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+template <typename T>
+inline Vec3T<T> cross(const Vec3T<T>& u, const Vec3T<T>& v) {
+    return Vec3T<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
         u.e[2] * v.e[0] - u.e[0] * v.e[2],
         u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
-inline Vec3 normalize(const Vec3 v) {
+template <typename T>
+inline Vec3T<T> normalize(const Vec3T<T> v) {
     return v / v.length();
 }
 
-Vec3 reflect(const Vec3& v, const Vec3& n) {
+template <typename T>
+inline Vec3T<T> reflect(const Vec3T<T>& v, const Vec3T<T>& n) {
     return v - 2 * dot(v, n) * n;
 }
 
-inline Vec3 refract(const Vec3& uv, const Vec3& n, double etai_over_etat) {
-    auto cos_theta = fmin(dot(-uv, n), 1.0);
-    Vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
-    Vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.lengthSquared())) * n;
+template <typename T>
+inline Vec3T<T> refract(const Vec3T<T>& uv, const Vec3T<T>& n, typename Vec3T<T>::Scalar etai_over_etat) {
+    T cos_theta = std::min(dot(-uv, n), static_cast<T>(1));
+    Vec3T<T> r_out_perp = etai_over_etat * (uv + cos_theta * n);
+    Vec3T<T> r_out_parallel = -sqrt(std::abs(1 - r_out_perp.lengthSquared())) * n;
     return r_out_perp + r_out_parallel;
 }
 
@@ -169,22 +198,25 @@ inline Vec3 random_in_unit_disk() {
     return p;
 }
 
-inline Vec3 RandomPointInsideUnitSphere() {
-    Vec3 p;
+template <typename T = double>
+inline Vec3T<T> RandomPointInsideUnitSphere() {
+    Vec3T<T> p;
 
-    do { p = Vec3::random(-1, 1); } 
+    do { p = Vec3T<T>::random(-1, 1); } 
     while (p.lengthSquared() > 1);
 
     return p;
 }
 
-inline Vec3 RandomPointOnUnitSphere() {
-    return RandomPointInsideUnitSphere().normalized();
+template <typename T = double>
+inline Vec3T<T> RandomPointOnUnitSphere() {
+    return RandomPointInsideUnitSphere<T>().normalized();
 }
 
-inline Vec3 RandomPointOnUnitHemisphere(const Vec3& normal) {
-    Vec3 onSphere = RandomPointOnUnitSphere();
-    if (dot(onSphere, normal) > 0.0) // Check if in same hemisphere as the normal
+template <typename T>
+inline Vec3T<T> RandomPointOnUnitHemisphere(const Vec3T<T>& normal) {
+    Vec3T<T> onSphere = RandomPointOnUnitSphere<T>();
+    if (dot(onSphere, normal) > 0) // Check if in same hemisphere as the normal
         return onSphere;
     else
         return -onSphere;
@@ -0,0 +1,223 @@
+#pragma once
+
+#include "RTWeekend.h"
+#include "Hittable.h"
+#include "Material.h"
+#include "MemoryStats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+// Paths of one wavefront, stored as separate arrays so every stage streams through only the data it uses.
+// All paths in the queue are at the same bounce.
+template <typename T>
+class PathQueue {
+public:
+	std::vector<RayT<T>> rays;
+	std::vector<Vec3T<T>> throughput;
+	std::vector<uint32_t> pixel;			// index of the band pixel the path adds to
+	std::vector<HitPointT<T>> points;		// closest hit of the current ray
+	std::vector<uint8_t> kind;				// material kind at the hit, Material::Kind::Count once the path has ended
+	std::vector<uint32_t> order;			// live paths grouped by material kind, see Sort
+	uint32_t kindStart[static_cast<int>(Material::Kind::Count) + 1];
+	uint32_t count = 0;
+
+	void Reserve(uint32_t capacity) {
+		if (rays.size() >= capacity)
+			return;
+		rays.resize(capacity);
+		throughput.resize(capacity);
+		pixel.resize(capacity);
+		points.resize(capacity);
+		kind.resize(capacity);
+		order.resize(capacity);
+		UpdateBytes();
+	}
+
+	// counting sort of the live paths by material kind, stable so paths stay in pixel order within a kind
+	void Sort() {
+		const int kinds = static_cast<int>(Material::Kind::Count);
+		uint32_t counts[kinds + 1] = {};
+		for (uint32_t i = 0; i < count; i++)
+			counts[kind[i]]++;
+
+		kindStart[0] = 0;
+		for (int k = 0; k < kinds; k++)
+			kindStart[k + 1] = kindStart[k] + counts[k];
+
+		uint32_t next[kinds + 1];
+		for (int k = 0; k <= kinds; k++)
+			next[k] = kindStart[k];
+		for (uint32_t i = 0; i < count; i++)
+			if (kind[i] < kinds)
+				order[next[kind[i]]++] = i;
+	}
+
+	// Sorts the paths by the octant of their direction, then by the Morton code of their origin
+	// within the bounds of all origins, so rays that start close together and head the same way are traced together.
+	void Reorder() {
+		if (count < 2)
+			return;
+
+		if (keys.size() < rays.size()) {
+			keys.resize(rays.size());
+			keyScratch.resize(rays.size());
+			indexScratch.resize(rays.size());
+			rayScratch.resize(rays.size());
+			throughputScratch.resize(rays.size());
+			pixelScratch.resize(rays.size());
+			UpdateBytes();
+		}
+
+		Vec3T<T> lo = rays[0].origin, hi = rays[0].origin;
+		for (uint32_t i = 1; i < count; i++) {
+			for (int axis = 0; axis < 3; axis++) {
+				lo.e[axis] = std::min(lo.e[axis], rays[i].origin.e[axis]);
+				hi.e[axis] = std::max(hi.e[axis], rays[i].origin.e[axis]);
+			}
+		}
+
+		// 9 bits per axis and the octant on top, 30 bits in all
+		T scale[3];
+		for (int axis = 0; axis < 3; axis++)
+			scale[axis] = hi.e[axis] > lo.e[axis] ? static_cast<T>(511.99) / (hi.e[axis] - lo.e[axis]) : 0;
+
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t key = 0;
+			for (int axis = 0; axis < 3; axis++) {
+				uint32_t cell = static_cast<uint32_t>((rays[i].origin.e[axis] - lo.e[axis]) * scale[axis]);
+				key |= SpreadBits(std::min(cell, 511u)) << axis;
+				key |= (rays[i].direction.e[axis] < 0 ? 1u : 0u) << (27 + axis);
+			}
+			keys[i] = key;
+			order[i] = i;
+		}
+
+		// least significant digit first radix sort, 10 bits per pass
+		for (int shift = 0; shift < 30; shift += 10) {
+			uint32_t offsets[1024] = {};
+			for (uint32_t i = 0; i < count; i++)
+				offsets[(keys[i] >> shift) & 1023]++;
+			uint32_t sum = 0;
+			for (uint32_t& offset : offsets) {
+				uint32_t n = offset;
+				offset = sum;
+				sum += n;
+			}
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t slot = offsets[(keys[i] >> shift) & 1023]++;
+				keyScratch[slot] = keys[i];
+				indexScratch[slot] = order[i];
+			}
+			keys.swap(keyScratch);
+			order.swap(indexScratch);
+		}
+
+		for (uint32_t i = 0; i < count; i++) {
+			rayScratch[i] = rays[order[i]];
+			throughputScratch[i] = throughput[order[i]];
+			pixelScratch[i] = pixel[order[i]];
+		}
+		rays.swap(rayScratch);
+		throughput.swap(throughputScratch);
+		pixel.swap(pixelScratch);
+	}
+
+	// moves the live paths to the front, keeping their order
+	void Compact() {
+		const uint8_t ended = static_cast<uint8_t>(Material::Kind::Count);
+		uint32_t live = 0;
+		for (uint32_t i = 0; i < count; i++) {
+			if (kind[i] == ended)
+				continue;
+			rays[live] = rays[i];
+			throughput[live] = throughput[i];
+			pixel[live] = pixel[i];
+			live++;
+		}
+		count = live;
+	}
+
+private:
+	// only used by Reorder
+	std::vector<uint32_t> keys, keyScratch, indexScratch;
+	std::vector<RayT<T>> rayScratch;
+	std::vector<Vec3T<T>> throughputScratch;
+	std::vector<uint32_t> pixelScratch;
+
+	MemoryCounter bytes{ MemorySubsystem::PathQueues };
+
+	void UpdateBytes() {
+		size_t perPath = sizeof(RayT<T>) + sizeof(Vec3T<T>) + sizeof(uint32_t) + sizeof(HitPointT<T>) + sizeof(uint8_t) + sizeof(uint32_t);
+		size_t perReorder = 4 * sizeof(uint32_t) + sizeof(RayT<T>) + sizeof(Vec3T<T>);
+		bytes.Set(rays.size() * perPath + keys.size() * perReorder);
+	}
+
+	// spaces the low 9 bits of v three apart
+	static uint32_t SpreadBits(uint32_t v) {
+		v = (v * 0x00010001u) & 0xFF0000FFu;
+		v = (v * 0x00000101u) & 0x0F00F00Fu;
+		v = (v * 0x00000011u) & 0xC30C30C3u;
+		v = (v * 0x00000005u) & 0x49249249u;
+		return v;
+	}
+};
+
+// Thread time spent in each wavefront stage and the number of paths entering each bounce, summed over all bands.
+class WavefrontStats {
+public:
+	enum Stage { Generate, Reorder, Intersect, Sort, Shade, Compact, StageCount };
+	static const int maxBounces = 64;
+
+	void Reset() {
+		for (auto& nanos : stageNanos)
+			nanos = 0;
+		for (auto& paths : bouncePaths)
+			paths = 0;
+	}
+
+	void AddStage(Stage stage, uint64_t nanos) { stageNanos[stage] += nanos; }
+
+	void AddPaths(int bounce, uint64_t paths) {
+		if (bounce < maxBounces)
+			bouncePaths[bounce] += paths;
+	}
+
+	uint64_t GetStageNanos(Stage stage) const { return stageNanos[stage]; }
+	uint64_t GetPaths(int bounce) const { return bounce < maxBounces ? bouncePaths[bounce].load() : 0; }
+
+	static const char* GetName(Stage stage) {
+		static const char* names[] = { "generate", "reorder", "intersect", "sort", "shade", "compact" };
+		return names[stage];
+	}
+
+	void Print(std::ostream& out) const {
+		out << "Wavefront stages (thread time):";
+		for (int i = 0; i < StageCount; i++)
+			out << (i ? ", " : " ") << GetName(static_cast<Stage>(i)) << " " << stageNanos[i] / 1e6 << " ms";
+		out << "\n";
+
+		// share of the generated paths still alive at each bounce, the long tail is only counted
+		out << "Queue occupancy by bounce:";
+		int bounce = 0;
+		for (; bounce < maxBounces && bouncePaths[bounce] * 1000 >= bouncePaths[0] && bouncePaths[0] > 0; bounce++) {
+			char entry[32];
+			snprintf(entry, sizeof(entry), " %d:%.1f%%", bounce, 100.0 * bouncePaths[bounce] / bouncePaths[0]);
+			out << entry;
+		}
+		int last = bounce;
+		while (last < maxBounces && bouncePaths[last] > 0)
+			last++;
+		if (last > bounce)
+			out << " ... " << last - bounce << " more bounces below 0.1%";
+		out << "\n";
+	}
+
+private:
+	std::atomic<uint64_t> stageNanos[StageCount] = {};
+	std::atomic<uint64_t> bouncePaths[maxBounces] = {};
+};
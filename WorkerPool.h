@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// How a job shares the workers of a WorkerPool with the other jobs.
+struct JobSchedule {
+	int priority = 0;				// workers go to jobs of a higher priority first
+	double weight = 1;				// share of the workers among the jobs of one priority
+	double deadlineSeconds = 0;		// after submission, 0 for none; a job that needs more workers to make it gets them first until it is missed
+};
+
+// A fixed set of threads divided among the jobs given to it, so renders running side by side share the machine
+// instead of each starting a thread per core. Jobs are split into bands of rows, and at the end of every band a
+// worker may be moved to another job:
+// - cancelled jobs first, so they end promptly, then jobs by priority
+// - within a priority, jobs with a deadline get the workers their measured band times say they need to make it,
+//   earliest deadline first; once missed, a deadline counts for nothing
+// - the remaining workers are shared in proportion to weight; a job left without a whole worker takes turns with
+//   the others, a band at a time, the least served first
+class WorkerPool {
+public:
+	// Bands of work that any number of workers take from together.
+	class Job {
+	public:
+		JobSchedule schedule;
+		int maxWorkers = 1;
+		int totalRows = 0;
+		const std::atomic<bool>* cancelled = nullptr;
+
+		// run by a worker, takes bands until FinishBand says to leave or they run out
+		// returns true once the bands have run out
+		std::function<bool()> run;
+		// run once, by the last worker out after the bands have run out
+		std::function<void()> finish;
+
+		// called by a worker after each band it rendered
+		// returns true when the worker should leave this job for another
+		bool FinishBand(int rows, double seconds) {
+			std::lock_guard<std::mutex> lock(pool->mutex);
+			finishedRows += rows;
+			workSeconds += seconds;
+			pool->UpdateTargets();
+			return running > target && pool->HasWaitingJob();
+		}
+
+	private:
+		friend class WorkerPool;
+
+		WorkerPool* pool = nullptr;
+		std::chrono::steady_clock::time_point deadline;
+		int running = 0;			// workers in the job
+		int target = 0;				// workers it should have
+		bool exhausted = false;		// no bands left to take
+		int finishedRows = 0;
+		double workSeconds = 0;		// summed over its workers
+
+		bool IsCancelled() const { return cancelled && cancelled->load(std::memory_order_relaxed); }
+
+		// workers that would finish the remaining rows at the measured rate before the deadline
+		// a missed deadline asks for none, the job then only has its weighted share so it cannot starve the others
+		int GetDeadlineWorkers(std::chrono::steady_clock::time_point now) const {
+			if (schedule.deadlineSeconds <= 0 || now >= deadline)
+				return 0;
+			if (finishedRows == 0)
+				return 1;
+			double remainingWork = workSeconds / finishedRows * (totalRows - finishedRows);
+			double timeLeft = std::chrono::duration<double>(deadline - now).count();
+			return static_cast<int>(std::min<double>(std::ceil(remainingWork / timeLeft), maxWorkers));
+		}
+	};
+
+	// 0 threads for one per hardware thread
+	explicit WorkerPool(int threadCount = 0) {
+		int count = threadCount > 0 ? threadCount : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+		for (int i = 0; i < count; i++)
+			threads.emplace_back([this] { Run(); });
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// finishes the jobs already scheduled, then stops the threads
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& thread : threads)
+			thread.join();
+	}
+
+	int GetThreadCount() const { return static_cast<int>(threads.size()); }
+
+	// longest deadline a job can ask for, later ones are cut to it
+	static constexpr double maxDeadlineSeconds = 1e7;
+
+	// returns false, leaving the job unscheduled, when its weight is not a positive number or its deadline is negative
+	bool Schedule(std::shared_ptr<Job> job) {
+		JobSchedule& schedule = job->schedule;
+		if (!(schedule.weight > 0) || !std::isfinite(schedule.weight) || !(schedule.deadlineSeconds >= 0))
+			return false;
+		schedule.weight = std::max(schedule.weight, 1e-3);
+		schedule.deadlineSeconds = std::min(schedule.deadlineSeconds, maxDeadlineSeconds);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job->pool = this;
+			job->deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double>(schedule.deadlineSeconds));
+			jobs.push_back(std::move(job));
+		}
+		wake.notify_all();
+		return true;
+	}
+
+private:
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<std::shared_ptr<Job>> jobs;		// scheduled and not yet finished
+	bool stopping = false;
+
+	void Run() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			std::shared_ptr<Job> job;
+			wake.wait(lock, [&] { return (job = Pick()) || (stopping && jobs.empty()); });
+			if (!job)
+				return;
+
+			job->running++;
+			lock.unlock();
+			bool exhausted = job->run();
+			lock.lock();
+			job->running--;
+			job->exhausted |= exhausted;
+
+			if (job->exhausted && job->running == 0) {
+				jobs.erase(std::find(jobs.begin(), jobs.end(), job));
+				lock.unlock();
+				job->finish();
+				// the functions may hold on to what the job renders
+				job->run = nullptr;
+				job->finish = nullptr;
+				lock.lock();
+			}
+			// a job left or has room for another worker
+			wake.notify_all();
+		}
+	}
+
+	// with mutex held
+	// returns the job furthest below its share of workers, or null when every job has as many workers as it can use
+	std::shared_ptr<Job> Pick() {
+		UpdateTargets();
+		std::shared_ptr<Job> best;
+		for (const std::shared_ptr<Job>& job : jobs) {
+			if (job->exhausted || job->running >= job->maxWorkers)
+				continue;
+			if (!best || job->target - job->running > best->target - best->running)
+				best = job;
+		}
+		return best;
+	}
+
+	// with mutex held
+	bool HasWaitingJob() const {
+		for (const std::shared_ptr<Job>& job : jobs) {
+			if (!job->exhausted && job->running < job->target)
+				return true;
+		}
+		return false;
+	}
+
+	// with mutex held, divides the workers among the jobs with bands left
+	void UpdateTargets() {
+		const auto now = std::chrono::steady_clock::now();
+		std::vector<Job*> runnable;
+		for (const std::shared_ptr<Job>& job : jobs) {
+			job->target = 0;
+			if (!job->exhausted)
+				runnable.push_back(job.get());
+		}
+		std::stable_sort(runnable.begin(), runnable.end(), [](const Job* a, const Job* b) {
+			if (a->IsCancelled() != b->IsCancelled())
+				return a->IsCancelled();
+			return a->schedule.priority > b->schedule.priority;
+		});
+
+		int free = static_cast<int>(threads.size());
+		for (size_t begin = 0, end; begin < runnable.size() && free > 0; begin = end) {
+			for (end = begin + 1; end < runnable.size() && runnable[end]->IsCancelled() == runnable[begin]->IsCancelled()
+				&& runnable[end]->schedule.priority == runnable[begin]->schedule.priority; end++) { }
+
+			// deadlines first, earliest first
+			std::vector<Job*> byDeadline(runnable.begin() + begin, runnable.begin() + end);
+			std::stable_sort(byDeadline.begin(), byDeadline.end(), [](const Job* a, const Job* b) { return a->deadline < b->deadline; });
+			for (Job* job : byDeadline) {
+				int workers = std::min({ job->GetDeadlineWorkers(now), job->maxWorkers, free });
+				job->target = workers;
+				free -= workers;
+			}
+
+			// then a worker at a time to the job with the fewest per weight, the least served on a tie
+			for (; free > 0; free--) {
+				Job* next = nullptr;
+				for (size_t i = begin; i < end; i++) {
+					Job* job = runnable[i];
+					if (job->target >= job->maxWorkers)
+						continue;
+					double share = (job->target + 1) / job->schedule.weight;
+					double nextShare = next ? (next->target + 1) / next->schedule.weight : 0;
+					if (!next || share < nextShare
+						|| (share == nextShare && job->workSeconds / job->schedule.weight < next->workSeconds / next->schedule.weight))
+						next = job;
+				}
+				if (!next)
+					break;
+				next->target++;
+			}
+		}
+	}
+};
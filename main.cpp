@@ -8,7 +8,21 @@
 #include "Sphere.h"
 #include "Camera.h"
 #include "Texture.h"
+#include "ImageStream.h"
+#include "Framebuffer.h"
+#include "Scene.h"
+#include "Scenes.h"
+#include "RenderBenchmark.h"
+#include "ScalingBenchmark.h"
+#include "ConvergenceBenchmark.h"
+#include "RenderServer.h"
+#include "Checkpoint.h"
+#include "DependencyMap.h"
+#include "Trace.h"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 
 double hit_sphere(const Point3& center, double radius, const Ray& r) {
@@ -27,78 +41,590 @@ double hit_sphere(const Point3& center, double radius, const Ray& r) {
 	}
 }
 
-int main()
+int main(int argc, char* argv[])
 {
 	STBI_DISABLE_PNG_COMPRESSION
 
-	// initialise output image
-	int imageWidth = 1280;
-	int imageHeight = 720;
-	auto outputTexture = shared_ptr<Texture>(new Texture(imageWidth, imageHeight));
+	// command line options
+	const char* streamPath = nullptr;		// stream rows to this file/FIFO ("-" for stdout) instead of output.png
+	const char* streamFormat = nullptr;		// raw, ppm or png; guessed from streamPath when not given
+	const char* framebufferPath = nullptr;	// accumulate into a memory-mapped tiled framebuffer at this path
+	bool halfAccumulation = false;			// store the framebuffer as half floats
+	int residentTiles = 256;				// maximum framebuffer tiles mapped at once, raised to two rows of tiles for wide images
+	ResolveSettings resolve;				// exposure, tonemapper, transfer curve and dithering of the output
+	const char* scenePath = nullptr;		// text or binary scene to render instead of the built-in one
+	const char* saveScenePath = nullptr;	// write the scene out, as binary if the path ends in .rtsb
+	int imageWidth = 0;						// settings left at 0 are taken from the scene
+	int imageHeight = 0;
+	int samplesPerPixel = 0;
+	int maxRayBounces = 0;
+	bool genericKernel = false;				// always use the virtual Hittable render loop
+	bool singlePrecision = false;			// trace paths in float
+	bool comparePrecision = false;			// render in double and float and report the difference
+	uint64_t seed = 0;						// nonzero for repeatable renders
+	const char* isa = nullptr;				// instruction set limit for the SIMD kernels
+	int packetSize = 8;						// trace camera rays in 4x4 or 8x8 packets, 0 for single rays
+	bool wavefront = false;					// render with path queues sorted by material
+	uint64_t reorderBounces = 0;			// bounces whose rays are sorted for coherence, implies wavefront
+	bool benchmark = false;					// time the canonical scenes instead of rendering one
+	int benchmarkRuns = 0;					// timed runs per scene, 0 for the default
+	const char* benchmarkScenes = nullptr;	// only scenes whose name contains this
+	const char* benchmarkOut = nullptr;		// write the results as JSON
+	const char* baselinePath = nullptr;		// results of an earlier --benchmark-out to compare with
+	double regressionThreshold = 5;			// percent drop in Mrays/s against the baseline that fails
+	const char* statsPath = nullptr;		// write the render statistics as JSON ("-" for stdout)
+	bool heatmap = false;					// write per pixel cost heatmaps next to output.png
+	const char* tracePath = nullptr;		// record a timeline of every thread as Chrome trace JSON
+	int threadCount = 0;					// render workers, 0 for one per hardware thread
+	const char* scaling = nullptr;			// strong or weak: sweep the thread count instead of rendering
+	const char* convergence = nullptr;		// comma separated configurations to measure error over time for
+	const char* convergenceOut = nullptr;	// CSV path, stdout when not given
+	const char* referencePath = nullptr;	// reference image reused between convergence runs
+	int referenceSpp = 0;					// samples per pixel of the reference, 0 for the default
+	const char* timePoints = nullptr;		// comma separated seconds at which the error is recorded
+	const char* socketPath = nullptr;		// serve render jobs on this local socket instead of rendering one
+	int cachedScenes = 0;					// scenes the server keeps built, 0 for the default
+	const char* outputDirectory = nullptr;	// where the server writes the images of its jobs, the working directory when not given
+	const char* checkpointPath = nullptr;	// render in passes, checkpointing the accumulated samples here
+	double checkpointSeconds = 60;			// least time between checkpoints
+	int passSpp = 0;						// samples per pixel of each pass, 0 for the default
+	bool resume = false;					// continue from the checkpoint
+	const char* incrementalPath = nullptr;	// re-render only the pixels the scene edits since the last render here reach
 
-	HittableList world;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+			streamPath = argv[++i];
+		else if (strcmp(argv[i], "--stream-format") == 0 && i + 1 < argc)
+			streamFormat = argv[++i];
+		else if (strcmp(argv[i], "--framebuffer") == 0 && i + 1 < argc)
+			framebufferPath = argv[++i];
+		else if (strcmp(argv[i], "--accum") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (strcmp(name, "float") != 0 && strcmp(name, "half") != 0) {
+				std::cerr << "Unknown accumulation format " << name << "\n";
+				return 1;
+			}
+			halfAccumulation = strcmp(name, "half") == 0;
+		}
+		else if (strcmp(argv[i], "--resident-tiles") == 0 && i + 1 < argc)
+			residentTiles = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--exposure") == 0 && i + 1 < argc)
+			resolve.exposure = static_cast<float>(atof(argv[++i]));
+		else if (strcmp(argv[i], "--tonemap") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			if (!ParseTonemapper(name, resolve.tonemapper)) {
+				std::cerr << "Unknown tonemapper " << name << "\n";
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--gamma2") == 0)
+			resolve.transfer = TransferFunction::Gamma2;
+		else if (strcmp(argv[i], "--dither") == 0)
+			resolve.dither = true;
+		else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+			scenePath = argv[++i];
+		else if (strcmp(argv[i], "--save-scene") == 0 && i + 1 < argc)
+			saveScenePath = argv[++i];
+		else if (strcmp(argv[i], "--spp") == 0 && i + 1 < argc)
+			samplesPerPixel = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--bounces") == 0 && i + 1 < argc)
+			maxRayBounces = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+			imageWidth = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc)
+			imageHeight = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--generic-kernel") == 0)
+			genericKernel = true;
+		else if (strcmp(argv[i], "--float") == 0)
+			singlePrecision = true;
+		else if (strcmp(argv[i], "--compare-precision") == 0)
+			comparePrecision = true;
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+			seed = strtoull(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc)
+			isa = argv[++i];
+		else if (strcmp(argv[i], "--packets") == 0 && i + 1 < argc) {
+			packetSize = atoi(argv[++i]);
+			if (packetSize != 0 && packetSize != 4 && packetSize != 8) {
+				std::cerr << "Unsupported packet size " << argv[i] << " (0, 4 or 8)\n";
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--wavefront") == 0)
+			wavefront = true;
+		else if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc) {
+			// "all", "secondary" or a comma separated list of bounces
+			const char* list = argv[++i];
+			if (strcmp(list, "all") == 0)
+				reorderBounces = ~0ull;
+			else if (strcmp(list, "secondary") == 0)
+				reorderBounces = ~1ull;
+			else
+				for (char* end = nullptr; *list; list = *end ? end + 1 : end) {
+					long bounce = strtol(list, &end, 10);
+					if (end == list)
+						break;
+					if (bounce >= 0 && bounce < 64)
+						reorderBounces |= 1ull << bounce;
+				}
+			wavefront = true;
+		}
+		else if (strcmp(argv[i], "--benchmark") == 0)
+			benchmark = true;
+		else if (strcmp(argv[i], "--benchmark-runs") == 0 && i + 1 < argc)
+			benchmarkRuns = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--benchmark-scenes") == 0 && i + 1 < argc)
+			benchmarkScenes = argv[++i];
+		else if (strcmp(argv[i], "--benchmark-out") == 0 && i + 1 < argc)
+			benchmarkOut = argv[++i];
+		else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+			baselinePath = argv[++i];
+		else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+			regressionThreshold = atof(argv[++i]);
+		else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+			statsPath = argv[++i];
+		else if (strcmp(argv[i], "--heatmap") == 0)
+			heatmap = true;
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			tracePath = argv[++i];
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			threadCount = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--scaling") == 0 && i + 1 < argc)
+			scaling = argv[++i];
+		else if (strcmp(argv[i], "--convergence") == 0 && i + 1 < argc)
+			convergence = argv[++i];
+		else if (strcmp(argv[i], "--convergence-out") == 0 && i + 1 < argc)
+			convergenceOut = argv[++i];
+		else if (strcmp(argv[i], "--reference") == 0 && i + 1 < argc)
+			referencePath = argv[++i];
+		else if (strcmp(argv[i], "--reference-spp") == 0 && i + 1 < argc)
+			referenceSpp = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--time-points") == 0 && i + 1 < argc)
+			timePoints = argv[++i];
+		else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+			socketPath = argv[++i];
+		else if (strcmp(argv[i], "--cache-scenes") == 0 && i + 1 < argc)
+			cachedScenes = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--output-dir") == 0 && i + 1 < argc)
+			outputDirectory = argv[++i];
+		else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+			checkpointPath = argv[++i];
+		else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc)
+			checkpointSeconds = atof(argv[++i]);
+		else if (strcmp(argv[i], "--pass-spp") == 0 && i + 1 < argc)
+			passSpp = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--resume") == 0)
+			resume = true;
+		else if (strcmp(argv[i], "--incremental") == 0 && i + 1 < argc)
+			incrementalPath = argv[++i];
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--scene <path>] [--save-scene <path>]"
+				<< " [--width <px>] [--height <px>] [--spp <n>] [--bounces <n>] [--generic-kernel] [--float] [--compare-precision] [--seed <n>]"
+				<< " [--isa scalar|sse4|avx2|avx512] [--packets 0|4|8] [--wavefront] [--reorder all|secondary|<bounce,...>]"
+				<< " [--benchmark [--benchmark-runs <n>] [--benchmark-scenes <text>] [--benchmark-out <path>] [--baseline <path>] [--threshold <percent>]]"
+				<< " [--stats <path|->] [--heatmap] [--trace <path>] [--threads <n>] [--scaling strong|weak]"
+				<< " [--convergence <config,...> [--convergence-out <path>] [--reference <path>] [--reference-spp <n>] [--time-points <s,...>]]"
+				<< " [--serve <socket> [--cache-scenes <n>] [--output-dir <path>]]"
+				<< " [--checkpoint <path> [--checkpoint-interval <s>] [--pass-spp <n>] [--resume]] [--incremental <path>]"
+				<< " [--stream <path|->] [--stream-format raw|ppm|png]"
+				<< " [--framebuffer <path>] [--accum float|half] [--resident-tiles <n>]"
+				<< " [--exposure <x>] [--tonemap clamp|reinhard|aces] [--gamma2] [--dither]\n";
+			return 1;
+		}
+	}
 
-	auto ground_material = make_shared<Lambertian>(Color(0.5, 0.5, 0.5));
-	world.add(make_shared<Sphere>(Point3(0, -1000, 0), 1000, ground_material));
+	if (statsPath && streamPath && strcmp(statsPath, "-") == 0 && strcmp(streamPath, "-") == 0) {
+		std::cerr << "--stats - and --stream - cannot both write to stdout\n";
+		return 1;
+	}
 
-	for (int a = -11; a < 11; a++) {
-		for (int b = -11; b < 11; b++) {
-			auto choose_mat = Random01();
-			Point3 center(a + 0.9 * Random01(), 0.2, b + 0.9 * Random01());
+	SimdLevel simdLevel = DetectSimdLevel();
+	if (isa) {
+		SimdLevel limit;
+		if (!ParseSimdLevel(isa, limit)) {
+			std::cerr << "Unknown instruction set " << isa << "\n";
+			return 1;
+		}
+		simdLevel = SetSimdLevel(limit);
+	}
+	std::clog << "SIMD: " << GetSimdName(simdLevel) << " (CPU supports " << GetSimdName(DetectSimdLevel()) << ")\n";
 
-			if ((center - Point3(4, 0.2, 0)).length() > 0.9) {
-				shared_ptr<Material> sphere_material;
+	if (tracePath) {
+		Trace::Enable();
+		Trace::SetThreadName("main");
+	}
+	// returns function's success
+	auto writeTrace = [&]() {
+		if (!tracePath)
+			return true;
+		std::ofstream file(tracePath);
+		if (!Trace::WriteJson(file)) {
+			std::cerr << "Could not write " << tracePath << "\n";
+			return false;
+		}
+		return true;
+	};
 
-				if (choose_mat < 0.8) {
-					// diffuse
-					auto albedo = Color::random() * Color::random();
-					sphere_material = make_shared<Lambertian>(albedo);
-					world.add(make_shared<Sphere>(center, 0.2, sphere_material));
-				}
-				else if (choose_mat < 0.95) {
-					// metal
-					auto albedo = Color::random(0.5, 1);
-					auto fuzz = RandomRange(0, 0.5);
-					sphere_material = make_shared<Metal>(albedo, fuzz);
-					world.add(make_shared<Sphere>(center, 0.2, sphere_material));
-				}
-				else {
-					// glass
-					sphere_material = make_shared<Dielectric>(1.5, 5 * HSV(Random01(), 1, 1));
-					world.add(make_shared<Sphere>(center, 0.2, sphere_material));
-				}
+	// render loop options, shared with the benchmark's cameras
+	auto setupKernels = [&](Camera& camera) {
+		camera.specializedKernels = !genericKernel;
+		camera.singlePrecision = singlePrecision;
+		camera.packetSize = packetSize;
+		camera.wavefront = wavefront;
+		camera.reorderBounces = reorderBounces;
+		camera.threadCount = threadCount;
+	};
+
+	if (socketPath) {
+		RenderServer server;
+		server.settings.socketPath = socketPath;
+		server.settings.threadCount = threadCount;
+		if (cachedScenes > 0) server.settings.cachedScenes = cachedScenes;
+		if (outputDirectory) server.settings.outputDirectory = outputDirectory;
+		server.configure = setupKernels;
+		if (!server.Run())
+			return 1;
+		return writeTrace() ? 0 : 1;
+	}
+
+	if (scaling) {
+		ScalingBenchmark sweep;
+		if (strcmp(scaling, "strong") == 0) sweep.settings.mode = ScalingMode::Strong;
+		else if (strcmp(scaling, "weak") == 0) sweep.settings.mode = ScalingMode::Weak;
+		else {
+			std::cerr << "Unknown scaling mode " << scaling << "\n";
+			return 1;
+		}
+		if (imageWidth > 0) sweep.settings.width = imageWidth;
+		if (imageHeight > 0) sweep.settings.height = imageHeight;
+		if (samplesPerPixel > 0) sweep.settings.samplesPerPixel = samplesPerPixel;
+		if (maxRayBounces > 0) sweep.settings.maxRayBounces = maxRayBounces;
+		if (benchmarkRuns > 0) sweep.settings.runs = benchmarkRuns;
+		if (benchmarkScenes) sweep.settings.scene = benchmarkScenes;
+		// the sweep goes up to --threads when given
+		if (threadCount > 0) sweep.settings.maxThreads = threadCount;
+		sweep.configure = setupKernels;
+
+		if (!sweep.Run(std::cout)) {
+			std::cerr << "Scaling run failed\n";
+			return 1;
+		}
+		return writeTrace() ? 0 : 1;
+	}
+
+	if (convergence) {
+		ConvergenceBenchmark convergenceRun;
+		ConvergenceSettings& settings = convergenceRun.settings;
+		if (imageWidth > 0) settings.width = imageWidth;
+		if (imageHeight > 0) settings.height = imageHeight;
+		if (maxRayBounces > 0) settings.maxRayBounces = maxRayBounces;
+		if (samplesPerPixel > 0) settings.passSpp = samplesPerPixel;
+		if (referenceSpp > 0) settings.referenceSpp = referenceSpp;
+		if (referencePath) settings.referencePath = referencePath;
+		if (benchmarkScenes) settings.scene = benchmarkScenes;
+		if (timePoints) {
+			settings.timePoints.clear();
+			for (const char* at = timePoints; *at; at = strchr(at, ',') ? strchr(at, ',') + 1 : at + strlen(at))
+				settings.timePoints.push_back(atof(at));
+			std::sort(settings.timePoints.begin(), settings.timePoints.end());
+		}
+
+		std::string names(convergence);
+		for (size_t start = 0; start <= names.size();) {
+			size_t end = std::min(names.find(',', start), names.size());
+			ConvergenceConfig config;
+			if (!GetConvergenceConfig(names.substr(start, end - start), setupKernels, config)) {
+				std::cerr << "Unknown configuration " << names.substr(start, end - start) << " (current, single, packets4, packets8, wavefront, float, generic)\n";
+				return 1;
+			}
+			convergenceRun.configs.push_back(config);
+			start = end + 1;
+		}
+
+		std::ofstream file;
+		if (convergenceOut)
+			file.open(convergenceOut);
+		if (!convergenceRun.Run(convergenceOut ? static_cast<std::ostream&>(file) : std::cout) || (convergenceOut && !file)) {
+			std::cerr << "Convergence run failed\n";
+			return 1;
+		}
+		return writeTrace() ? 0 : 1;
+	}
+
+	if (benchmark) {
+		RenderBenchmark bench;
+		if (imageWidth > 0) bench.settings.width = imageWidth;
+		if (imageHeight > 0) bench.settings.height = imageHeight;
+		if (samplesPerPixel > 0) bench.settings.samplesPerPixel = samplesPerPixel;
+		if (maxRayBounces > 0) bench.settings.maxRayBounces = maxRayBounces;
+		if (benchmarkRuns > 0) bench.settings.runs = benchmarkRuns;
+		if (benchmarkScenes) bench.settings.filter = benchmarkScenes;
+		bench.configure = setupKernels;
+
+		if (!bench.Run(std::cout) || !writeTrace())
+			return 1;
+
+		if (benchmarkOut) {
+			std::ofstream file(benchmarkOut);
+			bench.WriteJson(file);
+			if (!file) {
+				std::cerr << "Could not write " << benchmarkOut << "\n";
+				return 1;
+			}
+		}
+
+		if (baselinePath) {
+			std::vector<std::pair<std::string, double>> baseline;
+			if (!RenderBenchmark::LoadBaseline(baselinePath, baseline)) {
+				std::cerr << "Could not read baseline " << baselinePath << "\n";
+				return 1;
+			}
+			// a slowdown past the threshold fails the run
+			if (!bench.CompareBaseline(baseline, regressionThreshold, std::cout))
+				return 2;
+		}
+		return 0;
+	}
+
+	SceneDescription scene;
+	auto loadStart = high_resolution_clock::now();
+
+	{
+		TraceScope traceLoad("scene load");
+		if (scenePath) {
+			if (!scene.Load(scenePath)) {
+				std::cerr << "Could not load scene: " << scene.GetError() << "\n";
+				return 1;
 			}
 		}
+		else {
+			CreateBookScene(scene);
+		}
+	}
+
+	std::clog << "Scene: " << scene.GetSphereCount() << " spheres, " << scene.GetMaterialCount() << " materials"
+		<< (scene.IsMapped() ? " (binary)" : "") << (scene.WasLoadedFromCache() ? " (cached)" : "")
+		<< " loaded in " << duration_cast<microseconds>(high_resolution_clock::now() - loadStart).count() / 1000.0 << " ms\n";
+
+	if (saveScenePath) {
+		std::string path(saveScenePath);
+		bool binary = path.size() >= 5 && path.compare(path.size() - 5, 5, ".rtsb") == 0;
+		if (!(binary ? scene.SaveBinary(saveScenePath) : scene.SaveText(saveScenePath))) {
+			std::cerr << "Could not save scene " << saveScenePath << "\n";
+			return 1;
+		}
 	}
 
-	auto material1 = make_shared<Dielectric>(1.5);
-	world.add(make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
+	// command line settings override the scene's
+	if (imageWidth <= 0)
+		imageWidth = static_cast<int>(scene.render.width);
+	if (imageHeight <= 0)
+		imageHeight = static_cast<int>(scene.render.height);
+	if (samplesPerPixel <= 0)
+		samplesPerPixel = static_cast<int>(scene.render.samplesPerPixel);
+	if (maxRayBounces <= 0)
+		maxRayBounces = static_cast<int>(scene.render.maxRayBounces);
 
-	auto material2 = make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-	world.add(make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
+	if (imageWidth <= 0 || imageHeight <= 0) {
+		std::cerr << "Invalid resolution\n";
+		return 1;
+	}
+
+	auto buildStart = high_resolution_clock::now();
+	auto arena = make_shared<SceneArena>();
+	HittableList world;
+	MaterialTable materials;
+	{
+		TraceScope traceBuild("scene build", "spheres", static_cast<int64_t>(scene.GetSphereCount()));
+		scene.Build(world, materials, *arena);
+	}
+	std::clog << "Scene built in " << duration_cast<microseconds>(high_resolution_clock::now() - buildStart).count() / 1000.0 << " ms\n";
 
-	auto material3 = make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-	world.add(make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
+	shared_ptr<Texture> outputTexture;
+	shared_ptr<ImageSink> output;
 
-	Camera camera(outputTexture);
+	if (streamPath) {
+		StreamFormat format = ImageStream::FormatFromPath(streamPath);
+		if (streamFormat && !ImageStream::ParseFormat(streamFormat, format)) {
+			std::cerr << "Unknown stream format " << streamFormat << "\n";
+			return 1;
+		}
+
+		output = ImageStream::Open(streamPath, format);
+		if (!output) {
+			std::cerr << "Could not open stream " << streamPath << "\n";
+			return 1;
+		}
+	}
+	else {
+		outputTexture = make_shared<Texture>(imageWidth, imageHeight);
+		output = outputTexture;
+	}
+
+	// applies the scene and command line settings
+	auto setupCamera = [&](Camera& camera) {
+		camera.resolve = resolve;
+		SetCameraView(camera, scene.camera);
+
+		// render settings
+		camera.samplesPerPixel = samplesPerPixel;
+		camera.maxRayBounces = maxRayBounces;
+		camera.seed = seed;
+		setupKernels(camera);
+	};
+
+	if (comparePrecision) {
+		// both renders use the same random numbers so the difference is down to precision, not noise
+		auto reference = make_shared<Texture>(imageWidth, imageHeight);
+		auto single = make_shared<Texture>(imageWidth, imageHeight);
+		Camera referenceCamera(reference);
+		Camera singleCamera(single);
+		setupCamera(referenceCamera);
+		setupCamera(singleCamera);
+		referenceCamera.seed = singleCamera.seed = seed ? seed : 1;
+		referenceCamera.singlePrecision = false;
+		singleCamera.singlePrecision = true;
+
+		if (!referenceCamera.Render(world, materials) || !singleCamera.Render(world, materials))
+			return 1;
+
+		// error in 8-bit levels over the colour channels
+		const PixelColor* a = reference->GetPixels();
+		const PixelColor* b = single->GetPixels();
+		size_t values = static_cast<size_t>(imageWidth) * imageHeight * 3;
+		double sumSquared = 0, sum = 0;
+		int maxDifference = 0;
+		for (size_t i = 0; i < values; i++) {
+			int difference = b[i / 3].rgba[i % 3] - a[i / 3].rgba[i % 3];
+			sumSquared += difference * difference;
+			sum += difference;
+			maxDifference = std::max(maxDifference, std::abs(difference));
+		}
+
+		double doubleRate = referenceCamera.GetRayCount() / referenceCamera.GetRenderSeconds();
+		double floatRate = singleCamera.GetRayCount() / singleCamera.GetRenderSeconds();
+		std::clog << "Double: " << doubleRate / 1e6 << " Mrays/s, float: " << floatRate / 1e6 << " Mrays/s (" << floatRate / doubleRate << "x)\n";
+		std::clog << "Float vs double: RMSE " << sqrt(sumSquared / values) << ", mean difference " << sum / values
+			<< ", max difference " << maxDifference << " (8-bit levels)\n";
+		return 0;
+	}
+
+	Camera camera(imageWidth, imageHeight, output);
+	setupCamera(camera);
+
+	if (framebufferPath) {
+		AccumulationFormat format = halfAccumulation ? AccumulationFormat::Float16 : AccumulationFormat::Float32;
+		camera.accumulationBuffer = make_shared<TiledFramebuffer>(imageWidth, imageHeight, format, framebufferPath, residentTiles);
+		if (!camera.accumulationBuffer->IsValid()) {
+			std::cerr << "Could not create framebuffer " << framebufferPath << "\n";
+			return 1;
+		}
+	}
 
-	// camera transform
-	camera.lookfrom = Point3(13, 2, 3);
-	camera.lookat = Point3(0, 0, 0);
-	camera.vup = Vec3(0, 1, 0);
+	if (heatmap)
+		camera.costMap = make_shared<CostMap>(imageWidth, imageHeight);
 
-	// lens settings
-	camera.vfov = 20;
-	camera.defocusAngle = 0.6;
-	camera.focusDist = 10.0;
+	uint64_t incrementalFingerprint = 0;
+	if (incrementalPath) {
+		if (checkpointPath || camera.accumulationBuffer) {
+			std::cerr << "--incremental cannot be combined with --checkpoint or --framebuffer\n";
+			return 1;
+		}
+
+		// the stored pixels are reused for the same view and settings, tone mapping is applied after
+		const uint64_t options[] = { static_cast<uint64_t>(samplesPerPixel), static_cast<uint64_t>(maxRayBounces), seed,
+			singlePrecision, genericKernel };
+		incrementalFingerprint = HashBytes(options, sizeof(options), HashBytes(&scene.camera, sizeof(CameraRecord)));
+
+		camera.dependencyMap = make_shared<DependencyMap>(imageWidth, imageHeight);
+		if (camera.dependencyMap->Load(incrementalPath, incrementalFingerprint))
+			camera.dependencyMap->Invalidate(scene);
+		else
+			camera.dependencyMap->FitGrid(scene);
+	}
+
+	const size_t dirtyPixels = camera.dependencyMap ? camera.dependencyMap->GetDirtyCount() : 0;
+	if (checkpointPath) {
+		ProgressiveRender progressive;
+		ProgressiveRenderSettings& settings = progressive.settings;
+		settings.width = imageWidth;
+		settings.height = imageHeight;
+		settings.samplesPerPixel = samplesPerPixel;
+		if (passSpp > 0) settings.passSpp = passSpp;
+		settings.seed = seed;
+		settings.checkpointPath = checkpointPath;
+		settings.checkpointSeconds = checkpointSeconds;
+		settings.resume = resume;
+
+		// a checkpoint only continues the render of the same scene, view and path tracing options
+		uint64_t fingerprint = HashBytes(scene.GetSpheres(), scene.GetSphereCount() * sizeof(SphereRecord));
+		fingerprint = HashBytes(scene.GetMaterials(), scene.GetMaterialCount() * sizeof(MaterialRecord), fingerprint);
+		fingerprint = HashBytes(&scene.camera, sizeof(CameraRecord), fingerprint);
+		const uint64_t options[] = { static_cast<uint64_t>(maxRayBounces), static_cast<uint64_t>(packetSize), wavefront, reorderBounces,
+			singlePrecision, genericKernel };
+		settings.fingerprint = HashBytes(options, sizeof(options), fingerprint);
+
+		progressive.buffer = camera.accumulationBuffer;
+		progressive.configure = [&](Camera& pass) {
+			setupCamera(pass);
+			pass.costMap = camera.costMap;
+		};
+		if (!progressive.Run(world, materials, output))
+			return 1;
+	}
+	else if (!camera.Render(world, materials))
+		return 1;
+
+	if (camera.dependencyMap) {
+		const size_t pixels = static_cast<size_t>(imageWidth) * imageHeight;
+		std::clog << "Re-rendered " << dirtyPixels << " of " << pixels << " pixels (" << 100.0 * dirtyPixels / pixels << "%)\n";
+		if (!camera.dependencyMap->Save(incrementalPath, incrementalFingerprint, scene)) {
+			std::cerr << "Could not write " << incrementalPath << "\n";
+			return 1;
+		}
+	}
+
+	if (camera.costMap) {
+		for (int i = 0; i < static_cast<int>(CostMap::Metric::Count); i++) {
+			CostMap::Metric metric = static_cast<CostMap::Metric>(i);
+			std::string path = std::string("output_") + CostMap::GetName(metric) + ".png";
+			if (!camera.costMap->SaveHeatmap(path.c_str(), metric)) {
+				std::cerr << "Could not write " << path << "\n";
+				return 1;
+			}
+		}
+	}
+
+	if (camera.accumulationBuffer) {
+		std::clog << "Framebuffer: " << (camera.accumulationBuffer->GetFileBytes() >> 10) << " KiB on disk, "
+			<< (camera.accumulationBuffer->GetPeakResidentBytes() >> 10) << " KiB peak resident\n";
+	}
 	
-	// render settings
-	camera.samplesPerPixel = 500;
-	camera.maxRayBounces = 50;
+	MemoryStats::Print(std::clog);
 
-	camera.Render(world);
+	if (statsPath) {
+		if (!RenderStats::IsEnabled())
+			std::clog << "Render statistics are compiled out of this build, define RENDER_STATS=1 to count them\n";
+		if (strcmp(statsPath, "-") == 0) {
+			camera.GetRenderStats().WriteJson(std::cout);
+		}
+		else {
+			std::ofstream file(statsPath);
+			camera.GetRenderStats().WriteJson(file);
+			if (!file) {
+				std::cerr << "Could not write " << statsPath << "\n";
+				return 1;
+			}
+		}
+	}
 	
-	if (!outputTexture->SaveToFile("output.png"))
+	{
+		TraceScope traceSave("save png");
+		if (outputTexture && !outputTexture->SaveToFile("output.png"))
+			return 1;
+	}
+
+	if (!writeTrace())
 		return 1;
 
 	return 0;